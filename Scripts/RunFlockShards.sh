@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+# Runs a flock split across several server processes on this machine, then checks from their logs that every shard
+# reached its neighbors, that boids migrated between them, and that the flock stayed whole.
+#
+# Usage: Scripts/RunFlockShards.sh <shards> <seconds> <server command...>
+# e.g.   Scripts/RunFlockShards.sh 4 60 UnrealEditor "$PWD/BoidSimulation.uproject" /Game/Maps/Crowd
+#
+# FLOCK_SHARD_PORT picks the first shard's port (default 7800), each shard listens on the next one up.
+# FLOCK_SHARD_TOLERANCE is how far the summed boids may be off, to allow for migrants in flight (default 0.01).
+
+set -euo pipefail
+
+if [[ $# -lt 3 ]]; then
+	sed -n '5,6p' "$0" | sed 's/^# \{0,1\}//'
+	exit 2
+fi
+
+SHARDS=$1
+SECONDS_TO_RUN=$2
+shift 2
+
+PORT=${FLOCK_SHARD_PORT:-7800}
+TOLERANCE=${FLOCK_SHARD_TOLERANCE:-0.01}
+LOG_DIR=$(mktemp -d -t flock-shards.XXXXXX)
+
+PIDS=()
+cleanup() {
+	kill "${PIDS[@]}" 2>/dev/null || true
+	wait 2>/dev/null || true
+}
+trap cleanup EXIT
+
+for ((SHARD = 0; SHARD < SHARDS; ++SHARD)); do
+	"$@" -server -nullrhi -unattended -nosound -log -ABSLOG="$LOG_DIR/Shard$SHARD.log" -port=$((7777 + SHARD)) \
+		-FlockShard=$SHARD -FlockShards="$SHARDS" -FlockShardPort="$PORT" \
+		>/dev/null 2>&1 &
+	PIDS+=($!)
+done
+
+echo "Running $SHARDS shards for ${SECONDS_TO_RUN}s, logs in $LOG_DIR"
+sleep "$SECONDS_TO_RUN"
+cleanup
+trap - EXIT
+
+# The last status line of every flock in every shard, see BoidSimulation.Shard.StatusInterval:
+#   <Flock>: Shard <I>/<N> step <S>: <Owned> owned of <Total>, <Halo> halo, <In> migrated in, <Out> migrated out, <Connected>/<Neighbors> links
+for ((SHARD = 0; SHARD < SHARDS; ++SHARD)); do
+	grep -h ': Shard [0-9]*/[0-9]* step ' "$LOG_DIR/Shard$SHARD.log" || true
+done | awk -v Tolerance="$TOLERANCE" -v Shards="$SHARDS" '
+{
+	for (i = 1; i <= NF; ++i) {
+		if ($i == "Shard") { split($(i + 1), IndexCount, "/"); Shard = IndexCount[1] }
+		if ($i == "owned") { Owned = $(i - 1); Total = $(i + 2); sub(",", "", Total) }
+		if ($i == "in,") { In = $(i - 2) }
+		if ($i == "out,") { Out = $(i - 2) }
+		if ($i == "links") { Links = $(i - 1) }
+	}
+	Flock = $0; sub(/: Shard .*/, "", Flock); sub(/.*[ \]]/, "", Flock)
+	Key = Flock SUBSEP Shard
+	LastOwned[Key] = Owned; LastIn[Key] = In; LastOut[Key] = Out; LastLinks[Key] = Links
+	Totals[Flock] = Total
+}
+END {
+	Failed = 0
+	for (Flock in Totals) {
+		Sum = 0; Migrations = 0
+		for (Shard = 0; Shard < Shards; ++Shard) {
+			Key = Flock SUBSEP Shard
+			if (!(Key in LastOwned)) { printf "FAIL %s: shard %d never reported\n", Flock, Shard; Failed = 1; continue }
+			split(LastLinks[Key], ConnectedNeighbors, "/")
+			if (ConnectedNeighbors[1] != ConnectedNeighbors[2]) { printf "FAIL %s: shard %d only reached %s neighbors\n", Flock, Shard, LastLinks[Key]; Failed = 1 }
+			Sum += LastOwned[Key]; Migrations += LastIn[Key] + LastOut[Key]
+		}
+		Off = Sum > Totals[Flock] ? Sum - Totals[Flock] : Totals[Flock] - Sum
+		printf "%s: %d of %d boids across %d shards, %d migrations\n", Flock, Sum, Totals[Flock], Shards, Migrations
+		if (Off > Totals[Flock] * Tolerance) { printf "FAIL %s: %d boids unaccounted for\n", Flock, Off; Failed = 1 }
+		if (Migrations == 0) { printf "FAIL %s: no boid ever migrated\n", Flock; Failed = 1 }
+	}
+	if (length(Totals) == 0) { print "FAIL: no shard status in the logs"; Failed = 1 }
+	exit Failed
+}'
@@ -10,6 +10,6 @@ public class BoidSimulationTarget : TargetRules
 		Type = TargetType.Game;
 		DefaultBuildSettings = BuildSettingsVersion.V4;
 
-		ExtraModuleNames.AddRange( new string[] { "BoidSimulation" } );
+		ExtraModuleNames.AddRange( new string[] { "BoidSimulation", "BoidSimulationShaders" } );
 	}
 }
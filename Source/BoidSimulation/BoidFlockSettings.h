@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "BoidFlockSettings.generated.h"
+
+/**
+ * Tuning shared by every AFlock that references it. Each flock can still override individual values on itself.
+ * Flocks without an asset use the class defaults.
+ */
+UCLASS(BlueprintType)
+class BOIDSIMULATION_API UBoidFlockSettings : public UDataAsset
+{
+	GENERATED_BODY()
+public:
+	UPROPERTY(EditAnywhere, Category="Movement", meta=(ClampMin=0))
+	float MovementSpeed = 10.f;
+
+	// Default radius of every rule, and how far from the bounds boids start turning back.
+	UPROPERTY(EditAnywhere, Category="Rules", meta=(ClampMin=0))
+	float BoidsSearchNearbyRadius = 25.f;
+
+	UPROPERTY(EditAnywhere, Category="Rules", meta=(ClampMin=0))
+	float CohesionStrength = 0.75f;
+
+	UPROPERTY(EditAnywhere, Category="Rules", meta=(ClampMin=0))
+	float AvoidanceStrength = 0.75f;
+
+	UPROPERTY(EditAnywhere, Category="Rules", meta=(ClampMin=0))
+	float AlignmentStrength = 0.75f;
+
+	// Bumped on every edit. Flocks compare it at the start of their tick to pick up changes made while playing.
+	UE_NODISCARD FORCEINLINE uint32 GetRevision() const
+	{
+		return Revision;
+	}
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+private:
+	uint32 Revision = 0;
+};
@@ -3,4 +3,6 @@
 #include "BoidSimulation.h"
 #include "Modules/ModuleManager.h"
 
+DEFINE_LOG_CATEGORY(LogBoidSimulation);
+
 IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, BoidSimulation, "BoidSimulation" );
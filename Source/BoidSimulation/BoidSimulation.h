@@ -4,3 +4,7 @@
 
 #include "CoreMinimal.h"
 
+DECLARE_LOG_CATEGORY_EXTERN(LogBoidSimulation, Log, All);
+
+DECLARE_STATS_GROUP(TEXT("BoidSimulation"), STATGROUP_BoidSimulation, STATCAT_Advanced);
+
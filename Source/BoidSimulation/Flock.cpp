@@ -2,116 +2,1135 @@
 
 
 #include "Flock.h"
+#include "BoidFlockSettings.h"
+#include "BoidSimulation.h"
+#include "FlockRenderComponent.h"
+#include "FlockWarmState.h"
 #include "Components/InstancedStaticMeshComponent.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Engine/World.h"
+#include "Misc/App.h"
+#include "Misc/Crc.h"
+#include "Net/UnrealNetwork.h"
+#include "Misc/ScopedSlowTask.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/ObjectSaveContext.h"
 
-DECLARE_STATS_GROUP(TEXT("BoidSimulation"), STATGROUP_BoidSimulation, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Simulate (GT)"), STAT_Simulate_GameThread, STATGROUP_BoidSimulation);
+DECLARE_CYCLE_STAT(TEXT("Simulate (Task)"), STAT_Simulate_WorkerThread, STATGROUP_BoidSimulation);
+DECLARE_CYCLE_STAT(TEXT("Initialize Directions"), STAT_InitializeDirections, STATGROUP_BoidSimulation);
+DECLARE_CYCLE_STAT(TEXT("Find Nearby Boids"), STAT_FindNearbyBoids, STATGROUP_BoidSimulation);
+DECLARE_CYCLE_STAT(TEXT("Relocate Boid Cells"), STAT_RelocateBoidCells, STATGROUP_BoidSimulation);
+DECLARE_CYCLE_STAT(TEXT("Relocate Boid Cells Blocking Time"), STAT_RelocateBoidCellsBlockingTime, STATGROUP_BoidSimulation);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Initialize Buffers Batches"), STAT_InitializeBuffersBatches, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Steer Batches"), STAT_SteerBatches, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Integrate Batches"), STAT_IntegrateBatches, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Tiles"), STAT_Tiles, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Stolen Tiles"), STAT_StolenTiles, STATGROUP_BoidSimulation);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("BVH Rebuilds"), STAT_BVHRebuilds, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("BVH Nodes"), STAT_BVHNodes, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Collision Probes Issued"), STAT_CollisionProbesIssued, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Collision Probe Hits"), STAT_CollisionProbeHits, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Clusters"), STAT_Clusters, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Phased Region Partitions"), STAT_PhasedRegionPartitions, STATGROUP_BoidSimulation);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Initialize Buffers Avg Batch Size"), STAT_InitializeBuffersBatchSize, STATGROUP_BoidSimulation);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Steer Avg Batch Size"), STAT_SteerBatchSize, STATGROUP_BoidSimulation);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Integrate Avg Batch Size"), STAT_IntegrateBatchSize, STATGROUP_BoidSimulation);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Initialize Buffers Avg Batch Cost (us)"), STAT_InitializeBuffersBatchCost, STATGROUP_BoidSimulation);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Steer Avg Batch Cost (us)"), STAT_SteerBatchCost, STATGROUP_BoidSimulation);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Integrate Avg Batch Cost (us)"), STAT_IntegrateBatchCost, STATGROUP_BoidSimulation);
+
+namespace BoidSimulationCVars
+{
+static TAutoConsoleVariable<bool> EnableMultithreading{
+	TEXT("BoidSimulation.EnableMultithreading"),
+	true,
+	TEXT("")};
+
+static TAutoConsoleVariable<int32> Scheduling{
+	TEXT("BoidSimulation.Multithreading.Scheduling"),
+	0,
+	TEXT("0: Partition boids by index into adaptive batches. 1: Partition boids by spatial tiles of grid cells with work stealing. 2: Run all phases in one persistent parallel region separated by barriers, which locks spatial queries out of the whole step.")};
+
+static TAutoConsoleVariable<int32> TileSize{
+	TEXT("BoidSimulation.Multithreading.TileSize"),
+	4,
+	TEXT("Edge length in cells of a tile when BoidSimulation.Multithreading.Scheduling == 1.")};
+
+static TAutoConsoleVariable<int32> MinBoidsPerPartition{
+	TEXT("BoidSimulation.Multithreading.MinBoidsPerPartition"),
+	256,
+	TEXT("Smallest number of boids a thread is given when BoidSimulation.Multithreading.Scheduling == 2. Small flocks use fewer threads.")};
+
+static TAutoConsoleVariable<float> BVHRebuildQualityRatio{
+	TEXT("BoidSimulation.BVH.RebuildQualityRatio"),
+	1.5f,
+	TEXT("Rebuild the boid BVH instead of refitting it once its summed node area grows past this multiple of what it was when built.")};
+
+static TAutoConsoleVariable<bool> FarField{
+	TEXT("BoidSimulation.FarField"),
+	false,
+	TEXT("Approximate cohesion and alignment with per-cell sums for cells entirely inside both their radii, entirely outside the separation radius and not adjacent to the boid's own cell. ")
+	TEXT("Those cells skip the field of view and half-space tests, their sums are kept per species.")};
+
+static TAutoConsoleVariable<int32> SteeringMath{
+	TEXT("BoidSimulation.SteeringMath"),
+	0,
+	TEXT("0: Exact quaternion math for steering and orientation. 1: Bounded-error approximations without transcendentals, see FlockSteeringMath.h.")};
+
+static TAutoConsoleVariable<bool> CompactState{
+	TEXT("BoidSimulation.CompactState"),
+	false,
+	TEXT("Snapshot boids into 12 byte cell-relative fixed point locations and octahedral directions for the neighbor search and steering, rather than 48 bytes of doubles. ")
+	TEXT("A boid's own state stays full precision. See FFlockCompactBoid for the precision.")};
+
+static TAutoConsoleVariable<bool> DrawDebugBoundsSphere{
+	TEXT("BoidSimulation.DrawDebugBoundsSphere"),
+	false,
+	TEXT("")};
+
+static TAutoConsoleVariable<bool> DrawDebugClusters{
+	TEXT("BoidSimulation.DrawDebugClusters"),
+	false,
+	TEXT("Draws the bounds of every reported cluster.")};
+}
+
+namespace FlockStateVersion
+{
+// Leads every state block, so something that isn't one fails loudly instead of being read as boids.
+static constexpr uint32 Magic = 0x54534C46;
+
+enum Type : int32
+{
+	Initial = 0,
+
+	VersionPlusOne,
+	Latest = VersionPlusOne - 1
+};
+}
+
+AFlock::AFlock(const FObjectInitializer& ObjectInitializer)
+	: bOverride_MovementSpeed{false}
+	, bOverride_BoidsSearchNearbyRadius{false}
+	, bOverride_CohesionStrength{false}
+	, bOverride_AvoidanceStrength{false}
+	, bOverride_AlignmentStrength{false}
+{
+	PrimaryActorTick.bCanEverTick = true;
+
+	// Only replicates anything once Replicates is ticked. Relevance is worked out per boid, see FFlockReplicatedState.
+	bAlwaysRelevant = true;
+	
+	Mesh = ObjectInitializer.CreateDefaultSubobject<UInstancedStaticMeshComponent>(this, TEXT("Mesh"));
+	Mesh->SetCollisionProfileName(UCollisionProfile::NoCollision_ProfileName);
+	Mesh->SetCanEverAffectNavigation(false);
+	SetRootComponent(Mesh);
+
+	RenderComponent = ObjectInitializer.CreateDefaultSubobject<UFlockRenderComponent>(this, TEXT("RenderComponent"));
+	RenderComponent->SetupAttachment(Mesh);
+}
+
+void AFlock::BeginPlay()
+{
+	Super::BeginPlay();
+
+	checkf(NumInstances >= 0, TEXT("NumInstances == %i"), NumInstances);
+	checkf(BoundsRadius > 0.f, TEXT("Radius == %f"), BoundsRadius);
+	checkf(Species.Num() <= MAX_uint8 + 1, TEXT("Species.Num() == %i"), Species.Num());
+
+	// Nothing would ever see the boids, so don't pay for drawing them.
+	const EFlockRenderer ActiveRenderer = FApp::CanEverRender() ? Renderer : EFlockRenderer::None;
+	UE_CLOG(ActiveRenderer == EFlockRenderer::None, LogBoidSimulation, Log, TEXT("%s: Running headless, nothing is rendered."), *GetName());
+
+	bUpdateInstances = ActiveRenderer == EFlockRenderer::InstancedStaticMesh;
+	bPublishRenderFrames = ActiveRenderer == EFlockRenderer::FlockComponent;
+	Mesh->SetVisibility(bUpdateInstances, false);
+	RenderComponent->SetVisibility(bPublishRenderFrames);
+
+	ActiveInstanceEncoding = bUpdateInstances ? InstanceEncoding : EFlockInstanceEncoding::Transform;
+	if (ActiveInstanceEncoding == EFlockInstanceEncoding::Direction)
+	{
+		Mesh->SetNumCustomDataFloats(FlockInstanceEncoding::NumCustomDataFloats);
+	}
+
+	InitializeSimulation();
+
+	// Loaded from a save game or LoadState, or replicated, before play began.
+	if (GetNumSlots() > 0)
+	{
+		ApplyLoadedState();
+		return;
+	}
+
+	// Replicated boids only come from the server. Lockstep clients start once the server has, see FFlockLockstep::Tick.
+	if (!HasAuthority() && GetIsReplicated()) return;
+
+	const TOptional<FFlockShard::FConfig> ShardConfig = FFlockShard::ParseCommandLine();
+	if (ShardConfig && StartShard(*ShardConfig)) return;
+
+	if (ReplicationMode == EFlockReplicationMode::Lockstep)
+	{
+		LockstepState.Seed = LockstepSeed != 0 ? LockstepSeed : FMath::Max(FMath::Rand(), 1);
+		Lockstep.Start(*this);
+		return;
+	}
+
+	if (WarmState && WarmState->IsCompatible(*this))
+	{
+		LoadWarmState(*WarmState);
+		return;
+	}
+
+	UE_CLOG(WarmState != nullptr, LogBoidSimulation, Warning, TEXT("%s: %s was baked for a different configuration, scattering boids instead. Rebake it."), *GetName(), *WarmState->GetName());
+	ScatterBoids(FRandomStream{FMath::Rand()});
+}
+
+void AFlock::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Shard.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AFlock::InitializeSimulation()
+{
+	const int32 NumCells = GetNumCells();
+	BoidCells.SetNum(NumCells);
+	BoidCellSpinLocks.SetNum(NumCells);
+}
+
+void AFlock::ScatterBoids(const FRandomStream& Stream)
+{
+	TArray<FSpawnRequest> Requests;
+	MakeScatterRequests(Stream, Requests);
+	AddBoids(Requests);
+}
+
+void AFlock::MakeScatterRequests(const FRandomStream& Stream, TArray<FSpawnRequest>& OutRequests)
+{
+	const TConstArrayView<FFlockSpecies> ResolvedSpecies = GetSpeciesOrDefault();
+
+	float TotalSpawnWeight = 0.f;
+	for (const FFlockSpecies& Entry : ResolvedSpecies)
+	{
+		TotalSpawnWeight += Entry.SpawnWeight;
+	}
+
+	OutRequests.Reserve(NumInstances);
+	
+	for (int32 i = 0; i < NumInstances; ++i)
+	{
+		const FVector RandomLocation = Stream.VRand() * (Stream.FRand() * static_cast<double>(BoundsRadius));
+		const FRotator RandomRotation = FRotator{Stream.FRandRange(-180.f, 180.f), Stream.FRandRange(-180.f, 180.f), 0.f};
+
+		uint8 RandomSpecies = 0;
+		for (float Pick = Stream.FRand() * TotalSpawnWeight; RandomSpecies < ResolvedSpecies.Num() - 1 && Pick >= ResolvedSpecies[RandomSpecies].SpawnWeight; ++RandomSpecies)
+		{
+			Pick -= ResolvedSpecies[RandomSpecies].SpawnWeight;
+		}
+
+		OutRequests.Add(FSpawnRequest{FFlockBoidHandle{NextHandleId.fetch_add(1, std::memory_order_relaxed)}, FTransform{RandomRotation, RandomLocation}, RandomSpecies});
+	}
+}
+
+void AFlock::LoadWarmState(const UFlockWarmState& State)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Load Warm State"), STAT_LoadWarmState, STATGROUP_BoidSimulation);
+
+	check(GetNumSlots() == 0);
+
+	const int32 NumBoids = State.GetNumBoids();
+	const uint64 FirstId = NextHandleId.fetch_add(NumBoids, std::memory_order_relaxed);
+
+	BoidLocations.SetNumUninitialized(NumBoids);
+	BoidDirections.SetNumUninitialized(NumBoids);
+	BoidSpecies.SetNumUninitialized(NumBoids);
+	BoidProbeStates.SetNum(NumBoids);
+	BoidClusters.Init(INDEX_NONE, NumBoids);
+	SlotHandles.SetNumUninitialized(NumBoids);
+
+	const UFlockWarmState::FView View = State.Lock();
+
+	FMemory::Memcpy(BoidSpecies.GetData(), View.Species.GetData(), NumBoids);
+	ParallelFor(NumBoids, [&](const int32 Slot) -> void
+	{
+		BoidLocations[Slot] = FVector{View.Locations[Slot]};
+		BoidDirections[Slot] = FlockCompactState::DecodeDirection(View.Directions[Slot]);
+		SlotHandles[Slot] = FFlockBoidHandle{FirstId + Slot};
+	});
+
+	State.Unlock();
+
+	HandleToSlot.Reserve(NumBoids);
+	for (int32 Slot = 0; Slot < NumBoids; ++Slot)
+	{
+		HandleToSlot.Add(SlotHandles[Slot], Slot);
+	}
+
+	RebuildGrid();
+
+	if (bUpdateInstances)
+	{
+		AddAllInstances();
+	}
+
+	bBoidBVHNeedsRebuild = true;
+}
+
+void AFlock::AddAllInstances()
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Add All Instances"), STAT_AddAllInstances, STATGROUP_BoidSimulation);
+
+	check(Mesh->GetInstanceCount() == 0);
+
+	const int32 NumSlots = GetNumSlots();
+	const bool bEncodeDirection = ActiveInstanceEncoding == EFlockInstanceEncoding::Direction;
+	const EFlockSteeringMath SteeringMath = BoidSimulationCVars::SteeringMath.GetValueOnGameThread() == 1 ? EFlockSteeringMath::Fast : EFlockSteeringMath::Exact;
+
+	// Free slots still get an instance so slot and instance indices keep lining up, just a hidden one.
+	TArray<FTransform> Transforms;
+	Transforms.SetNumUninitialized(NumSlots);
+	ParallelFor(NumSlots, [&](const int32 Slot) -> void
+	{
+		if (!IsSlotAlive(Slot))
+		{
+			Transforms[Slot] = FTransform{FQuat::Identity, FVector::ZeroVector, FVector::ZeroVector};
+		}
+		else
+		{
+			Transforms[Slot] = bEncodeDirection ? FTransform{BoidLocations[Slot]} : FTransform{FlockSteeringMath::DirectionToQuat(BoidDirections[Slot], SteeringMath), BoidLocations[Slot]};
+		}
+	});
+
+	Mesh->AddInstances(Transforms, false, false);
+
+	if (bEncodeDirection)
+	{
+		ParallelFor(NumSlots, [&](const int32 Slot) -> void
+		{
+			WriteInstanceDirection(Slot);
+		});
+	}
+}
+
+void AFlock::RebuildGrid()
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Rebuild Grid"), STAT_RebuildGrid, STATGROUP_BoidSimulation);
+
+	const int32 NumSlots = GetNumSlots();
+	const int32 NumCells = BoidCells.Num();
+
+	TArray<int32> SlotCells;
+	SlotCells.SetNumUninitialized(NumSlots);
+	ParallelFor(NumSlots, [&](const int32 Slot) -> void
+	{
+		SlotCells[Slot] = IsSlotAlive(Slot) ? GetCellIndex(BoidLocations[Slot]) : INDEX_NONE;
+	});
+
+	// Cell I owns [CellOffsets[I], CellOffsets[I + 1]) of SortedSlots. Slots stay in index order within a cell.
+	TArray<int32> CellOffsets;
+	CellOffsets.SetNumZeroed(NumCells + 1);
+	for (const int32 CellIndex : SlotCells)
+	{
+		if (CellIndex != INDEX_NONE)
+		{
+			++CellOffsets[CellIndex + 1];
+		}
+	}
+
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		CellOffsets[CellIndex + 1] += CellOffsets[CellIndex];
+	}
+
+	TArray<int32> SortedSlots;
+	SortedSlots.SetNumUninitialized(CellOffsets[NumCells]);
+	{
+		TArray<int32> WriteOffsets(CellOffsets.GetData(), NumCells);
+		for (int32 Slot = 0; Slot < NumSlots; ++Slot)
+		{
+			if (SlotCells[Slot] != INDEX_NONE)
+			{
+				SortedSlots[WriteOffsets[SlotCells[Slot]]++] = Slot;
+			}
+		}
+	}
+
+	ParallelFor(NumCells, [&](const int32 CellIndex) -> void
+	{
+		TArray<int32, TInlineAllocator<4>>& Cell = BoidCells[CellIndex];
+		Cell.Reset();
+		Cell.Append(SortedSlots.GetData() + CellOffsets[CellIndex], CellOffsets[CellIndex + 1] - CellOffsets[CellIndex]);
+	});
+}
+
+void AFlock::SaveState(TArray<uint8>& OutBytes)
+{
+	FMemoryWriter Writer{OutBytes};
+	Writer.ArIsSaveGame = true;
+	SerializeState(Writer);
+}
+
+void AFlock::LoadState(const TConstArrayView<uint8>& Bytes)
+{
+	FMemoryReaderView Reader{MakeArrayView(Bytes.GetData(), Bytes.Num())};
+	Reader.ArIsSaveGame = true;
+	SerializeState(Reader);
+}
+
+void AFlock::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(AFlock, ReplicatedState);
+	DOREPLIFETIME(AFlock, LockstepState);
+}
+
+void AFlock::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	// Only save games carry the simulation. Saving packages, undo and duplication keep dealing with the configuration alone.
+	if (Ar.IsSaveGame())
+	{
+		SerializeState(Ar);
+	}
+}
+
+void AFlock::SerializeState(FArchive& Ar)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Serialize State"), STAT_SerializeState, STATGROUP_BoidSimulation);
+
+	// Written into the block itself rather than as a custom version, which plain memory archives don't keep.
+	uint32 Magic = FlockStateVersion::Magic;
+	int32 Version = FlockStateVersion::Latest;
+	Ar << Magic;
+	Ar << Version;
+
+	if (Ar.IsLoading() && !Ar.IsError() && (Magic != FlockStateVersion::Magic || Version < FlockStateVersion::Initial || Version > FlockStateVersion::Latest))
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("%s: Not a flock state this build can read (magic 0x%08X, version %i, latest %i)."), *GetName(), Magic, Version, static_cast<int32>(FlockStateVersion::Latest));
+		Ar.SetError();
+		return;
+	}
+
+	// Live boids only, packed densely as one plain array per buffer: locations, directions, handles, species. Raw memory, so little endian only.
+	constexpr int32 BytesPerBoid = sizeof(FVector) * 2 + sizeof(FFlockBoidHandle) + sizeof(uint8);
+
+	int32 NumBoids = 0;
+	uint64 NextId = 0;
+	bool bCompressed = false;
+	int32 UncompressedSize = 0;
+	TArray<uint8> Payload;
+
+	if (Ar.IsSaving())
+	{
+		TArray<int32> LiveSlots;
+		LiveSlots.Reserve(HandleToSlot.Num());
+		for (int32 Slot = 0; Slot < GetNumSlots(); ++Slot)
+		{
+			if (IsSlotAlive(Slot))
+			{
+				LiveSlots.Add(Slot);
+			}
+		}
+
+		NumBoids = LiveSlots.Num();
+		NextId = NextHandleId.load(std::memory_order_relaxed);
+		UncompressedSize = NumBoids * BytesPerBoid;
+
+		TArray<uint8> Raw;
+		Raw.SetNumUninitialized(UncompressedSize);
+
+		FVector* Locations = reinterpret_cast<FVector*>(Raw.GetData());
+		FVector* Directions = Locations + NumBoids;
+		FFlockBoidHandle* Handles = reinterpret_cast<FFlockBoidHandle*>(Directions + NumBoids);
+		uint8* SavedSpecies = reinterpret_cast<uint8*>(Handles + NumBoids);
+
+		ParallelFor(NumBoids, [&](const int32 i) -> void
+		{
+			const int32 Slot = LiveSlots[i];
+			Locations[i] = BoidLocations[Slot];
+			Directions[i] = BoidDirections[Slot];
+			Handles[i] = SlotHandles[Slot];
+			SavedSpecies[i] = BoidSpecies[Slot];
+		});
+
+		if (bCompressSavedState && UncompressedSize > 0)
+		{
+			int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Oodle, UncompressedSize);
+			Payload.SetNumUninitialized(CompressedSize);
+			bCompressed = FCompression::CompressMemory(NAME_Oodle, Payload.GetData(), CompressedSize, Raw.GetData(), UncompressedSize, COMPRESS_BiasSpeed);
+			Payload.SetNum(bCompressed ? CompressedSize : 0, false);
+		}
+
+		if (!bCompressed)
+		{
+			Payload = MoveTemp(Raw);
+		}
+	}
+
+	Ar << NumBoids;
+	Ar << NextId;
+	Ar << bCompressed;
+	Ar << UncompressedSize;
+	Ar << Payload;
+
+	if (!Ar.IsLoading() || Ar.IsError()) return;
+
+	if (NumBoids < 0 || UncompressedSize != NumBoids * BytesPerBoid)
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("%s: Corrupt flock state, %i boids in %i bytes."), *GetName(), NumBoids, UncompressedSize);
+		Ar.SetError();
+		return;
+	}
+
+	TArray<uint8> Raw;
+	if (bCompressed)
+	{
+		Raw.SetNumUninitialized(UncompressedSize);
+		if (!FCompression::UncompressMemory(NAME_Oodle, Raw.GetData(), UncompressedSize, Payload.GetData(), Payload.Num()))
+		{
+			UE_LOG(LogBoidSimulation, Error, TEXT("%s: Failed to decompress flock state."), *GetName());
+			Ar.SetError();
+			return;
+		}
+	}
+	else
+	{
+		Raw = MoveTemp(Payload);
+	}
+
+	if (Raw.Num() != UncompressedSize)
+	{
+		Ar.SetError();
+		return;
+	}
+
+	const FVector* Locations = reinterpret_cast<const FVector*>(Raw.GetData());
+	const FVector* Directions = Locations + NumBoids;
+	const FFlockBoidHandle* Handles = reinterpret_cast<const FFlockBoidHandle*>(Directions + NumBoids);
+	const uint8* SavedSpecies = reinterpret_cast<const uint8*>(Handles + NumBoids);
+
+	FRWScopeLock Lock{SimulationLock, SLT_Write};
+
+	// Queued spawns and despawns refer to the old boids, or were made against handles that are about to be replaced anyway.
+	PendingSpawns.Empty();
+	PendingDespawns.Empty();
+	UnknownDespawns.Reset();
+	InFlightCollisionProbes.Reset();
+	FreeSlots.Reset();
+
+	BoidLocations.SetNumUninitialized(NumBoids);
+	BoidDirections.SetNumUninitialized(NumBoids);
+	SlotHandles.SetNumUninitialized(NumBoids);
+	BoidSpecies.SetNumUninitialized(NumBoids);
+	BoidProbeStates.Reset();
+	BoidProbeStates.SetNum(NumBoids);
+	BoidClusters.Init(INDEX_NONE, NumBoids);
+	Clusters.Reset();
+
+	FMemory::Memcpy(BoidLocations.GetData(), Locations, NumBoids * sizeof(FVector));
+	FMemory::Memcpy(BoidDirections.GetData(), Directions, NumBoids * sizeof(FVector));
+	FMemory::Memcpy(SlotHandles.GetData(), Handles, NumBoids * sizeof(FFlockBoidHandle));
+	FMemory::Memcpy(BoidSpecies.GetData(), SavedSpecies, NumBoids);
+
+	// Species that no longer exist fall back to the first, like spawns do.
+	const int32 NumSpecies = GetNumSpecies();
+	ParallelFor(NumBoids, [&](const int32 Slot) -> void
+	{
+		if (BoidSpecies[Slot] >= NumSpecies)
+		{
+			BoidSpecies[Slot] = 0;
+		}
+	});
+
+	HandleToSlot.Reset();
+	HandleToSlot.Reserve(NumBoids);
+	for (int32 Slot = 0; Slot < NumBoids; ++Slot)
+	{
+		HandleToSlot.Add(SlotHandles[Slot], Slot);
+	}
+
+	NextHandleId.store(FMath::Max(NextId, NextHandleId.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+
+	// Otherwise BeginPlay picks it up.
+	if (HasActorBegunPlay())
+	{
+		ApplyLoadedState();
+	}
+}
+
+void AFlock::ApplyLoadedState()
+{
+	InitializeSimulation();
+	RebuildGrid();
+
+	if (bUpdateInstances)
+	{
+		Mesh->ClearInstances();
+		AddAllInstances();
+	}
+
+	RebuildBoidBVH();
+}
+
+#if WITH_EDITOR
+void AFlock::BakeWarmState()
+{
+	if (!WarmState)
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("%s: Assign a WarmState asset to bake into first."), *GetName());
+		return;
+	}
+
+	if (HasActorBegunPlay())
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("%s: Warm states can only be baked outside of play."), *GetName());
+		return;
+	}
+
+	// Runs on this actor's own buffers, which are empty outside of play, without ever touching its components since bUpdateInstances is still false.
+	InitializeSimulation();
+	ScatterBoids(FRandomStream{FMath::Rand()});
+	bParametersDirty = true;
+	UpdateParameters();
+	bInfluenceFieldDirty = true;
+	UpdateInfluenceField();
+
+	const int32 NumSteps = FMath::CeilToInt32(WarmUpSeconds / WarmUpTimeStep);
+
+	FScopedSlowTask SlowTask{static_cast<float>(NumSteps), FText::FromString(FString::Printf(TEXT("Baking %s"), *WarmState->GetName()))};
+	SlowTask.MakeDialog(true);
+
+	for (int32 Step = 0; Step < NumSteps && !SlowTask.ShouldCancel(); ++Step)
+	{
+		SlowTask.EnterProgressFrame();
+		SimulateAsynchronously(WarmUpTimeStep);
+	}
+
+	if (!SlowTask.ShouldCancel())
+	{
+		WarmState->Modify();
+		WarmState->Store(*this, BoidLocations, BoidDirections, BoidSpecies, NumSteps * WarmUpTimeStep);
+		WarmState->MarkPackageDirty();
+	}
+
+	BoidLocations.Empty();
+	BoidDirections.Empty();
+	BoidSpecies.Empty();
+	BoidProbeStates.Empty();
+	BoidClusters.Empty();
+	SlotHandles.Empty();
+	FreeSlots.Empty();
+	HandleToSlot.Empty();
+	BoidCells.Empty();
+	BoidCellSpinLocks.Empty();
+	InfluenceField.Empty();
+	bInfluenceFieldDirty = true;
+	bRenderFramePending = false;
+}
+#endif
+
+void AFlock::PreSave(FObjectPreSaveContext SaveContext)
+{
+	Super::PreSave(SaveContext);
+
+	// A stale warm state still works, it just silently falls back to scattering at runtime. Flag it while it can still be rebaked.
+	UE_CLOG(SaveContext.IsCooking() && WarmState && !WarmState->IsCompatible(*this), LogBoidSimulation, Warning,
+		TEXT("%s: %s no longer matches the flock's configuration and will be ignored. Rebake it with BakeWarmState."), *GetPathName(), *WarmState->GetName());
+}
+
+void AFlock::SpawnBoids(const TConstArrayView<FTransform>& Transforms, TArray<FFlockBoidHandle>& OutHandles, const int32 SpeciesIndex)
+{
+	if (Transforms.IsEmpty()) return;
+
+	// Reserve a contiguous block of ids in one go.
+	const uint64 FirstId = NextHandleId.fetch_add(Transforms.Num(), std::memory_order_relaxed);
+
+	TArray<FSpawnRequest> Requests;
+	Requests.Reserve(Transforms.Num());
+	OutHandles.Reserve(OutHandles.Num() + Transforms.Num());
+
+	for (int32 i = 0; i < Transforms.Num(); ++i)
+	{
+		const FFlockBoidHandle Handle{FirstId + i};
+		Requests.Add(FSpawnRequest{Handle, Transforms[i], static_cast<uint8>(FMath::Clamp(SpeciesIndex, 0, MAX_uint8))});
+		OutHandles.Add(Handle);
+	}
+
+	PendingSpawns.Enqueue(MoveTemp(Requests));
+}
+
+void AFlock::DespawnBoids(const TConstArrayView<FFlockBoidHandle>& Handles)
+{
+	if (Handles.IsEmpty()) return;
+
+	PendingDespawns.Enqueue(TArray<FFlockBoidHandle>{Handles});
+}
+
+void AFlock::QueryBoids(const TConstArrayView<FFlockSpatialQuery>& Queries, FFlockSpatialQueryResults& OutResults) const
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Query Boids"), STAT_QueryBoids, STATGROUP_BoidSimulation);
+
+	FRWScopeLock Lock{SimulationLock, SLT_ReadOnly};
+
+	const int32 NumQueries = Queries.Num();
+	OutResults.Offsets.SetNumUninitialized(NumQueries + 1);
+	OutResults.Offsets[0] = 0;
+
+	// Count, prefix sum, then fill. Every query writes straight into its own span of the flat buffers.
+	ParallelFor(NumQueries, [&](const int32 QueryIndex) -> void
+	{
+		int32 Count = 0;
+		ForEachBoidInQuery(Queries[QueryIndex], [&](int32) -> void { ++Count; });
+		OutResults.Offsets[QueryIndex + 1] = Count;
+	});
+
+	for (int32 QueryIndex = 0; QueryIndex < NumQueries; ++QueryIndex)
+	{
+		OutResults.Offsets[QueryIndex + 1] += OutResults.Offsets[QueryIndex];
+	}
+
+	OutResults.Handles.SetNumUninitialized(OutResults.Offsets[NumQueries], false);
+	OutResults.Locations.SetNumUninitialized(OutResults.Offsets[NumQueries], false);
+
+	ParallelFor(NumQueries, [&](const int32 QueryIndex) -> void
+	{
+		int32 WriteIndex = OutResults.Offsets[QueryIndex];
+		ForEachBoidInQuery(Queries[QueryIndex], [&](const int32 Slot) -> void
+		{
+			OutResults.Handles[WriteIndex] = SlotHandles[Slot];
+			OutResults.Locations[WriteIndex] = BoidLocations[Slot];
+			++WriteIndex;
+		});
+	});
+}
+
+void AFlock::TraceBoids(const TConstArrayView<FFlockBoidTrace>& Traces, TArray<FFlockBoidTraceHit>& OutHits) const
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Trace Boids"), STAT_TraceBoids, STATGROUP_BoidSimulation);
+
+	ensureMsgf(bEnableBoidTraces, TEXT("%s: TraceBoids requires bEnableBoidTraces"), *GetName());
+
+	FRWScopeLock Lock{SimulationLock, SLT_ReadOnly};
+
+	OutHits.SetNum(Traces.Num(), false);
+
+	const auto IsAlive = [this](const int32 Slot) -> bool { return IsSlotAlive(Slot); };
+
+	ParallelFor(Traces.Num(), [&](const int32 TraceIndex) -> void
+	{
+		const FFlockBoidTrace& Trace = Traces[TraceIndex];
+		FFlockBoidTraceHit& Hit = OutHits[TraceIndex];
+
+		double Time = 1.0;
+		const int32 Slot = BoidBVH.Sweep(Trace.Start, Trace.End, Trace.SweepRadius, BoidLocations, IsAlive, Time);
+		if (Slot == INDEX_NONE)
+		{
+			Hit = FFlockBoidTraceHit{};
+			return;
+		}
+
+		Hit.Handle = SlotHandles[Slot];
+		Hit.BoidLocation = BoidLocations[Slot];
+		Hit.Time = Time;
+	});
+}
+
+void AFlock::ReadBuffers(const TFunctionRef<void(const FBufferViews&)>& Functor) const
+{
+	FRWScopeLock Lock{SimulationLock, SLT_ReadOnly};
+	Functor(FBufferViews{BoidLocations, BoidDirections, SlotHandles, BoidSpecies, BoidClusters});
+}
+
+void AFlock::UpdateBoidBVH()
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Update BVH"), STAT_UpdateBVH, STATGROUP_BoidSimulation);
+
+	FRWScopeLock Lock{SimulationLock, SLT_Write};
+
+	if (!bBoidBVHNeedsRebuild)
+	{
+		BoidBVH.Refit(BoidLocations);
+		bBoidBVHNeedsRebuild = BoidBVH.GetQualityRatio() > BoidSimulationCVars::BVHRebuildQualityRatio.GetValueOnGameThread();
+	}
+
+	if (bBoidBVHNeedsRebuild)
+	{
+		RebuildBoidBVH();
+	}
+
+	SET_DWORD_STAT(STAT_BVHNodes, BoidBVH.GetNumNodes());
+}
+
+void AFlock::RebuildBoidBVH()
+{
+	if (bEnableBoidTraces)
+	{
+		BoidBVH.Build(BoidLocations, [this](const int32 Slot) -> bool { return IsSlotAlive(Slot); }, BoidRadius);
+		INC_DWORD_STAT(STAT_BVHRebuilds);
+	}
+	else
+	{
+		BoidBVH.Reset();
+	}
+
+	bBoidBVHNeedsRebuild = false;
+}
+
+void AFlock::ConsumeCollisionProbes()
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Consume Collision Probes"), STAT_ConsumeCollisionProbes, STATGROUP_BoidSimulation);
+
+	UWorld* World = GetWorld();
+	const FTransform& ActorTransform = GetActorTransform();
+
+	int32 NumHits = 0;
+	for (const FCollisionProbe& Probe : InFlightCollisionProbes)
+	{
+		const int32* Slot = HandleToSlot.Find(Probe.Boid);
+		if (!Slot) continue;// Despawned since
+
+		FTraceDatum Datum;
+		if (!World->QueryTraceData(Probe.Trace, Datum)) continue;// Not done, which shouldn't happen a frame later. The boid just gets picked again.
+
+		FBoidProbeState& State = BoidProbeStates[*Slot];
+
+		const FHitResult* Hit = Datum.OutHits.FindByPredicate([](const FHitResult& Candidate) -> bool { return Candidate.bBlockingHit; });
+		if (!Hit)
+		{
+			State.Avoidance = FVector::ZeroVector;
+			State.Proximity = 0.f;
+			continue;
+		}
+
+		State.Proximity = 1.f - Hit->Time;
+		State.Avoidance = ActorTransform.InverseTransformVectorNoScale(Hit->ImpactNormal) * (State.Proximity * CollisionAvoidanceStrength);
+		++NumHits;
+	}
+
+	InFlightCollisionProbes.Reset();
+
+	SET_DWORD_STAT(STAT_CollisionProbeHits, NumHits);
+}
+
+void AFlock::IssueCollisionProbes(const FParameterBlock& InParameters)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Issue Collision Probes"), STAT_IssueCollisionProbes, STATGROUP_BoidSimulation);
+
+	struct FCandidate
+	{
+		float Priority;
+		int32 Slot;
+
+		// Min-heap on priority, so the least urgent of the picked boids is the one to evict.
+		UE_NODISCARD FORCEINLINE bool operator<(const FCandidate& Other) const
+		{
+			return Priority < Other.Priority;
+		}
+	};
+
+	const int32 Budget = FMath::Min(CollisionProbeBudget, GetNumBoids());
+
+	TArray<FCandidate, TMemStackAllocator<>> Heap;
+	Heap.Reserve(Budget);
+
+	for (int32 Slot = 0; Slot < GetNumSlots(); ++Slot)
+	{
+		if (!IsSlotAlive(Slot)) continue;
+
+		FBoidProbeState& State = BoidProbeStates[Slot];
+		State.FramesSinceProbe = FMath::Min<int32>(State.FramesSinceProbe + 1, MAX_uint16);
+
+		if (Budget == 0) continue;
+
+		// Fast boids cover more ground between probes, and boids that were about to hit something are likely still about to.
+		const float Priority = State.FramesSinceProbe * InParameters.SpeciesRules[BoidSpecies[Slot]].MovementSpeed * (1.f + State.Proximity * CollisionProximityPriority);
+		if (Heap.Num() < Budget)
+		{
+			Heap.HeapPush(FCandidate{Priority, Slot});
+		}
+		else if (Priority > Heap.HeapTop().Priority)
+		{
+			Heap.HeapPopDiscard(false);
+			Heap.HeapPush(FCandidate{Priority, Slot});
+		}
+	}
+
+	UWorld* World = GetWorld();
+	const FTransform& ActorTransform = GetActorTransform();
+	const FCollisionQueryParams QueryParams{SCENE_QUERY_STAT(BoidCollisionProbe), false, this};
+
+	for (const FCandidate& Candidate : Heap)
+	{
+		const FVector Start = ActorTransform.TransformPosition(BoidLocations[Candidate.Slot]);
+		const FVector End = ActorTransform.TransformPosition(BoidLocations[Candidate.Slot] + BoidDirections[Candidate.Slot] * CollisionProbeDistance);
+
+		InFlightCollisionProbes.Add(FCollisionProbe{SlotHandles[Candidate.Slot], World->AsyncLineTraceByChannel(EAsyncTraceType::Single, Start, End, CollisionProbeChannel, QueryParams)});
+		BoidProbeStates[Candidate.Slot].FramesSinceProbe = 0;
+	}
+
+	SET_DWORD_STAT(STAT_CollisionProbesIssued, Heap.Num());
+}
+
+void AFlock::AddBoids(const TConstArrayView<FSpawnRequest>& Requests)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Add Boids"), STAT_AddBoids, STATGROUP_BoidSimulation);
+
+	const bool bEncodeDirection = ActiveInstanceEncoding == EFlockInstanceEncoding::Direction;
+	const int32 FirstAppendedSlot = GetNumSlots();
+
+	TArray<FTransform> AppendedTransforms;
+	for (const FSpawnRequest& Request : Requests)
+	{
+		// The material applies the rotation when only the direction is encoded.
+		const FTransform InstanceTransform = bEncodeDirection ? FTransform{Request.Transform.GetTranslation()} : Request.Transform;
+
+		int32 Slot;
+		if (!FreeSlots.IsEmpty())
+		{
+			Slot = FreeSlots.Pop(false);
+			if (bUpdateInstances)
+			{
+				Mesh->UpdateInstanceTransform(Slot, InstanceTransform);
+			}
+		}
+		else
+		{
+			// Appended slots line up with the ISM instances added below.
+			Slot = SlotHandles.AddUninitialized();
+			BoidLocations.AddUninitialized();
+			BoidDirections.AddUninitialized();
+			BoidSpecies.AddUninitialized();
+			BoidProbeStates.AddUninitialized();
+			BoidClusters.AddUninitialized();
+			if (bUpdateInstances)
+			{
+				AppendedTransforms.Add(InstanceTransform);
+			}
+		}
 
-DECLARE_CYCLE_STAT(TEXT("Simulate (GT)"), STAT_Simulate_GameThread, STATGROUP_BoidSimulation);
-DECLARE_CYCLE_STAT(TEXT("Simulate (Task)"), STAT_Simulate_WorkerThread, STATGROUP_BoidSimulation);
-DECLARE_CYCLE_STAT(TEXT("Initialize Directions"), STAT_InitializeDirections, STATGROUP_BoidSimulation);
-DECLARE_CYCLE_STAT(TEXT("Find Nearby Boids"), STAT_FindNearbyBoids, STATGROUP_BoidSimulation);
-DECLARE_CYCLE_STAT(TEXT("Relocate Boid Cells"), STAT_RelocateBoidCells, STATGROUP_BoidSimulation);
-DECLARE_CYCLE_STAT(TEXT("Relocate Boid Cells Blocking Time"), STAT_RelocateBoidCellsBlockingTime, STATGROUP_BoidSimulation);
+		BoidLocations[Slot] = Request.Transform.GetTranslation();
+		BoidDirections[Slot] = Request.Transform.GetUnitAxis(EAxis::X);
+		SlotHandles[Slot] = Request.Handle;
+		BoidSpecies[Slot] = Request.Species < GetNumSpecies() ? Request.Species : 0;
+		BoidProbeStates[Slot] = FBoidProbeState{};
+		BoidClusters[Slot] = INDEX_NONE;
+		HandleToSlot.Add(Request.Handle, Slot);
 
-namespace BoidSimulationCVars
-{
-static TAutoConsoleVariable<bool> EnableMultithreading{
-	TEXT("BoidSimulation.EnableMultithreading"),
-	true,
-	TEXT("")};
+		BoidCells[GetCellIndex(BoidLocations[Slot])].Add(Slot);
 
-static TAutoConsoleVariable<int32> BatchSize{
-	TEXT("BoidSimulation.Multithreading.BatchSize"),\
-	64,
-	TEXT("")};
-	
-static TAutoConsoleVariable<bool> DrawDebugBoundsSphere{
-	TEXT("BoidSimulation.DrawDebugBoundsSphere"),
-	false,
-	TEXT("")};
+		if (bEncodeDirection && Slot < FirstAppendedSlot)
+		{
+			WriteInstanceDirection(Slot);
+		}
+	}
 
-static TAutoConsoleVariable<float> CohesionStrength{
-	TEXT("BoidSimulation.CohesionStrength"),
-	0.75f,
-	TEXT("")};
+	// Recycled slots aren't in the BVH either, it only ever covers the boids alive when it was built.
+	if (!Requests.IsEmpty())
+	{
+		bBoidBVHNeedsRebuild = true;
+	}
 
-static TAutoConsoleVariable<float> AvoidanceStrength{
-	TEXT("BoidSimulation.AvoidanceStrength"),
-	0.75f,
-	TEXT("")};
+	if (!AppendedTransforms.IsEmpty())
+	{
+		Mesh->AddInstances(AppendedTransforms, false, false);
 
-static TAutoConsoleVariable<float> AlignmentStrength{
-	TEXT("BoidSimulation.AlignmentStrength"),
-	0.75f,
-	TEXT("")};
+		if (bEncodeDirection)
+		{
+			for (int32 Slot = FirstAppendedSlot; Slot < GetNumSlots(); ++Slot)
+			{
+				WriteInstanceDirection(Slot);
+			}
+		}
+	}
 }
 
-AFlock::AFlock(const FObjectInitializer& ObjectInitializer)
+void AFlock::ApplyReplicatedBoids(const TConstArrayView<FFlockBoidHandle>& Removed, const TConstArrayView<FReplicatedBoid>& Boids)
 {
-	PrimaryActorTick.bCanEverTick = true;
-	
-	Mesh = ObjectInitializer.CreateDefaultSubobject<UInstancedStaticMeshComponent>(this, TEXT("Mesh"));
-	Mesh->SetCollisionProfileName(UCollisionProfile::NoCollision_ProfileName);
-	Mesh->SetCanEverAffectNavigation(false);
-	SetRootComponent(Mesh);
-}
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Apply Replicated Boids"), STAT_ApplyReplicatedBoids, STATGROUP_BoidSimulation);
 
-void AFlock::BeginPlay()
-{
-	Super::BeginPlay();
+	FRWScopeLock Lock{SimulationLock, SLT_Write};
 
-	checkf(NumInstances > 0, TEXT("NumInstances == %i"), NumInstances);
-	checkf(BoundsRadius > 0.f, TEXT("Radius == %f"), BoundsRadius);
+	// Updates can arrive before BeginPlay.
+	if (BoidCells.IsEmpty())
+	{
+		InitializeSimulation();
+	}
 
-	const int32 NumCells = GetNumCells();
-	BoidCells.SetNum(NumCells);
-	BoidCellSpinLocks.SetNum(NumCells);
+	RemoveBoids(Removed);
 
-	TArray<FTransform> Transforms;
-	Transforms.Reserve(NumInstances);
-	
-	for (int32 i = 0; i < NumInstances; ++i)
+	// Instances pick up the new transforms when the boids are next integrated.
+	TArray<FSpawnRequest> Added;
+	for (const FReplicatedBoid& Boid : Boids)
 	{
-		const FVector RandomLocation = FMath::VRand() * FMath::RandRange(0.0, static_cast<double>(BoundsRadius));
-		const FRotator RandomRotation = FRotator{FMath::RandRange(-180.0, 180.0), FMath::RandRange(-180.0, 180.0), 0.0};
-		Transforms.Emplace(RandomRotation, RandomLocation);
+		const int32* Slot = HandleToSlot.Find(Boid.Handle);
+		if (!Slot)
+		{
+			Added.Add(FSpawnRequest{Boid.Handle, FTransform{Boid.Direction.ToOrientationQuat(), Boid.Location}, Boid.Species});
+			continue;
+		}
 
-		BoidCells[GetCellIndex(RandomLocation)].Add(i);
+		RelocateBoidCell(*Slot, BoidLocations[*Slot], Boid.Location);
+		BoidLocations[*Slot] = Boid.Location;
+		BoidDirections[*Slot] = Boid.Direction;
 	}
 
-	Mesh->AddInstances(Transforms, false, false);
+	AddBoids(Added);
 }
 
-UE_NODISCARD FORCEINLINE FVector LerpNormals(const FVector& A, const FVector& B, const double Alpha)
+void AFlock::RemoveBoids(const TConstArrayView<FFlockBoidHandle>& Handles)
 {
-	const FQuat RotationDifference = FQuat::FindBetweenNormals(A, B);
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Remove Boids"), STAT_RemoveBoids, STATGROUP_BoidSimulation);
+
+	// Park the instance at the origin with zero scale rather than removing it, which would reorder the ISM.
+	const FTransform HiddenTransform{FQuat::Identity, FVector::ZeroVector, FVector::ZeroVector};
 
-	FVector Axis; double Angle;
-	RotationDifference.ToAxisAndAngle(Axis, Angle);
+	for (const FFlockBoidHandle& Handle : Handles)
+	{
+		int32 Slot;
+		if (!HandleToSlot.RemoveAndCopyValue(Handle, Slot)) continue;
+
+		verify(BoidCells[GetCellIndex(BoidLocations[Slot])].RemoveSingleSwap(Slot, false) != INDEX_NONE);
 
-	return FQuat{Axis, Angle * Alpha}.RotateVector(A);
+		SlotHandles[Slot] = FFlockBoidHandle{};
+		FreeSlots.Add(Slot);
+
+		if (bUpdateInstances)
+		{
+			Mesh->UpdateInstanceTransform(Slot, HiddenTransform);
+		}
+	}
 }
 
-void AFlock::Cohere(FVector& RESTRICT OutDirection, const TConstArrayView<FVector>& Directions, const TConstArrayView<FVector>& Locations, const int32 BoidIndex, const TConstArrayView<int32>& OtherRelevantBoidIndices) const
+void AFlock::ApplyPendingSpawnRequests()
 {
-	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Cohere"), STAT_Cohere, STATGROUP_BoidSimulation);
+	FRWScopeLock Lock{SimulationLock, SLT_Write};
+
+	// Spawns first so a boid spawned and despawned within the same tick doesn't leak.
+	for (TArray<FSpawnRequest> Requests; PendingSpawns.Dequeue(Requests);)
+	{
+		AddBoids(Requests);
+
+		if (Shard)
+		{
+			Shard->ScanAllMigrants();
+		}
+	}
+
+	// Whatever was held back last time has had its spawn drained by now. Still unknown means the handle was stale.
+	TArray<FFlockBoidHandle> HeldDespawns = MoveTemp(UnknownDespawns);
+	RemoveBoids(HeldDespawns);
+
+	// A spawn enqueued after the drain above can have its despawn enqueued before the one below, so hold on to handles we don't know yet.
+	for (TArray<FFlockBoidHandle> Handles; PendingDespawns.Dequeue(Handles);)
+	{
+		for (const FFlockBoidHandle& Handle : Handles)
+		{
+			if (!HandleToSlot.Contains(Handle))
+			{
+				UnknownDespawns.Add(Handle);
+			}
+		}
+		RemoveBoids(Handles);
+	}
+
+	if (!FreeSlots.IsEmpty() && FreeSlots.Num() >= FMath::CeilToInt32(GetNumSlots() * SlotCompactionThreshold))
+	{
+		CompactSlots();
+	}
+}
+
+void AFlock::CompactSlots()
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Compact Slots"), STAT_CompactSlots, STATGROUP_BoidSimulation);
+
+	const int32 NumSlots = GetNumSlots();
+
+	// Fill the lowest holes with the highest live slots. Everything past NewNumSlots ends up free.
+	FreeSlots.Sort();
+
+	int32 NewNumSlots = NumSlots;
+	for (const int32 Hole : FreeSlots)
+	{
+		while (NewNumSlots > 0 && !IsSlotAlive(NewNumSlots - 1))
+		{
+			--NewNumSlots;
+		}
+		if (Hole >= NewNumSlots) break;
+
+		const int32 From = --NewNumSlots;
+
+		TArray<int32, TInlineAllocator<4>>& Cell = BoidCells[GetCellIndex(BoidLocations[From])];
+		Cell[Cell.Find(From)] = Hole;
+
+		BoidLocations[Hole] = BoidLocations[From];
+		BoidDirections[Hole] = BoidDirections[From];
+		BoidSpecies[Hole] = BoidSpecies[From];
+		BoidProbeStates[Hole] = BoidProbeStates[From];
+		BoidClusters[Hole] = BoidClusters[From];
+		SlotHandles[Hole] = SlotHandles[From];
+		SlotHandles[From] = FFlockBoidHandle{};
+		HandleToSlot[SlotHandles[Hole]] = Hole;
 
-	if (OtherRelevantBoidIndices.IsEmpty()) return;
+		if (!bUpdateInstances) continue;
+
+		FTransform Transform{NoInit};
+		verify(Mesh->GetInstanceTransform(From, Transform));
+		Mesh->UpdateInstanceTransform(Hole, Transform);
+
+		if (ActiveInstanceEncoding == EFlockInstanceEncoding::Direction)
+		{
+			WriteInstanceDirection(Hole);
+		}
+	}
 
-	FVector AverageLocation = FVector::ZeroVector;
-	for (const int32 OtherBoidIndex : OtherRelevantBoidIndices)
+	while (NewNumSlots > 0 && !IsSlotAlive(NewNumSlots - 1))
 	{
-		FTransform OtherTransform{NoInit};
-		Mesh->GetInstanceTransform(OtherBoidIndex, OtherTransform);
+		--NewNumSlots;
+	}
 
-		AverageLocation += OtherTransform.GetTranslation();
+	// Removing from the back never reorders the remaining instances.
+	if (bUpdateInstances)
+	{
+		TArray<int32> InstancesToRemove;
+		InstancesToRemove.Reserve(NumSlots - NewNumSlots);
+		for (int32 Slot = NumSlots - 1; Slot >= NewNumSlots; --Slot)
+		{
+			InstancesToRemove.Add(Slot);
+		}
+		Mesh->RemoveInstances(InstancesToRemove);
 	}
-	AverageLocation /= OtherRelevantBoidIndices.Num();
+
+	BoidLocations.SetNum(NewNumSlots, false);
+	BoidDirections.SetNum(NewNumSlots, false);
+	BoidSpecies.SetNum(NewNumSlots, false);
+	BoidProbeStates.SetNum(NewNumSlots, false);
+	BoidClusters.SetNum(NewNumSlots, false);
+	SlotHandles.SetNum(NewNumSlots, false);
+	FreeSlots.Reset();
+
+	// Boids moved to other slots, and the old tree's leaves may point past the end now. Traces can come in before the end of the tick.
+	RebuildBoidBVH();
+}
+
+void AFlock::Cohere(FVector& RESTRICT OutDirection, const FVector& RESTRICT Location, const FBoidNeighborhood& Neighborhood, const FBoidSpeciesRules& Rules, const EFlockSteeringMath SteeringMath) const
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Cohere"), STAT_Cohere, STATGROUP_BoidSimulation);
+
+	const int32 NumNeighbors = Neighborhood.NumCohesion();
+	if (NumNeighbors == 0) return;
+
+	const FVector AverageLocation = (Neighborhood.FarFieldLocationSum + Neighborhood.CohesionLocationSum) / NumNeighbors;
 	
-	const FVector DirToAverageLocation = (AverageLocation - Locations[BoidIndex]).GetSafeNormal();
+	const FVector DirToAverageLocation = (AverageLocation - Location).GetSafeNormal();
 	
-	const double Alpha = FMath::GetMappedRangeValueClamped<double, double>({0.0, 15.0}, {0.0, BoidSimulationCVars::CohesionStrength.GetValueOnAnyThread()}, static_cast<double>(OtherRelevantBoidIndices.Num()));
-	OutDirection = LerpNormals(OutDirection, DirToAverageLocation, Alpha);
+	const double Alpha = FMath::GetMappedRangeValueClamped<double, double>({0.0, 15.0}, {0.0, Rules.CohesionStrength}, static_cast<double>(NumNeighbors));
+	OutDirection = FlockSteeringMath::SlerpNormals(OutDirection, DirToAverageLocation, Alpha, SteeringMath);
 }
 
 void AFlock::RelocateBoidCell(const int32 BoidIndex, const FVector& LastLocation, const FVector& NewLocation)
@@ -127,20 +1146,19 @@ void AFlock::RelocateBoidCell(const int32 BoidIndex, const FVector& LastLocation
 	BoidCells[NewCell].Add(BoidIndex);
 }
 
-void AFlock::Avoid(FVector& RESTRICT OutDirection, const TConstArrayView<FVector>& Directions, const TConstArrayView<FVector>& Locations, const int32 BoidIndex, const TConstArrayView<int32>& OtherRelevantBoidIndices) const
+void AFlock::Avoid(FVector& RESTRICT OutDirection, const FBoidNeighborhood& Neighborhood, const FBoidSpeciesRules& Rules) const
 {
 	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Avoid"), STAT_Avoid, STATGROUP_BoidSimulation);
 
 	FVector NewDirection = OutDirection;
 
-	for (const int32 OtherBoidIndex : OtherRelevantBoidIndices)
+	for (const FVector& Translation : Neighborhood.SeparationTranslations)
 	{
-		const FVector Translation = Locations[BoidIndex] - Locations[OtherBoidIndex];
 		if (UNLIKELY(Translation.SizeSquared() < UE_DOUBLE_KINDA_SMALL_NUMBER)) continue;
 		
 		const double Dist = Translation.Size();
 
-		NewDirection += Translation * (((1.0 - (Dist / BoidsSearchNearbyRadius)) / Dist) * BoidSimulationCVars::AvoidanceStrength.GetValueOnAnyThread());
+		NewDirection += Translation * (((1.0 - (Dist / Rules.SeparationRadius)) / Dist) * Rules.SeparationStrength);
 	}
 
 	NewDirection.Normalize();
@@ -148,30 +1166,168 @@ void AFlock::Avoid(FVector& RESTRICT OutDirection, const TConstArrayView<FVector
 	OutDirection = NewDirection;
 }
 
-void AFlock::Align(FVector& RESTRICT OutDirection, const TConstArrayView<FVector>& Directions, const TConstArrayView<FVector>& Locations, const int32 BoidIndex, const TConstArrayView<int32>& OtherRelevantBoidIndices) const
+void AFlock::Align(FVector& RESTRICT OutDirection, const FBoidNeighborhood& Neighborhood, const FBoidSpeciesRules& Rules, const EFlockSteeringMath SteeringMath) const
 {
 	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Align"), STAT_Align, STATGROUP_BoidSimulation);
 
-	if (OtherRelevantBoidIndices.IsEmpty()) return;
+	const int32 NumNeighbors = Neighborhood.NumAlignment();
+	if (NumNeighbors == 0) return;
+
+	FVector AverageDirection = (Neighborhood.FarFieldDirectionSum + Neighborhood.AlignmentDirectionSum) / NumNeighbors;
+	AverageDirection.Normalize();
+
+	const double Alpha = FMath::Min(1.0, static_cast<double>(NumNeighbors) / 15.0) * Rules.AlignmentStrength;
+	OutDirection = FlockSteeringMath::SlerpNormals(OutDirection, AverageDirection, Alpha, SteeringMath);
+}
 
-	FVector AverageDirection = FVector::ZeroVector;
-	for (const int32 OtherBoidIndex : OtherRelevantBoidIndices)
+AFlock::FSimulationSwitches AFlock::ResolveSimulationSwitches() const
+{
+	// Lockstep clients have to simulate exactly like the server, whatever their own console variables say.
+	if (IsLockstepClient() && LockstepState.bStarted)
 	{
-		AverageDirection += Directions[OtherBoidIndex];
+		return FSimulationSwitches{LockstepState.SteeringMath == 1 ? EFlockSteeringMath::Fast : EFlockSteeringMath::Exact, LockstepState.bCompactState, LockstepState.bFarField};
 	}
-	AverageDirection /= OtherRelevantBoidIndices.Num();
-	AverageDirection.Normalize();
 
-	const double Alpha = FMath::Min(1.0, static_cast<double>(OtherRelevantBoidIndices.Num()) / 15.0) * BoidSimulationCVars::AlignmentStrength.GetValueOnAnyThread();
-	OutDirection = LerpNormals(OutDirection, AverageDirection, Alpha);
+	return FSimulationSwitches
+	{
+		BoidSimulationCVars::SteeringMath.GetValueOnGameThread() == 1 ? EFlockSteeringMath::Fast : EFlockSteeringMath::Exact,
+		BoidSimulationCVars::CompactState.GetValueOnGameThread(),
+		BoidSimulationCVars::FarField.GetValueOnGameThread()
+	};
+}
+
+TSharedRef<const AFlock::FParameterBlock, ESPMode::ThreadSafe> AFlock::BuildParameters() const
+{
+	const UBoidFlockSettings& Defaults = Settings ? *Settings : *GetDefault<UBoidFlockSettings>();
+
+	const double BaseMovementSpeed = bOverride_MovementSpeed ? MovementSpeed : Defaults.MovementSpeed;
+	const double BaseRadius = bOverride_BoidsSearchNearbyRadius ? BoidsSearchNearbyRadius : Defaults.BoidsSearchNearbyRadius;
+	const double BaseCohesionStrength = bOverride_CohesionStrength ? CohesionStrength : Defaults.CohesionStrength;
+	const double BaseAvoidanceStrength = bOverride_AvoidanceStrength ? AvoidanceStrength : Defaults.AvoidanceStrength;
+	const double BaseAlignmentStrength = bOverride_AlignmentStrength ? AlignmentStrength : Defaults.AlignmentStrength;
+
+	const auto RadiusOrDefault = [BaseRadius](const float Radius) -> double
+	{
+		return Radius > 0.f ? Radius : BaseRadius;
+	};
+
+	const auto MinCos = [](const float FieldOfView) -> double
+	{
+		return FieldOfView >= 360.f ? -1.0 : FMath::Cos(FMath::DegreesToRadians(static_cast<double>(FieldOfView) * 0.5));
+	};
+
+	const FSimulationSwitches Switches = ResolveSimulationSwitches();
+
+	const TSharedRef<FParameterBlock, ESPMode::ThreadSafe> Block = MakeShared<FParameterBlock, ESPMode::ThreadSafe>();
+	Block->BoidsSearchNearbyRadius = BaseRadius;
+	Block->SteeringMath = Switches.SteeringMath;
+	Block->bCompactState = Switches.bCompactState;
+	Block->bFarField = Switches.bFarField;
+	const TConstArrayView<FFlockSpecies> ResolvedSpecies = GetSpeciesOrDefault();
+	Block->SpeciesRules.Reserve(ResolvedSpecies.Num());
+	Block->SpeciesKernels.Reserve(ResolvedSpecies.Num());
+
+	for (const FFlockSpecies& Entry : ResolvedSpecies)
+	{
+		const double SeparationRadius = RadiusOrDefault(Entry.SeparationRadius);
+		const double AlignmentRadius = RadiusOrDefault(Entry.AlignmentRadius);
+		const double CohesionRadius = RadiusOrDefault(Entry.CohesionRadius);
+
+		FBoidSpeciesRules& Rules = Block->SpeciesRules.AddDefaulted_GetRef();
+		Rules.RuleMask = (Entry.bSeparation ? RuleSeparation : 0) | (Entry.bAlignment ? RuleAlignment : 0) | (Entry.bCohesion ? RuleCohesion : 0);
+		Rules.MovementSpeed = Entry.MovementSpeed > 0.f ? Entry.MovementSpeed : BaseMovementSpeed;
+		Rules.SearchRadius = FMath::Max3(Entry.bSeparation ? SeparationRadius : 0.0, Entry.bAlignment ? AlignmentRadius : 0.0, Entry.bCohesion ? CohesionRadius : 0.0);
+		Rules.FarFieldRadius = FMath::Min(AlignmentRadius, CohesionRadius);
+		Rules.SeparationRadius = SeparationRadius;
+		Rules.SeparationRadiusSquared = FMath::Square(SeparationRadius);
+		Rules.AlignmentRadiusSquared = FMath::Square(AlignmentRadius);
+		Rules.CohesionRadiusSquared = FMath::Square(CohesionRadius);
+		Rules.SeparationMinCos = MinCos(Entry.SeparationFieldOfView);
+		Rules.AlignmentMinCos = MinCos(Entry.AlignmentFieldOfView);
+		Rules.CohesionMinCos = MinCos(Entry.CohesionFieldOfView);
+		Rules.bAnyFieldOfView = Rules.SeparationMinCos > -1.0 || Rules.AlignmentMinCos > -1.0 || Rules.CohesionMinCos > -1.0;
+		Rules.bLegacyHalfSpace = Entry.bLegacyHalfSpace;
+		Rules.SeparationStrength = BaseAvoidanceStrength * Entry.SeparationStrengthScale;
+		Rules.AlignmentStrength = BaseAlignmentStrength * Entry.AlignmentStrengthScale;
+		Rules.CohesionStrength = BaseCohesionStrength * Entry.CohesionStrengthScale;
+
+		Block->SpeciesKernels.Add(GetSteerKernel(Rules.RuleMask, Block->bCompactState));
+	}
+
+	// Field by field, since the structs have padding.
+	uint32 Hash = 0;
+	const auto HashValue = [&Hash](const auto& Value) -> void
+	{
+		Hash = FCrc::MemCrc32(&Value, sizeof(Value), Hash);
+	};
+
+	HashValue(Block->BoidsSearchNearbyRadius);
+	HashValue(BoundsRadius);
+	HashValue(bTopologicalNeighbors);
+	HashValue(NumTopologicalNeighbors);
+	for (const FBoidSpeciesRules& Rules : Block->SpeciesRules)
+	{
+		HashValue(Rules.RuleMask);
+		HashValue(Rules.MovementSpeed);
+		HashValue(Rules.SearchRadius);
+		HashValue(Rules.SeparationRadius);
+		HashValue(Rules.AlignmentRadiusSquared);
+		HashValue(Rules.CohesionRadiusSquared);
+		HashValue(Rules.SeparationMinCos);
+		HashValue(Rules.AlignmentMinCos);
+		HashValue(Rules.CohesionMinCos);
+		HashValue(Rules.bLegacyHalfSpace);
+		HashValue(Rules.SeparationStrength);
+		HashValue(Rules.AlignmentStrength);
+		HashValue(Rules.CohesionStrength);
+	}
+	Block->Hash = Hash;
+
+	return Block;
+}
+
+TConstArrayView<FFlockSpecies> AFlock::GetSpeciesOrDefault() const
+{
+	static const FFlockSpecies DefaultSpecies;
+	return Species.IsEmpty() ? TConstArrayView<FFlockSpecies>{&DefaultSpecies, 1} : TConstArrayView<FFlockSpecies>{Species};
+}
+
+void AFlock::UpdateParameters()
+{
+	const uint32 SettingsRevision = Settings ? Settings->GetRevision() : 0;
+	const FSimulationSwitches Switches = ResolveSimulationSwitches();
+	if (!bParametersDirty && Parameters.IsValid() && SettingsRevision == ParametersSettingsRevision
+		&& Switches.SteeringMath == Parameters->SteeringMath && Switches.bCompactState == Parameters->bCompactState && Switches.bFarField == Parameters->bFarField) return;
+
+	const int32 PreviousNumSpecies = Parameters.IsValid() ? Parameters->SpeciesRules.Num() : 0;
+
+	// Nothing from the previous tick still references the old block, and the next tick only ever sees the new one.
+	Parameters = BuildParameters();
+	ParametersSettingsRevision = SettingsRevision;
+	bParametersDirty = false;
+
+	// Species removed while playing would leave their boids indexing past the rules. They fall back to the first, like spawns do.
+	const int32 NumSpecies = Parameters->SpeciesRules.Num();
+	if (NumSpecies < PreviousNumSpecies)
+	{
+		FRWScopeLock Lock{SimulationLock, SLT_Write};
+		for (uint8& BoidSpeciesIndex : BoidSpecies)
+		{
+			if (BoidSpeciesIndex >= NumSpecies)
+			{
+				BoidSpeciesIndex = 0;
+			}
+		}
+	}
 }
 
-void AFlock::Constrain(FVector& RESTRICT OutDirection, const FVector& RESTRICT Location, const int32 BoidIndex) const
+void AFlock::Constrain(FVector& RESTRICT OutDirection, const FVector& RESTRICT Location, const int32 BoidIndex, const FParameterBlock& InParameters) const
 {
 	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Constrain"), STAT_Constrain, STATGROUP_BoidSimulation);
 	
 	// Confine to bounds
-	if (Location.SizeSquared() > FMath::Square(BoundsRadius - BoidsSearchNearbyRadius - UE_DOUBLE_KINDA_SMALL_NUMBER))
+	const double Margin = InParameters.BoidsSearchNearbyRadius;
+	if (Location.SizeSquared() > FMath::Square(BoundsRadius - Margin - UE_DOUBLE_KINDA_SMALL_NUMBER))
 	{
 		const double DistFromOrigin = Location.Size();
 		const FVector DirFromOrigin = Location / DistFromOrigin;
@@ -186,12 +1342,281 @@ void AFlock::Constrain(FVector& RESTRICT OutDirection, const FVector& RESTRICT L
 		}
 		else
 		{
-			TargetDirection = -DirFromOrigin;
+			TargetDirection = -DirFromOrigin;
+		}
+
+		const double Alpha = FMath::GetMappedRangeValueUnclamped<double, double>({BoundsRadius - Margin - UE_DOUBLE_KINDA_SMALL_NUMBER, BoundsRadius}, {0.0, 1.0}, DistFromOrigin);
+		OutDirection = FlockSteeringMath::SlerpNormals(OutDirection, TargetDirection, Alpha, InParameters.SteeringMath);
+	}
+}
+
+template<uint32 RuleMask, bool bCompactState>
+void AFlock::SteerBoid(const FSteerContext& Context, const int32 BoidIndex)
+{
+	if (!IsSlotAlive(BoidIndex)) return;
+
+	// The boid's own location and direction are always full precision. Its new direction goes to its own slot of Context.NewDirections at the very end.
+	const FVector& Location = Context.Locations[BoidIndex];
+
+	// Neighbors are read from whichever buffer this kernel was compiled for.
+	const auto& OtherLocations = [&Context]() -> const auto&
+	{
+		if constexpr (bCompactState) return Context.CompactBoids;
+		else return Context.Locations;
+	}();
+
+	const auto GetOtherDirection = [&Context](const int32 OtherBoidIndex) -> FVector
+	{
+		if constexpr (bCompactState) return FlockCompactState::DecodeDirection(Context.CompactBoids[OtherBoidIndex]);
+		else return Context.Directions[OtherBoidIndex];
+	};
+
+	const uint8 SpeciesIndex = BoidSpecies[BoidIndex];
+	const FBoidSpeciesRules& Rules = Context.Parameters.SpeciesRules[SpeciesIndex];
+
+	FVector NewDirection = Context.Directions[BoidIndex];// Working with a copy rather than a reference to avoid false-sharing.
+
+	FBoidNeighborhood Neighborhood;
+	if constexpr (RuleMask != 0)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_FindNearbyBoids);
+
+		// Sorts a neighbor into every rule whose ring and cone it falls in. Topological neighbors only respect the separation ring.
+		// Every species separates from every other, but only aligns and coheres with its own, which the caller knows from the run the neighbor came from.
+		const auto ClassifyNearbyBoid = [&](const int32 OtherBoidIndex, const FVector& RESTRICT OtherLocation, const bool bTopological, const auto bSameSpecies) -> void
+		{
+			const FVector Translation = Location - OtherLocation;
+			const double DistSquared = Translation.SizeSquared();
+			const double Facing = NewDirection | Translation;
+			const double CosAngle = Rules.bAnyFieldOfView ? -Facing * FMath::InvSqrt(FMath::Max(DistSquared, UE_DOUBLE_SMALL_NUMBER)) : 1.0;
+
+			// Rules whose cone is left at 360 degrees keep the original half-space test instead, see FFlockSpecies::bLegacyHalfSpace.
+			const bool bInHalfSpace = !Rules.bLegacyHalfSpace || Facing > LegacyHalfSpaceFacing;
+			const auto IsInView = [CosAngle, bInHalfSpace](const double MinCos) -> bool
+			{
+				return MinCos > -1.0 ? CosAngle >= MinCos : bInHalfSpace;
+			};
+
+			if constexpr ((RuleMask & RuleSeparation) != 0)
+			{
+				if (DistSquared <= Rules.SeparationRadiusSquared && IsInView(Rules.SeparationMinCos))
+				{
+					Neighborhood.SeparationTranslations.Add(Translation);
+				}
+			}
+
+			if constexpr ((RuleMask & (RuleAlignment | RuleCohesion)) != 0 && decltype(bSameSpecies)::value)
+			{
+				if constexpr ((RuleMask & RuleAlignment) != 0)
+				{
+					if ((bTopological || DistSquared <= Rules.AlignmentRadiusSquared) && IsInView(Rules.AlignmentMinCos))
+					{
+						Neighborhood.AlignmentDirectionSum += GetOtherDirection(OtherBoidIndex);
+						++Neighborhood.NumAlignmentBoids;
+					}
+				}
+
+				if constexpr ((RuleMask & RuleCohesion) != 0)
+				{
+					if ((bTopological || DistSquared <= Rules.CohesionRadiusSquared) && IsInView(Rules.CohesionMinCos))
+					{
+						Neighborhood.CohesionLocationSum += OtherLocation;
+						++Neighborhood.NumCohesionBoids;
+					}
+				}
+			}
+		};
+
+		const double SearchRadiusSquared = FMath::Square(Rules.SearchRadius);
+
+		// Other species only ever matter to separation, so their runs are skipped entirely without it.
+		const auto AddNearbyRun = [&](const TConstArrayView<int32>& Run, const FVector& CellLocation, const auto bSameSpecies) -> void
+		{
+			if constexpr (decltype(bSameSpecies)::value || (RuleMask & RuleSeparation) != 0)
+			{
+				for (const int32 OtherBoidIndex : Run)
+				{
+					if (decltype(bSameSpecies)::value && BoidIndex == OtherBoidIndex) continue;
+
+					const FVector& OtherLocation = GetOtherLocation(OtherLocations, OtherBoidIndex, CellLocation);
+					if (FVector::DistSquared(Location, OtherLocation) > SearchRadiusSquared) continue;
+
+					ClassifyNearbyBoid(OtherBoidIndex, OtherLocation, false, bSameSpecies);
+				}
+			}
+		};
+
+		if (bTopologicalNeighbors)
+		{
+			const int32 K = FMath::Clamp(NumTopologicalNeighbors, 1, MaxTopologicalNeighbors);
+
+			TArray<int32, TInlineAllocator<32>> NearestBoids;
+			TArray<FVector, TInlineAllocator<32>> NearestLocations;
+			const int32 NumSameSpecies = FindNearestBoids<MaxTopologicalNeighbors>(Location, OtherLocations, Context.SpeciesCells, SpeciesIndex, K, K * TopologicalCandidatesPerNeighbor, [&](const int32 OtherBoidIndex, const FVector& RESTRICT OtherLocation) -> bool
+			{
+				// With every cone at its default, the half-space test picks the candidates as it always did.
+				return BoidIndex != OtherBoidIndex && (!Rules.bLegacyHalfSpace || Rules.bAnyFieldOfView || (NewDirection | (Location - OtherLocation)) > LegacyHalfSpaceFacing);
+			}, NearestBoids, NearestLocations);
+
+			for (int32 i = 0; i < NumSameSpecies; ++i)
+			{
+				ClassifyNearbyBoid(NearestBoids[i], NearestLocations[i], true, std::true_type{});
+			}
+			for (int32 i = NumSameSpecies; i < NearestBoids.Num(); ++i)
+			{
+				ClassifyNearbyBoid(NearestBoids[i], NearestLocations[i], true, std::false_type{});
+			}
+		}
+		else
+		{
+			// Without far-field, or any rule that could use it, no cell is ever taken as a whole.
+			// The boid's own cell is always adjacent, so it never ends up counting itself through an aggregate.
+			const double FarFieldRadius = Context.bUseFarField && (RuleMask & (RuleAlignment | RuleCohesion)) != 0 ? Rules.FarFieldRadius : 0.0;
+			const double NearRadius = (RuleMask & RuleSeparation) != 0 ? Rules.SeparationRadius : 0.0;
+			ForEachNearbyCell(Location, Rules.SearchRadius, FarFieldRadius, NearRadius, [&](const int32 CellIndex, const FVector& CellLocation) -> void
+			{
+				ForEachCellRun(Context.SpeciesCells, CellIndex, SpeciesIndex, [&](const TConstArrayView<int32>& Run, const auto bSameSpecies) -> void
+				{
+					AddNearbyRun(Run, CellLocation, bSameSpecies);
+				});
+			},
+			[&](const int32 CellIndex) -> void
+			{
+				const FBoidCellAggregate& Aggregate = BoidCellAggregates[CellIndex * Context.SpeciesCells.NumSpecies + SpeciesIndex];
+				Neighborhood.FarFieldLocationSum += Aggregate.LocationSum;
+				Neighborhood.FarFieldDirectionSum += Aggregate.DirectionSum;
+				Neighborhood.NumFarField += Aggregate.Count;
+			});
+		}
+	}
+
+	if constexpr ((RuleMask & RuleCohesion) != 0)
+	{
+		Cohere(NewDirection, Location, Neighborhood, Rules, Context.Parameters.SteeringMath);
+	}
+	if constexpr ((RuleMask & RuleSeparation) != 0)
+	{
+		Avoid(NewDirection, Neighborhood, Rules);
+	}
+	if constexpr ((RuleMask & RuleAlignment) != 0)
+	{
+		Align(NewDirection, Neighborhood, Rules, Context.Parameters.SteeringMath);
+	}
+	if (Context.InfluenceField)
+	{
+		NewDirection = (NewDirection + Context.InfluenceField->Sample(Location)).GetSafeNormal(UE_DOUBLE_SMALL_NUMBER, NewDirection);
+	}
+
+	// Zero unless the boid's last collision probe hit something.
+	const FVector& CollisionAvoidance = BoidProbeStates[BoidIndex].Avoidance;
+	if (!CollisionAvoidance.IsZero())
+	{
+		NewDirection = (NewDirection + CollisionAvoidance).GetSafeNormal(UE_DOUBLE_SMALL_NUMBER, NewDirection);
+	}
+
+	Constrain(NewDirection, Location, BoidIndex, Context.Parameters);
+
+	Context.NewDirections[BoidIndex] = NewDirection;
+}
+
+AFlock::FSteerKernel AFlock::GetSteerKernel(const uint32 RuleMask, const bool bCompactState)
+{
+	static constexpr FSteerKernel Kernels[2][NumRuleMasks]
+	{
+		{
+			&AFlock::SteerBoid<0, false>,
+			&AFlock::SteerBoid<1, false>,
+			&AFlock::SteerBoid<2, false>,
+			&AFlock::SteerBoid<3, false>,
+			&AFlock::SteerBoid<4, false>,
+			&AFlock::SteerBoid<5, false>,
+			&AFlock::SteerBoid<6, false>,
+			&AFlock::SteerBoid<7, false>,
+		},
+		{
+			&AFlock::SteerBoid<0, true>,
+			&AFlock::SteerBoid<1, true>,
+			&AFlock::SteerBoid<2, true>,
+			&AFlock::SteerBoid<3, true>,
+			&AFlock::SteerBoid<4, true>,
+			&AFlock::SteerBoid<5, true>,
+			&AFlock::SteerBoid<6, true>,
+			&AFlock::SteerBoid<7, true>,
+		},
+	};
+
+	check(RuleMask < NumRuleMasks);
+	return Kernels[bCompactState][RuleMask];
+}
+
+void AFlock::BuildSpeciesBuckets(const int32 NumSpecies)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Build Species Buckets"), STAT_BuildSpeciesBuckets, STATGROUP_BoidSimulation);
+
+	const int32 NumSlots = GetNumSlots();
+
+	// Counting sort of the alive slots. Slots stay in index order within a bucket.
+	SpeciesBucketOffsets.Reset();
+	SpeciesBucketOffsets.SetNumZeroed(NumSpecies + 1);
+
+	for (int32 Slot = 0; Slot < NumSlots; ++Slot)
+	{
+		if (IsSlotAlive(Slot))
+		{
+			++SpeciesBucketOffsets[BoidSpecies[Slot] + 1];
+		}
+	}
+
+	for (int32 SpeciesIndex = 0; SpeciesIndex < NumSpecies; ++SpeciesIndex)
+	{
+		SpeciesBucketOffsets[SpeciesIndex + 1] += SpeciesBucketOffsets[SpeciesIndex];
+	}
+
+	SpeciesBucketSlots.SetNumUninitialized(SpeciesBucketOffsets[NumSpecies], false);
+
+	TArray<int32, TInlineAllocator<8>> WriteIndices(SpeciesBucketOffsets.GetData(), NumSpecies);
+	for (int32 Slot = 0; Slot < NumSlots; ++Slot)
+	{
+		if (IsSlotAlive(Slot))
+		{
+			SpeciesBucketSlots[WriteIndices[BoidSpecies[Slot]]++] = Slot;
+		}
+	}
+}
+
+void AFlock::BuildSpeciesCells(const int32 NumSpecies)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Build Species Cells"), STAT_BuildSpeciesCells, STATGROUP_BoidSimulation);
+
+	const int32 NumCells = BoidCells.Num();
+
+	// Counting sort of every cell's boids, keeping the grid's own order within a species so lockstep stays deterministic.
+	SpeciesCellOffsets.SetNumUninitialized(NumCells * NumSpecies + 1, false);
+	ParallelFor(NumCells, [&](const int32 CellIndex) -> void
+	{
+		int32* RESTRICT Counts = SpeciesCellOffsets.GetData() + CellIndex * NumSpecies + 1;
+		FMemory::Memzero(Counts, NumSpecies * sizeof(int32));
+		for (const int32 BoidIndex : BoidCells[CellIndex])
+		{
+			++Counts[BoidSpecies[BoidIndex]];
 		}
+	});
 
-		const double Alpha = FMath::GetMappedRangeValueUnclamped<double, double>({BoundsRadius - BoidsSearchNearbyRadius - UE_DOUBLE_KINDA_SMALL_NUMBER, BoundsRadius}, {0.0, 1.0}, DistFromOrigin);
-		OutDirection = LerpNormals(OutDirection, TargetDirection, Alpha);
+	SpeciesCellOffsets[0] = 0;
+	for (int32 i = 1; i < SpeciesCellOffsets.Num(); ++i)
+	{
+		SpeciesCellOffsets[i] += SpeciesCellOffsets[i - 1];
 	}
+
+	SpeciesCellSlots.SetNumUninitialized(SpeciesCellOffsets.Last(), false);
+	ParallelFor(NumCells, [&](const int32 CellIndex) -> void
+	{
+		TArray<int32, TInlineAllocator<8>> WriteIndices(SpeciesCellOffsets.GetData() + CellIndex * NumSpecies, NumSpecies);
+		for (const int32 BoidIndex : BoidCells[CellIndex])
+		{
+			SpeciesCellSlots[WriteIndices[BoidSpecies[BoidIndex]]++] = BoidIndex;
+		}
+	});
 }
 
 void AFlock::SimulateSynchronously(float DeltaTime)
@@ -293,59 +1718,133 @@ void AFlock::SimulateAsynchronously(float DeltaTime)
 
 	FMemMark Mark{FMemStack::Get()};
 
-	TArray<FVector, TMemStackAllocator<>> Locations;
-	TArray<FVector, TMemStackAllocator<>> Directions;
-	{
-		DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Initialize Buffers"), STAT_InitializeBuffers, STATGROUP_BoidSimulation);
+	const int32 SchedulingMode = BoidSimulationCVars::Scheduling.GetValueOnGameThread();
 
-		Locations.SetNumUninitialized(NumInstances);
-		Directions.SetNumUninitialized(NumInstances);
+	const int32 NumSlots = GetNumSlots();
 
-		ParallelFor(NumInstances, [&](const int32 i) -> void
-		{
-			FTransform Transform{NoInit};
-			verify(Mesh->GetInstanceTransform(i, Transform));
-			Locations[i] = Transform.GetTranslation();
-			Directions[i] = Transform.GetUnitAxis(EAxis::X);
-		});
+	// Held for the whole tick so the block can't be swapped out from under the workers.
+	const TSharedRef<const FParameterBlock, ESPMode::ThreadSafe> ParametersRef = Parameters.ToSharedRef();
+	const FParameterBlock& Params = *ParametersRef;
+	const int32 NumSpecies = Params.SpeciesRules.Num();
+
+	// Snapshot the grid up front, sorted by species when there's more than one and into tiles when tiling.
+	// The integrate phase mutates the grid so it can't be walked while scheduling.
+	FSpeciesCells SpeciesCells;
+	if (NumSpecies > 1)
+	{
+		BuildSpeciesCells(NumSpecies);
+		SpeciesCells = FSpeciesCells{SpeciesCellSlots, SpeciesCellOffsets, NumSpecies};
 	}
 
-	ParallelFor(NumInstances, [&](const int32 BoidIndex) -> void
+	const bool bTiled = SchedulingMode == 1;
+	if (bTiled)
 	{
-		FVector NewDirection = Directions[BoidIndex];// Working with a copy rather than a reference to avoid false-sharing.
+		DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Build Tiles"), STAT_BuildTiles, STATGROUP_BoidSimulation);
 
-		TArray<int32, TInlineAllocator<32>> OtherRelevantBoids;
+		const int32 TileSize = FMath::Max(BoidSimulationCVars::TileSize.GetValueOnGameThread(), 1);
+		TileSchedule.Build(GetCellDimensions(), TileSize, [this](const int32 CellIndex) -> TConstArrayView<int32>
 		{
-			SCOPE_CYCLE_COUNTER(STAT_FindNearbyBoids);
-			
-			ForEachNearbyBoid(Locations[BoidIndex], Locations, [&](const int32 OtherBoidIndex, const FVector& RESTRICT OtherLocation) -> void
-			{
-				if (BoidIndex == OtherBoidIndex) return;
-				
-				const FVector Translation = Locations[BoidIndex] - OtherLocation;
-				if ((NewDirection | Translation) <= -0.25) return;
+			return BoidCells[CellIndex];
+		});
 
-				OtherRelevantBoids.Add(OtherBoidIndex);
+		SpeciesTileSchedules.SetNum(NumSpecies > 1 ? NumSpecies : 0);
+		for (int32 SpeciesIndex = 0; SpeciesIndex < SpeciesTileSchedules.Num(); ++SpeciesIndex)
+		{
+			SpeciesTileSchedules[SpeciesIndex].Build(GetCellDimensions(), TileSize, [&SpeciesCells, SpeciesIndex](const int32 CellIndex) -> TConstArrayView<int32>
+			{
+				return SpeciesCells.GetRun(CellIndex, SpeciesIndex, SpeciesIndex + 1);
 			});
 		}
-		
-		Cohere(NewDirection, Directions, Locations, BoidIndex, OtherRelevantBoids);
-		Avoid(NewDirection, Directions, Locations, BoidIndex, OtherRelevantBoids);
-		Align(NewDirection, Directions, Locations, BoidIndex, OtherRelevantBoids);
-		Constrain(NewDirection, Locations[BoidIndex], BoidIndex);
+	}
+	else
+	{
+		// The adaptive batches steer one bucket at a time, the phased region walks all of them in order.
+		BuildSpeciesBuckets(NumSpecies);
+	}
 
-		Directions[BoidIndex] = NewDirection;
-	});
+	const auto ParallelForBoids = [&](FFlockAdaptiveBatches& Batches, auto&& Body) -> void
+	{
+		if (bTiled)
+		{
+			TileSchedule.ParallelFor(Body);
+		}
+		else
+		{
+			Batches.ParallelFor(GetNumSlots(), Body);
+		}
+	};
+
+	// Steering writes the new directions to a buffer of their own, so BoidDirections keeps last tick's until integration swaps them in under the write lock.
+	// The compact snapshot replaces the full precision neighbor reads, locations included.
+	const TConstArrayView<FVector> Locations = BoidLocations;
+	TArray<FVector, TMemStackAllocator<>> NewDirections;
+	NewDirections.SetNumUninitialized(NumSlots);
+	TArray<FFlockCompactBoid, TMemStackAllocator<>> CompactBoids;
+	if (Params.bCompactState)
+	{
+		CompactBoids.SetNumUninitialized(NumSlots);
+	}
+
+	const auto InitializeBoid = [&](const int32 i) -> void
+	{
+		// Relative to the cell the grid files the boid under, which is the one every walk will find it through.
+		CompactBoids[i] = FlockCompactState::Encode(BoidLocations[i], GetCellLocation(GetCellCoordinates(BoidLocations[i])), BoidDirections[i], CELL_SIZE);
+	};
+
+	// Aggregates only need the grid and last tick's directions, both of which are final before any phase runs.
+	const bool bUseFarField = !bTopologicalNeighbors && Params.bFarField;
+	if (bUseFarField)
+	{
+		BuildCellAggregates(BoidDirections, SpeciesCells);
+	}
+
+	const FSteerContext SteerContext{Locations, BoidDirections, NewDirections, CompactBoids, Params, InfluenceField.IsEmpty() ? nullptr : &InfluenceField, bUseFarField, SpeciesCells};
+
+	const bool bEncodeDirection = ActiveInstanceEncoding == EFlockInstanceEncoding::Direction;
+
+	// The integrate phase writes the render component's next frame directly.
+	FFlockRenderFrame* RenderFrame = nullptr;
+	if (bPublishRenderFrames)
+	{
+		RenderFrame = &RenderComponent->GetWriteFrame();
+		RenderFrame->Locations.SetNumUninitialized(NumSlots, false);
+		RenderFrame->Directions.SetNumUninitialized(NumSlots, false);
+		bRenderFramePending = true;
+
+		// Tiles and buckets only visit live boids, so free slots are hidden up front.
+		for (const int32 Slot : FreeSlots)
+		{
+			RenderFrame->Directions[Slot] = FVector3f::ZeroVector;
+		}
+	}
 
 	// @NOTE: Doesn't scale as well as it should due to the blocking
-	ParallelFor(NumInstances, [&](const int32 BoidIndex) -> void
+	const auto IntegrateBoid = [&](const int32 BoidIndex) -> void
 	{
-		FVector& RESTRICT Location = Locations[BoidIndex];
+		if (!IsSlotAlive(BoidIndex)) return;
+
+		BoidDirections[BoidIndex] = NewDirections[BoidIndex];
+
+		FVector& RESTRICT Location = BoidLocations[BoidIndex];
 		const FVector PreviousLocation = Location;
 
-		Location += Directions[BoidIndex] * MovementSpeed * DeltaTime;
+		Location += BoidDirections[BoidIndex] * (Params.SpeciesRules[BoidSpecies[BoidIndex]].MovementSpeed * DeltaTime);
 		
-		Mesh->UpdateInstanceTransform(BoidIndex, FTransform{Directions[BoidIndex].ToOrientationQuat(), Location});
+		if (RenderFrame)
+		{
+			RenderFrame->Locations[BoidIndex] = FVector3f{Location};
+			RenderFrame->Directions[BoidIndex] = FVector3f{BoidDirections[BoidIndex]};
+		}
+		else if (bEncodeDirection)
+		{
+			// The rotation part stays identity from when the instance was added. Only the origin and the encoded direction change.
+			Mesh->PerInstanceSMData[BoidIndex].Transform.SetOrigin(Location);
+			WriteInstanceDirection(BoidIndex);
+		}
+		else if (bUpdateInstances)
+		{
+			Mesh->UpdateInstanceTransform(BoidIndex, FTransform{FlockSteeringMath::DirectionToQuat(BoidDirections[BoidIndex], Params.SteeringMath), Location});
+		}
 
 		SCOPE_CYCLE_COUNTER(STAT_RelocateBoidCells);
 		
@@ -367,15 +1866,382 @@ void AFlock::SimulateAsynchronously(float DeltaTime)
 
 			SCOPE_CYCLE_COUNTER(STAT_RelocateBoidCellsBlockingTime)
 		}
+	};
+
+	if (SchedulingMode == 2)
+	{
+		// One fork/join for the whole tick. Each thread keeps the same contiguous range of the species buckets across all three phases.
+		const int32 NumBoids = SpeciesBucketSlots.Num();
+		const int32 MinBoidsPerPartition = FMath::Max(BoidSimulationCVars::MinBoidsPerPartition.GetValueOnGameThread(), 1);
+		const int32 NumPartitions = FMath::Clamp(FMath::DivideAndRoundUp(NumBoids, MinBoidsPerPartition), 1, FTaskGraphInterface::Get().GetNumWorkerThreads() + 1);
+
+		// Integration happens somewhere inside the region, so queries are locked out of all of it.
+		FRWScopeLock Lock{SimulationLock, SLT_Write};
+
+		PhasedRegion.Run(NumBoids, NumPartitions, [&](const int32 Phase, const int32 Begin, const int32 End) -> void
+		{
+			switch (Phase)
+			{
+			case 0:
+				if (!Params.bCompactState) break;
+
+				for (int32 i = Begin; i < End; ++i)
+				{
+					InitializeBoid(SpeciesBucketSlots[i]);
+				}
+				break;
+
+			case 1:
+				// A range only straddles the few buckets it overlaps, each steered by its own kernel.
+				for (int32 SpeciesIndex = 0; SpeciesIndex < NumSpecies; ++SpeciesIndex)
+				{
+					const FSteerKernel Kernel = Params.SpeciesKernels[SpeciesIndex];
+					const int32 BucketEnd = FMath::Min(End, SpeciesBucketOffsets[SpeciesIndex + 1]);
+					for (int32 i = FMath::Max(Begin, SpeciesBucketOffsets[SpeciesIndex]); i < BucketEnd; ++i)
+					{
+						(this->*Kernel)(SteerContext, SpeciesBucketSlots[i]);
+					}
+				}
+				break;
+
+			default:
+				for (int32 i = Begin; i < End; ++i)
+				{
+					IntegrateBoid(SpeciesBucketSlots[i]);
+				}
+				break;
+			}
+		});
+
+		SET_DWORD_STAT(STAT_PhasedRegionPartitions, NumPartitions);
+		return;
+	}
+
+	if (Params.bCompactState)
+	{
+		DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Initialize Buffers"), STAT_InitializeBuffers, STATGROUP_BoidSimulation);
+		ParallelForBoids(InitializeBatches, InitializeBoid);
+	}
+
+	if (bTiled && SpeciesTileSchedules.IsEmpty())
+	{
+		const FSteerKernel Kernel = Params.SpeciesKernels[0];
+		TileSchedule.ParallelFor([&](const int32 BoidIndex) -> void
+		{
+			(this->*Kernel)(SteerContext, BoidIndex);
+		});
+	}
+	else if (bTiled)
+	{
+		// One pass per species, each from tiles of its own boids only.
+		for (int32 SpeciesIndex = 0; SpeciesIndex < NumSpecies; ++SpeciesIndex)
+		{
+			const FSteerKernel Kernel = Params.SpeciesKernels[SpeciesIndex];
+			SpeciesTileSchedules[SpeciesIndex].ParallelFor([&](const int32 BoidIndex) -> void
+			{
+				(this->*Kernel)(SteerContext, BoidIndex);
+			});
+		}
+	}
+	else
+	{
+		// One pass per species, each calling straight into the kernel compiled for its rules.
+		while (SteerBatches.Num() < Params.SpeciesKernels.Num())
+		{
+			SteerBatches.Emplace(TEXT("BoidSimulation.Steer"));
+		}
+
+		for (int32 SpeciesIndex = 0; SpeciesIndex < Params.SpeciesKernels.Num(); ++SpeciesIndex)
+		{
+			const TConstArrayView<int32> Bucket{SpeciesBucketSlots.GetData() + SpeciesBucketOffsets[SpeciesIndex], SpeciesBucketOffsets[SpeciesIndex + 1] - SpeciesBucketOffsets[SpeciesIndex]};
+			if (Bucket.IsEmpty()) continue;
+
+			const FSteerKernel Kernel = Params.SpeciesKernels[SpeciesIndex];
+			SteerBatches[SpeciesIndex].ParallelFor(Bucket.Num(), [&](const int32 i) -> void
+			{
+				(this->*Kernel)(SteerContext, Bucket[i]);
+			});
+		}
+	}
+
+	{
+		FRWScopeLock Lock{SimulationLock, SLT_Write};
+		ParallelForBoids(IntegrateBatches, IntegrateBoid);
+	}
+
+	if (bTiled)
+	{
+		int32 NumStolenTiles = TileSchedule.GetNumStolenTiles();
+		for (const FFlockTileSchedule& SpeciesTileSchedule : SpeciesTileSchedules)
+		{
+			NumStolenTiles += SpeciesTileSchedule.GetNumStolenTiles();
+		}
+
+		SET_DWORD_STAT(STAT_Tiles, TileSchedule.GetNumTiles());
+		SET_DWORD_STAT(STAT_StolenTiles, NumStolenTiles);
+		return;
+	}
+
+	SET_DWORD_STAT(STAT_InitializeBuffersBatches, InitializeBatches.GetNumBatches());
+	int32 NumSteerBatches = 0;
+	float SteerBatchMicroseconds = 0.f;
+	for (int32 SpeciesIndex = 0; SpeciesIndex < Params.SpeciesKernels.Num(); ++SpeciesIndex)
+	{
+		NumSteerBatches += SteerBatches[SpeciesIndex].GetNumBatches();
+		SteerBatchMicroseconds += SteerBatches[SpeciesIndex].GetAverageBatchMicroseconds() * SteerBatches[SpeciesIndex].GetNumBatches();
+	}
+
+	SET_DWORD_STAT(STAT_SteerBatches, NumSteerBatches);
+	SET_DWORD_STAT(STAT_IntegrateBatches, IntegrateBatches.GetNumBatches());
+	SET_FLOAT_STAT(STAT_InitializeBuffersBatchSize, InitializeBatches.GetAverageBatchSize());
+	SET_FLOAT_STAT(STAT_SteerBatchSize, NumSteerBatches > 0 ? static_cast<float>(SpeciesBucketSlots.Num()) / NumSteerBatches : 0.f);
+	SET_FLOAT_STAT(STAT_IntegrateBatchSize, IntegrateBatches.GetAverageBatchSize());
+	SET_FLOAT_STAT(STAT_InitializeBuffersBatchCost, InitializeBatches.GetAverageBatchMicroseconds());
+	SET_FLOAT_STAT(STAT_SteerBatchCost, NumSteerBatches > 0 ? SteerBatchMicroseconds / NumSteerBatches : 0.f);
+	SET_FLOAT_STAT(STAT_IntegrateBatchCost, IntegrateBatches.GetAverageBatchMicroseconds());
+}
+
+void AFlock::UpdateClusters(const FParameterBlock& InParameters)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Update Clusters"), STAT_UpdateClusters, STATGROUP_BoidSimulation);
+
+	const int32 NumSlots = GetNumSlots();
+	const double LinkRadius = ClusterLinkRadius > 0.f ? ClusterLinkRadius : InParameters.BoidsSearchNearbyRadius;
+
+	// Every pair is found from both ends, only the lower slot links it.
+	ClusterSets.Reset(NumSlots);
+	ParallelFor(NumSlots, [&](const int32 Slot) -> void
+	{
+		if (!IsSlotAlive(Slot)) return;
+
+		ForEachNearbyBoid(BoidLocations[Slot], TConstArrayView<FVector>{BoidLocations}, LinkRadius, [&](const int32 OtherSlot, const FVector&) -> void
+		{
+			if (OtherSlot > Slot)
+			{
+				ClusterSets.Union(Slot, OtherSlot);
+			}
+		});
+	}, EParallelForFlags::Unbalanced);
+
+	// Roots are the smallest slot of their set, so a single pass in slot order meets every root before any of its members.
+	TArray<int32> RootClusters;
+	RootClusters.SetNumUninitialized(NumSlots);
+
+	// Built aside and swapped in under the write lock, ReadBuffers hands BoidClusters out to other threads.
+	TArray<int32> NewBoidClusters;
+	NewBoidClusters.SetNumUninitialized(NumSlots);
+
+	TArray<FFlockCluster> AllClusters;
+	for (int32 Slot = 0; Slot < NumSlots; ++Slot)
+	{
+		if (!IsSlotAlive(Slot))
+		{
+			NewBoidClusters[Slot] = INDEX_NONE;
+			continue;
+		}
+
+		const int32 Root = ClusterSets.Find(Slot);
+		if (Root == Slot)
+		{
+			RootClusters[Slot] = AllClusters.AddDefaulted();
+			AllClusters.Last().Anchor = SlotHandles[Slot];
+		}
+
+		const int32 ClusterIndex = RootClusters[Root];
+		FFlockCluster& Cluster = AllClusters[ClusterIndex];
+		Cluster.Centroid += BoidLocations[Slot];
+		Cluster.Bounds += BoidLocations[Slot];
+		++Cluster.NumBoids;
+		if (SlotHandles[Slot].Id < Cluster.Anchor.Id)
+		{
+			Cluster.Anchor = SlotHandles[Slot];
+		}
+
+		NewBoidClusters[Slot] = ClusterIndex;
+	}
+
+	// Drop the small ones and renumber what's left.
+	TArray<int32> ClusterRemap;
+	ClusterRemap.SetNumUninitialized(AllClusters.Num());
+
+	TArray<FFlockCluster> NewClusters;
+	for (int32 ClusterIndex = 0; ClusterIndex < AllClusters.Num(); ++ClusterIndex)
+	{
+		FFlockCluster& Cluster = AllClusters[ClusterIndex];
+		if (Cluster.NumBoids < MinClusterSize)
+		{
+			ClusterRemap[ClusterIndex] = INDEX_NONE;
+			continue;
+		}
+
+		Cluster.Centroid /= Cluster.NumBoids;
+		ClusterRemap[ClusterIndex] = NewClusters.Add(Cluster);
+	}
+
+	ParallelFor(NumSlots, [&](const int32 Slot) -> void
+	{
+		if (NewBoidClusters[Slot] != INDEX_NONE)
+		{
+			NewBoidClusters[Slot] = ClusterRemap[NewBoidClusters[Slot]];
+		}
 	});
+
+	{
+		FRWScopeLock Lock{SimulationLock, SLT_Write};
+		BoidClusters = MoveTemp(NewBoidClusters);
+		Clusters = MoveTemp(NewClusters);
+	}
+
+	SET_DWORD_STAT(STAT_Clusters, Clusters.Num());
+}
+
+FBox AFlock::ComputeOccupiedBounds() const
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Compute Occupied Bounds"), STAT_ComputeOccupiedBounds, STATGROUP_BoidSimulation);
+
+	const int32 CellDimensions = GetCellDimensions();
+
+	FIntVector Min{CellDimensions};
+	FIntVector Max{-1};
+	for (int32 CellIndex = 0; CellIndex < BoidCells.Num(); ++CellIndex)
+	{
+		if (BoidCells[CellIndex].IsEmpty()) continue;
+
+		const FIntVector Coordinates{CellIndex % CellDimensions, (CellIndex / CellDimensions) % CellDimensions, CellIndex / (CellDimensions * CellDimensions)};
+		Min = FIntVector{FMath::Min(Min.X, Coordinates.X), FMath::Min(Min.Y, Coordinates.Y), FMath::Min(Min.Z, Coordinates.Z)};
+		Max = FIntVector{FMath::Max(Max.X, Coordinates.X), FMath::Max(Max.Y, Coordinates.Y), FMath::Max(Max.Z, Coordinates.Z)};
+	}
+
+	if (Max.X < 0) return FBox{ForceInit};
+
+	// Boids past the edge of the grid are clamped into the border cells, so border sides get an extra cell of slack.
+	const FVector Margin{CELL_SIZE * 0.5 + RenderComponent->BoidSize};
+	FVector BoxMin = GetCellLocation(Min) - Margin;
+	FVector BoxMax = GetCellLocation(Max) + Margin;
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		if (Min[Axis] == 0) BoxMin[Axis] -= CELL_SIZE;
+		if (Max[Axis] == CellDimensions - 1) BoxMax[Axis] += CELL_SIZE;
+	}
+
+	return FBox{BoxMin, BoxMax};
+}
+
+void AFlock::BuildCellAggregates(const TConstArrayView<FVector>& Directions, const FSpeciesCells& SpeciesCells)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Build Cell Aggregates"), STAT_BuildCellAggregates, STATGROUP_BoidSimulation);
+
+	const int32 NumSpecies = SpeciesCells.NumSpecies;
+	BoidCellAggregates.SetNumUninitialized(BoidCells.Num() * NumSpecies);
+
+	ParallelFor(BoidCells.Num(), [&](const int32 CellIndex) -> void
+	{
+		for (int32 SpeciesIndex = 0; SpeciesIndex < NumSpecies; ++SpeciesIndex)
+		{
+			const TConstArrayView<int32> Run = SpeciesCells.Offsets.IsEmpty() ? TConstArrayView<int32>{BoidCells[CellIndex]} : SpeciesCells.GetRun(CellIndex, SpeciesIndex, SpeciesIndex + 1);
+
+			FBoidCellAggregate& Aggregate = BoidCellAggregates[CellIndex * NumSpecies + SpeciesIndex];
+			Aggregate.LocationSum = FVector::ZeroVector;
+			Aggregate.DirectionSum = FVector::ZeroVector;
+			Aggregate.Count = Run.Num();
+
+			for (const int32 BoidIndex : Run)
+			{
+				Aggregate.LocationSum += BoidLocations[BoidIndex];
+				Aggregate.DirectionSum += Directions[BoidIndex];
+			}
+		}
+	}, EParallelForFlags::Unbalanced);
+}
+
+void AFlock::SetInfluences(const TConstArrayView<FFlockInfluence>& InInfluences)
+{
+	Influences = InInfluences;
+	bInfluenceFieldDirty = true;
+}
+
+void AFlock::UpdateInfluenceField()
+{
+	if (!bInfluenceFieldDirty) return;
+
+	if (Influences.IsEmpty())
+	{
+		InfluenceField.Empty();
+	}
+	else
+	{
+		InfluenceField.Build(Influences, BoundsRadius, FMath::Clamp(InfluenceFieldResolution, 2, 64));
+	}
+	bInfluenceFieldDirty = false;
+}
+
+void AFlock::SortBoidCells()
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Sort Cells"), STAT_SortCells, STATGROUP_BoidSimulation);
+
+	FRWScopeLock Lock{SimulationLock, SLT_Write};
+	ParallelFor(BoidCells.Num(), [this](const int32 CellIndex) -> void
+	{
+		BoidCells[CellIndex].Sort([this](const int32 A, const int32 B) -> bool
+		{
+			return SlotHandles[A].Id < SlotHandles[B].Id;
+		});
+	}, EParallelForFlags::Unbalanced);
 }
 
+bool AFlock::StartShard(const FFlockShard::FConfig& Config)
+{
+	if (Config.Count > GetCellDimensions())
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("%s: Can't split %i grid columns across %i shards, simulating the whole flock here instead."), *GetName(), GetCellDimensions(), Config.Count);
+		return false;
+	}
+
+	UE_CLOG(ReplicationMode == EFlockReplicationMode::Lockstep, LogBoidSimulation, Warning, TEXT("%s: Shards replicate with snapshots, lockstep needs the whole flock in one process."), *GetName());
+	ReplicationMode = EFlockReplicationMode::Snapshots;
+
+	Shard = MakeUnique<FFlockShard>(Config, GetCellDimensions());
+
+	// Every shard draws the same flock, so the handles of the boids it keeps are unique across shards as they are.
+	TArray<FSpawnRequest> Requests;
+	MakeScatterRequests(FRandomStream{Config.Seed}, Requests);
+	Requests.RemoveAllSwap([this](const FSpawnRequest& Request) -> bool
+	{
+		return !Shard->OwnsCell(GetCellCoordinates(Request.Transform.GetTranslation()).X);
+	});
+	AddBoids(Requests);
+
+	// Boids spawned later on draw from a range of their own per shard.
+	NextHandleId.store((static_cast<uint64>(Config.Index) + 1) << 48, std::memory_order_relaxed);
+
+	UE_LOG(LogBoidSimulation, Log, TEXT("%s: Shard %i of %i, owning grid columns [%i, %i) and %i of %i boids."), *GetName(), Config.Index, Config.Count, Shard->GetFirstCell(), Shard->GetLastCell(), GetNumBoids(), NumInstances);
+	return true;
+}
 
 void AFlock::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
-	if (BoidSimulationCVars::EnableMultithreading.GetValueOnGameThread())
+	UpdateParameters();
+	UpdateInfluenceField();
+	ApplyPendingSpawnRequests();
+
+	if (Shard)
+	{
+		Shard->ReceiveBoids(*this);
+	}
+
+	if (!InFlightCollisionProbes.IsEmpty())
+	{
+		ConsumeCollisionProbes();
+	}
+
+	const bool bLockstep = ReplicationMode == EFlockReplicationMode::Lockstep;
+	if (bLockstep)
+	{
+		Lockstep.Tick(*this, DeltaTime);
+	}
+	else if (BoidSimulationCVars::EnableMultithreading.GetValueOnGameThread())
 	{
 		SimulateAsynchronously(DeltaTime);
 	}
@@ -384,13 +2250,72 @@ void AFlock::Tick(float DeltaTime)
 		SimulateSynchronously(DeltaTime);
 	}
 
-	Mesh->MarkRenderStateDirty();
+	if (Shard)
+	{
+		Shard->SendBoids(*this, DeltaTime);
+	}
+
+	if (bEnableBoidTraces)
+	{
+		UpdateBoidBVH();
+	}
+
+	if (bEnableClustering && ++TicksSinceClusterUpdate >= ClusterUpdateInterval)
+	{
+		UpdateClusters(*Parameters);
+		TicksSinceClusterUpdate = 0;
+	}
+
+	// Issued after moving so the probes start from where the boids are now. They run during the rest of the frame and are read next tick.
+	// Not in lockstep, where nothing may depend on the rest of the world or on when traces complete.
+	if (bEnableCollisionProbes && !bLockstep)
+	{
+		FMemMark Mark{FMemStack::Get()};
+		IssueCollisionProbes(*Parameters);
+	}
+
+	if (bUpdateInstances)
+	{
+		Mesh->MarkRenderStateDirty();
+	}
+	else if (bRenderFramePending)
+	{
+		RenderComponent->PublishFrame(ComputeOccupiedBounds());
+		bRenderFramePending = false;
+	}
 
 #if UE_BUILD_DEVELOPMENT
 	if (BoidSimulationCVars::DrawDebugBoundsSphere.GetValueOnGameThread())
 	{
 		DrawDebugSphere(GetWorld(), GetActorLocation(), BoundsRadius, 16, FColor::Blue);
 	}
+
+	if (BoidSimulationCVars::DrawDebugClusters.GetValueOnGameThread())
+	{
+		for (const FFlockCluster& Cluster : Clusters)
+		{
+			DrawDebugBox(GetWorld(), GetActorTransform().TransformPosition(Cluster.Bounds.GetCenter()), Cluster.Bounds.GetExtent() * GetActorScale3D(), GetActorQuat(), FColor::MakeRandomSeededColor(static_cast<int32>(Cluster.Anchor.Id)));
+		}
+	}
 #endif
 }
 
+#if WITH_EDITOR
+void AFlock::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	// Picked up at the start of the next tick.
+	bParametersDirty = true;
+	bInfluenceFieldDirty = true;
+
+	// Otherwise the last hits would keep steering boids forever.
+	if (PropertyChangedEvent.GetPropertyName() == GET_MEMBER_NAME_CHECKED(AFlock, bEnableCollisionProbes) && !bEnableCollisionProbes)
+	{
+		for (FBoidProbeState& State : BoidProbeStates)
+		{
+			State = FBoidProbeState{};
+		}
+	}
+}
+#endif
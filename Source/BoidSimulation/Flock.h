@@ -6,37 +6,631 @@
 #include "Components/InstancedStaticMeshComponent.h"
 #include "GameFramework/Actor.h"
 #include "Misc/SpinLock.h"
+#include "Containers/Queue.h"
+#include "Misc/ScopeRWLock.h"
+#include "WorldCollision.h"
+#include "FlockBoidHandle.h"
+#include "FlockSpatialQuery.h"
+#include "FlockBVH.h"
+#include "FlockAdaptiveBatches.h"
+#include "FlockTileSchedule.h"
+#include "FlockPhasedRegion.h"
+#include "FlockSpecies.h"
+#include "FlockSteeringMath.h"
+#include "FlockInstanceEncoding.h"
+#include "FlockCompactState.h"
+#include "FlockCluster.h"
+#include "FlockUnionFind.h"
+#include "FlockInfluenceField.h"
+#include "FlockReplication.h"
+#include "FlockLockstep.h"
+#include "FlockShard.h"
+#include "FlockRenderComponent.h"
+#include <type_traits>
 #include "Flock.generated.h"
 
 class UInstancedStaticMeshComponent;
+class UBoidFlockSettings;
+class UFlockWarmState;
 
 UCLASS()
 class BOIDSIMULATION_API AFlock : public AActor
 {
 	GENERATED_BODY()
+
+	friend struct FFlockReplicatedState;
+	friend class UFlockLockstepComponent;
+	friend class FFlockLockstep;
+	friend class FFlockShard;
+	friend struct FFlockTestAccess;
+	friend class FFlockTestWorld;
+
 public:
 	explicit AFlock(const FObjectInitializer& ObjectInitializer);
 
+	/**
+	 * Queues boids of one species to be added to the flock. Transforms are relative to the flock. Thread safe and lock free.
+	 * The returned handles are usable immediately, but the boids only join the simulation at the start of the next tick.
+	 * An invalid SpeciesIndex falls back to the first species.
+	 */
+	void SpawnBoids(const TConstArrayView<FTransform>& Transforms, TArray<FFlockBoidHandle>& OutHandles, const int32 SpeciesIndex = 0);
+
+	// Queues boids to be removed from the flock at the start of the next tick. Thread safe and lock free. Stale handles are ignored.
+	void DespawnBoids(const TConstArrayView<FFlockBoidHandle>& Handles);
+
+	// Game thread only. Boids spawned since the last tick aren't alive yet.
+	UE_NODISCARD FORCEINLINE bool IsBoidAlive(const FFlockBoidHandle& Handle) const
+	{
+		return HandleToSlot.Contains(Handle);
+	}
+
+	UE_NODISCARD FORCEINLINE int32 GetNumBoids() const
+	{
+		return HandleToSlot.Num();
+	}
+
+	UE_NODISCARD FORCEINLINE int32 GetNumInstances() const
+	{
+		return NumInstances;
+	}
+
+	UE_NODISCARD FORCEINLINE float GetBoundsRadius() const
+	{
+		return BoundsRadius;
+	}
+
+	// At least one, see Species.
+	UE_NODISCARD FORCEINLINE int32 GetNumSpecies() const
+	{
+		return FMath::Max(Species.Num(), 1);
+	}
+
+	/**
+	 * Runs a batch of queries in parallel against the current grid, overwriting OutResults.
+	 * Thread safe. Safe to call from async tasks while the flock is steering, blocks while it's integrating or applying spawns.
+	 * With BoidSimulation.Multithreading.Scheduling 2 integration happens inside the same parallel region as steering, which holds the lock
+	 * throughout, so calls block for the whole simulation step instead.
+	 */
+	void QueryBoids(const TConstArrayView<FFlockSpatialQuery>& Queries, FFlockSpatialQueryResults& OutResults) const;
+
+	/**
+	 * Finds the first boid hit by each trace in parallel, writing one entry per trace to OutHits. Requires bEnableBoidTraces.
+	 * Same thread safety as QueryBoids, including blocking for the whole simulation step with Scheduling 2. Hits are against the current positions, but the tree is only refit at the end of a tick, so while
+	 * the flock is simulating and until then boids that moved out of last tick's boxes, or spawned into recycled slots, can be missed.
+	 */
+	void TraceBoids(const TConstArrayView<FFlockBoidTrace>& Traces, TArray<FFlockBoidTraceHit>& OutHits) const;
+
+	// Game thread only. As of the last cluster update, see bEnableClustering. Clusters smaller than MinClusterSize are left out.
+	UE_NODISCARD FORCEINLINE const TArray<FFlockCluster>& GetClusters() const
+	{
+		return Clusters;
+	}
+
+	// Game thread only. Index into GetClusters of the cluster the boid was in at the last update, INDEX_NONE if it wasn't in a reported one.
+	UE_NODISCARD FORCEINLINE int32 GetBoidCluster(const FFlockBoidHandle& Handle) const
+	{
+		const int32* Slot = HandleToSlot.Find(Handle);
+		return Slot ? BoidClusters[*Slot] : INDEX_NONE;
+	}
+
+	// Read-only views straight into the per-slot simulation buffers, relative to the flock. Slots with an invalid handle are free.
+	struct FBufferViews
+	{
+		TConstArrayView<FVector> Locations;
+		TConstArrayView<FVector> Directions;
+		TConstArrayView<FFlockBoidHandle> Handles;
+		TConstArrayView<uint8> Species;
+
+		// Index into GetClusters, see BoidClusters.
+		TConstArrayView<int32> Clusters;
+	};
+
+	/**
+	 * Hands Functor the buffers without copying them, holding the same lock spatial queries do. Thread safe, blocks while the flock is integrating or applying spawns,
+	 * or for the whole simulation step with Scheduling 2, see QueryBoids.
+	 * Slots, and so the views, stay put until Functor returns, but a boid moves to another slot when slots get compacted.
+	 * Every buffer is from the same tick: steering writes directions aside and integration swaps them in under the same lock.
+	 */
+	void ReadBuffers(const TFunctionRef<void(const FBufferViews&)>& Functor) const;
+
+	// Game thread only. Replaces every influence, see Influences. The field is splatted again at the start of the next tick.
+	void SetInfluences(const TConstArrayView<FFlockInfluence>& InInfluences);
+
+	UE_NODISCARD FORCEINLINE const TArray<FFlockInfluence>& GetInfluences() const
+	{
+		return Influences;
+	}
+
+	/**
+	 * Writes every live boid into one versioned block, compressed when bCompressSavedState. Game thread only, between ticks.
+	 * Serialize writes the same block into save game archives. This is for holding on to a flock while its level is streamed out.
+	 */
+	void SaveState(TArray<uint8>& OutBytes);
+
+	// Replaces every boid with the saved ones, handles included. Before BeginPlay the flock starts from them rather than spawning its own.
+	void LoadState(const TConstArrayView<uint8>& Bytes);
+
+	virtual void Serialize(FArchive& Ar) override;
+
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
 protected:
+	// Number of boids spawned on BeginPlay.
 	UPROPERTY(EditAnywhere, Category="Configurations")
 	int32 NumInstances = 100;
 
+	// Once at least this fraction of slots are free, live boids get moved into the holes and the tail of every buffer is trimmed.
+	UPROPERTY(EditAnywhere, Category="Configurations", meta=(ClampMin=0, ClampMax=1))
+	float SlotCompactionThreshold = 0.25f;
+
 	UPROPERTY(EditAnywhere, Category="Configurations")
 	float BoundsRadius = 1000.f;
 
+	// Shared tuning. Null uses UBoidFlockSettings' defaults. Anything overridden below wins over the asset.
 	UPROPERTY(EditAnywhere, Category="Configurations")
+	TObjectPtr<UBoidFlockSettings> Settings;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(InlineEditConditionToggle))
+	uint8 bOverride_MovementSpeed : 1;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(InlineEditConditionToggle))
+	uint8 bOverride_BoidsSearchNearbyRadius : 1;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(InlineEditConditionToggle))
+	uint8 bOverride_CohesionStrength : 1;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(InlineEditConditionToggle))
+	uint8 bOverride_AvoidanceStrength : 1;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(InlineEditConditionToggle))
+	uint8 bOverride_AlignmentStrength : 1;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(EditCondition="bOverride_MovementSpeed", ClampMin=0))
 	float MovementSpeed = 10.f;
 
-	UPROPERTY(EditAnywhere, Category="Configurations")
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(EditCondition="bOverride_BoidsSearchNearbyRadius", ClampMin=0))
 	float BoidsSearchNearbyRadius = 25.f;
 
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(EditCondition="bOverride_CohesionStrength", ClampMin=0))
+	float CohesionStrength = 0.75f;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(EditCondition="bOverride_AvoidanceStrength", ClampMin=0))
+	float AvoidanceStrength = 0.75f;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Overrides", meta=(EditCondition="bOverride_AlignmentStrength", ClampMin=0))
+	float AlignmentStrength = 0.75f;
+
+	// Every boid belongs to exactly one of these. None behaves like a single species with default settings.
+	UPROPERTY(EditAnywhere, Category="Configurations")
+	TArray<FFlockSpecies> Species;
+
+	// Interact with a fixed number of nearest neighbors rather than everyone within BoidsSearchNearbyRadius. Bounds per-boid cost in dense clumps.
+	UPROPERTY(EditAnywhere, Category="Configurations")
+	bool bTopologicalNeighbors = false;
+
+	UPROPERTY(EditAnywhere, Category="Configurations", meta=(EditCondition="bTopologicalNeighbors", ClampMin=1, ClampMax=32))
+	int32 NumTopologicalNeighbors = 7;
+
+	/**
+	 * Direction skips building a rotation per boid per tick, but needs a material that decodes it. It saves CPU time only: the instanced static mesh
+	 * still uploads a full transform per instance, translation only or not, plus the custom data float, so upload bytes grow slightly rather than
+	 * halving as intended. Only read on BeginPlay.
+	 */
+	UPROPERTY(EditAnywhere, Category="Configurations|Rendering", meta=(EditCondition="Renderer == EFlockRenderer::InstancedStaticMesh"))
+	EFlockInstanceEncoding InstanceEncoding = EFlockInstanceEncoding::Transform;
+
+	// Settled state to start from instead of scattering NumInstances boids at random. Ignored, with a warning, once it no longer matches the flock.
+	UPROPERTY(EditAnywhere, Category="Configurations|Startup")
+	TObjectPtr<UFlockWarmState> WarmState;
+
+	// How long BakeWarmState lets the flock settle for, in fixed steps of WarmUpTimeStep.
+	UPROPERTY(EditAnywhere, Category="Configurations|Startup", meta=(ClampMin=0, Units="s"))
+	float WarmUpSeconds = 20.f;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Startup", meta=(ClampMin=0.001, Units="s"))
+	float WarmUpTimeStep = 1.f / 30.f;
+
+	// Trades a little CPU on save and load for a state block around half the size.
+	UPROPERTY(EditAnywhere, Category="Configurations|Saving")
+	bool bCompressSavedState = true;
+
+#if WITH_EDITOR
+	// Scatters and simulates the flock offline for WarmUpSeconds and stores the result in WarmState. Leaves the actor itself untouched.
+	UFUNCTION(CallInEditor, Category="Configurations|Startup")
+	void BakeWarmState();
+#endif
+
+	// FlockComponent leaves Mesh empty and takes all per-boid rendering work off the game thread. None skips rendering entirely. Only read on BeginPlay.
+	UPROPERTY(EditAnywhere, Category="Configurations|Rendering")
+	EFlockRenderer Renderer = EFlockRenderer::InstancedStaticMesh;
+
+	// Periodically splits the flock into clusters of connected neighbors, see GetClusters.
+	UPROPERTY(EditAnywhere, Category="Configurations|Clustering")
+	bool bEnableClustering = false;
+
+	// Ticks between cluster updates. Each update recomputes the clusters from scratch, in parallel.
+	UPROPERTY(EditAnywhere, Category="Configurations|Clustering", meta=(EditCondition="bEnableClustering", ClampMin=1))
+	int32 ClusterUpdateInterval = 10;
+
+	// Boids this close are in the same cluster. Zero uses the resolved BoidsSearchNearbyRadius.
+	UPROPERTY(EditAnywhere, Category="Configurations|Clustering", meta=(EditCondition="bEnableClustering", ClampMin=0))
+	float ClusterLinkRadius = 0.f;
+
+	// Smaller clusters, stragglers mostly, aren't reported.
+	UPROPERTY(EditAnywhere, Category="Configurations|Clustering", meta=(EditCondition="bEnableClustering", ClampMin=1))
+	int32 MinClusterSize = 3;
+
+	// Attractors, repulsors and wind, relative to the flock. Splatted into a coarse field whenever they change, so each boid pays a single lookup for all of them.
+	UPROPERTY(EditAnywhere, Category="Configurations|Influence")
+	TArray<FFlockInfluence> Influences;
+
+	// Voxels along each axis of the influence field, which spans the bounds. Influences much smaller than a voxel get smeared out.
+	UPROPERTY(EditAnywhere, Category="Configurations|Influence", meta=(ClampMin=2, ClampMax=64))
+	int32 InfluenceFieldResolution = 16;
+
+	// Per connection. Boids that moved compete for it by staleness and relevance, see FFlockReplicatedState. Removals and at least one boid always go out.
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(ClampMin=0, Units="BytesPerSecond"))
+	float ReplicationBytesPerSecond = 16384.f;
+
+	// Boids this far from a connection's view target are updated half as often as ones right next to it, a third as often at twice the distance and so on.
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(ClampMin=0))
+	float ReplicationRelevanceDistance = 2000.f;
+
+	/**
+	 * Lockstep only replicates enough for clients to simulate the flock themselves, which needs every client to run the same build on the same platform.
+	 * It steps in fixed LockstepTimeStep increments, skips collision probes, and spawns, despawns and influences on the server only reach clients through resyncs.
+	 * Clients need a UFlockLockstepComponent on their player controller to resync at all.
+	 */
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking")
+	EFlockReplicationMode ReplicationMode = EFlockReplicationMode::Snapshots;
+
+	// What the server scatters the boids with when there's no warm state. Zero picks a random one on BeginPlay.
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(EditCondition="ReplicationMode == EFlockReplicationMode::Lockstep"))
+	int32 LockstepSeed = 0;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(EditCondition="ReplicationMode == EFlockReplicationMode::Lockstep", ClampMin=0.001, Units="s"))
+	float LockstepTimeStep = 1.f / 30.f;
+
+	// Bounds the cost of a slow frame or of catching up with the server. Time beyond it is dropped on the server, clients fall further behind instead.
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(EditCondition="ReplicationMode == EFlockReplicationMode::Lockstep", ClampMin=1))
+	int32 MaxLockstepStepsPerFrame = 4;
+
+	// Steps between checksums. Divergence goes unnoticed for up to this long.
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(EditCondition="ReplicationMode == EFlockReplicationMode::Lockstep", ClampMin=1))
+	int32 LockstepChecksumInterval = 30;
+
+	// Edge length in grid cells of the regions checksummed and resynced independently. Raised as needed to keep the region count replicable.
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(EditCondition="ReplicationMode == EFlockReplicationMode::Lockstep", ClampMin=1))
+	int32 LockstepRegionCells = 4;
+
+	// Clients joining further in than this ask for every boid rather than simulating their way up from the seed.
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(EditCondition="ReplicationMode == EFlockReplicationMode::Lockstep", ClampMin=0))
+	int32 MaxLockstepCatchUpSteps = 300;
+
+	// Per flock, across every client resyncing. Each chunk holds up to 512 boids at 57 bytes each.
+	UPROPERTY(EditAnywhere, Category="Configurations|Networking", meta=(EditCondition="ReplicationMode == EFlockReplicationMode::Lockstep", ClampMin=1))
+	int32 LockstepResyncChunksPerFrame = 4;
+
+	// Maintains a BVH over the boids every tick so TraceBoids can hit individual boids.
+	UPROPERTY(EditAnywhere, Category="Configurations")
+	bool bEnableBoidTraces = false;
+
+	// Radius of the sphere each boid is treated as by TraceBoids.
+	UPROPERTY(EditAnywhere, Category="Configurations", meta=(EditCondition="bEnableBoidTraces"))
+	float BoidRadius = 10.f;
+
+	// Line traces a budgeted subset of boids against the world every frame and steers them away from whatever they hit, one frame late.
+	UPROPERTY(EditAnywhere, Category="Configurations|Collision")
+	bool bEnableCollisionProbes = false;
+
+	// Most probes issued per frame. Boids are picked by how long it's been since their last probe, their speed and how close their last hit was.
+	UPROPERTY(EditAnywhere, Category="Configurations|Collision", meta=(EditCondition="bEnableCollisionProbes", ClampMin=0))
+	int32 CollisionProbeBudget = 64;
+
+	// Length of a probe along the boid's heading, relative to the flock.
+	UPROPERTY(EditAnywhere, Category="Configurations|Collision", meta=(EditCondition="bEnableCollisionProbes", ClampMin=0))
+	float CollisionProbeDistance = 150.f;
+
+	UPROPERTY(EditAnywhere, Category="Configurations|Collision", meta=(EditCondition="bEnableCollisionProbes"))
+	TEnumAsByte<ECollisionChannel> CollisionProbeChannel = ECC_WorldStatic;
+
+	// Weight of the hit normal added to the heading at point blank range, falling off linearly to zero at CollisionProbeDistance.
+	UPROPERTY(EditAnywhere, Category="Configurations|Collision", meta=(EditCondition="bEnableCollisionProbes", ClampMin=0))
+	float CollisionAvoidanceStrength = 2.f;
+
+	// How many times more urgent a boid whose last probe hit at point blank range is than one whose last probe missed.
+	UPROPERTY(EditAnywhere, Category="Configurations|Collision", meta=(EditCondition="bEnableCollisionProbes", ClampMin=0))
+	float CollisionProximityPriority = 4.f;
+
 	static constexpr double CELL_SIZE = 125.0;
+	static constexpr int32 MaxTopologicalNeighbors = 32;
+	static constexpr int32 TopologicalCandidatesPerNeighbor = 16;
 	TArray<TArray<int32, TInlineAllocator<4>>> BoidCells;
 	TArray<UE::FSpinLock> BoidCellSpinLocks;
+
+	// Simulation state, one entry per slot. A slot's index doubles as its ISM instance index.
+	// Despawned boids leave their slot behind (hidden, out of the grid and with an invalid handle) until it's recycled or compacted away.
+	TArray<FVector> BoidLocations;
+	TArray<FVector> BoidDirections;
+	TArray<FFlockBoidHandle> SlotHandles;
+	TArray<uint8> BoidSpecies;
+	TArray<int32> FreeSlots;
+
+	// Index into Clusters as of the last cluster update, INDEX_NONE when not in a reported cluster.
+	TArray<int32> BoidClusters;
+	TArray<FFlockCluster> Clusters;
+	FFlockUnionFind ClusterSets;
+	int32 TicksSinceClusterUpdate = 0;
+
+	// What the last collision probe of a boid found.
+	struct FBoidProbeState
+	{
+		// Added to the heading while steering. Zero when the last probe missed.
+		FVector Avoidance = FVector::ZeroVector;
+
+		// 1 at point blank range, 0 for a miss.
+		float Proximity = 0.f;
+
+		uint16 FramesSinceProbe = 0;
+	};
+	TArray<FBoidProbeState> BoidProbeStates;
+
+	// Issued last frame, consumed at the start of this one. Boids are tracked by handle since their slot may move in between.
+	struct FCollisionProbe
+	{
+		FFlockBoidHandle Boid;
+		FTraceHandle Trace;
+	};
+	TArray<FCollisionProbe> InFlightCollisionProbes;
+	TMap<FFlockBoidHandle, int32> HandleToSlot;
+
+	struct FSpawnRequest
+	{
+		FFlockBoidHandle Handle;
+		FTransform Transform;
+		uint8 Species = 0;
+	};
+
+	// Each SpawnBoids/DespawnBoids call enqueues a single batch so bursts don't pay per-boid queue nodes.
+	TQueue<TArray<FSpawnRequest>, EQueueMode::Mpsc> PendingSpawns;
+	TQueue<TArray<FFlockBoidHandle>, EQueueMode::Mpsc> PendingDespawns;
+
+	// Despawns of handles that had no boid yet when they were drained, retried once at the next drain.
+	TArray<FFlockBoidHandle> UnknownDespawns;
+	std::atomic<uint64> NextHandleId{1};
+
+	// Per cell and species sums of the resident boids, indexed like FSpeciesCells::Offsets. Rebuilt at the start of each tick when BoidSimulation.FarField is enabled.
+	struct FBoidCellAggregate
+	{
+		FVector LocationSum;
+		FVector DirectionSum;
+		int32 Count;
+	};
+	TArray<FBoidCellAggregate> BoidCellAggregates;
+
+	// Clients build their boids from this rather than spawning their own.
+	UPROPERTY(Replicated, Transient)
+	FFlockReplicatedState ReplicatedState;
+
+	// Written by the server in lockstep mode, see ReplicationMode.
+	UPROPERTY(Replicated, Transient)
+	FFlockLockstepState LockstepState;
+
+	// Everything else lockstep keeps, on both ends.
+	FFlockLockstep Lockstep;
+
+	// Set when this process simulates one slab of a flock split across several, see FFlockShard.
+	TUniquePtr<FFlockShard> Shard;
+
+	// Sum of every influence, only written on the game thread between simulations. Empty when there are no influences.
+	FFlockInfluenceField InfluenceField;
+	bool bInfluenceFieldDirty = true;
+
+	// A boid's surroundings, reduced to what each rule needs of the neighbors that fall within it.
+	// Gathered from whichever precision the neighbors were read in, so the rules themselves never touch the neighbors' state.
+	struct FBoidNeighborhood
+	{
+		// From each neighbor to the boid.
+		TArray<FVector, TInlineAllocator<32>> SeparationTranslations;
+
+		FVector AlignmentDirectionSum = FVector::ZeroVector;
+		int32 NumAlignmentBoids = 0;
+
+		FVector CohesionLocationSum = FVector::ZeroVector;
+		int32 NumCohesionBoids = 0;
+
+		// Summed over the far cells approximated as a whole. Counts towards both alignment and cohesion.
+		FVector FarFieldLocationSum = FVector::ZeroVector;
+		FVector FarFieldDirectionSum = FVector::ZeroVector;
+		int32 NumFarField = 0;
+
+		UE_NODISCARD FORCEINLINE int32 NumAlignment() const
+		{
+			return NumAlignmentBoids + NumFarField;
+		}
+
+		UE_NODISCARD FORCEINLINE int32 NumCohesion() const
+		{
+			return NumCohesionBoids + NumFarField;
+		}
+	};
+
+	// The original neighbor test skips neighbors with (Direction | (Location - OtherLocation)) at or below this, see FFlockSpecies::bLegacyHalfSpace.
+	static constexpr double LegacyHalfSpaceFacing = -0.25;
+
+	// Bits of a steering kernel's rule mask.
+	static constexpr uint32 RuleSeparation = 1 << 0;
+	static constexpr uint32 RuleAlignment = 1 << 1;
+	static constexpr uint32 RuleCohesion = 1 << 2;
+	static constexpr uint32 NumRuleMasks = 1 << 3;
+
+	// One species' rules in the form the steering kernel wants them, resolved once per tick.
+	struct FBoidSpeciesRules
+	{
+		uint32 RuleMask;
+		double MovementSpeed;
+
+		double SearchRadius;
+		double FarFieldRadius;
+
+		double SeparationRadius;
+		double SeparationRadiusSquared;
+		double AlignmentRadiusSquared;
+		double CohesionRadiusSquared;
+
+		// Cosine of half the field of view. -1 when the cone is left at 360 degrees, where the rule uses the half-space test instead if bLegacyHalfSpace.
+		double SeparationMinCos;
+		double AlignmentMinCos;
+		double CohesionMinCos;
+
+		bool bAnyFieldOfView;
+		bool bLegacyHalfSpace;
+
+		double SeparationStrength;
+		double AlignmentStrength;
+		double CohesionStrength;
+	};
+
+	struct FSteerContext;
+	using FSteerKernel = void (AFlock::*)(const FSteerContext&, int32);
+
+	// Everything tunable the simulation reads, resolved from Settings, the overrides and Species. Immutable once built.
+	struct FParameterBlock
+	{
+		double BoidsSearchNearbyRadius;
+		EFlockSteeringMath SteeringMath;
+
+		// Neighbors are read from FSteerContext::CompactBoids rather than the full precision buffers.
+		bool bCompactState;
+
+		// Approximate far cells by their aggregates, see BoidSimulation.FarField. Ignored with topological neighbors.
+		bool bFarField;
+
+		// Of everything above besides the switches, so lockstep clients can tell they resolved the same block as the server.
+		uint32 Hash;
+
+		// Indexed by species.
+		TArray<FBoidSpeciesRules> SpeciesRules;
+		TArray<FSteerKernel> SpeciesKernels;
+	};
+
+	/**
+	 * Every cell's boids again, sorted by species, so walks take a boid's own kind and everyone else as separate runs rather than testing each neighbor.
+	 * Cell C's boids of species S are Slots[Offsets[C * NumSpecies + S], Offsets[C * NumSpecies + S + 1]). Empty with a single species, BoidCells already is that.
+	 */
+	struct FSpeciesCells
+	{
+		TConstArrayView<int32> Slots;
+		TConstArrayView<int32> Offsets;
+		int32 NumSpecies = 1;
+
+		// The cell's boids of species [FirstSpecies, EndSpecies).
+		UE_NODISCARD FORCEINLINE TConstArrayView<int32> GetRun(const int32 CellIndex, const int32 FirstSpecies, const int32 EndSpecies) const
+		{
+			const int32 Begin = Offsets[CellIndex * NumSpecies + FirstSpecies];
+			return {Slots.GetData() + Begin, Offsets[CellIndex * NumSpecies + EndSpecies] - Begin};
+		}
+	};
+
+	// Everything the steering kernels read besides the flock's own buffers. Lives on the stack of SimulateAsynchronously.
+	struct FSteerContext
+	{
+		TConstArrayView<FVector> Locations;
+
+		// Last tick's directions, which is BoidDirections itself: steering never writes it.
+		TConstArrayView<FVector> Directions;
+
+		// Steering's output, one per slot, copied into BoidDirections by integration.
+		TArrayView<FVector> NewDirections;
+
+		// Last tick's locations and directions, quantized. Only filled when FParameterBlock::bCompactState is set.
+		TConstArrayView<FFlockCompactBoid> CompactBoids;
+
+		const FParameterBlock& Parameters;
+
+		// Null when there are no influences.
+		const FFlockInfluenceField* InfluenceField;
+
+		bool bUseFarField;
+
+		FSpeciesCells SpeciesCells;
+	};
+
+	// Replaced by a freshly resolved block at the start of a tick whenever anything it depends on changed, never during one.
+	TSharedPtr<const FParameterBlock, ESPMode::ThreadSafe> Parameters;
+	uint32 ParametersSettingsRevision = 0;
+	bool bParametersDirty = true;
+
+	// Alive slots sorted by species, rebuilt every tick. Species I owns [SpeciesBucketOffsets[I], SpeciesBucketOffsets[I + 1]).
+	TArray<int32> SpeciesBucketSlots;
+	TArray<int32> SpeciesBucketOffsets;
+
+	// Backing FSteerContext::SpeciesCells, rebuilt every tick when there's more than one species.
+	TArray<int32> SpeciesCellSlots;
+	TArray<int32> SpeciesCellOffsets;
+
+	// Refit every tick, rebuilt when slots get added or moved or when refitting has loosened it too much.
+	FFlockBVH BoidBVH;
+	bool bBoidBVHNeedsRebuild = true;
+
+	// Held for writing while the grid, locations or slots change. Spatial queries hold it for reading.
+	mutable FRWLock SimulationLock;
+
+	// Per-phase batching for SimulateAsynchronously. Each phase adapts independently since their per-boid costs differ by orders of magnitude.
+	// Steering is batched per species bucket.
+	FFlockAdaptiveBatches InitializeBatches{TEXT("BoidSimulation.InitializeBuffers")};
+	TArray<FFlockAdaptiveBatches> SteerBatches;
+	FFlockAdaptiveBatches IntegrateBatches{TEXT("BoidSimulation.Integrate")};
+
+	// Used instead of the adaptive batches when BoidSimulation.Multithreading.Scheduling == 1.
+	// Steering runs on per species tiles when there's more than one species, the other phases on tiles of every boid.
+	FFlockTileSchedule TileSchedule;
+	TArray<FFlockTileSchedule> SpeciesTileSchedules;
+
+	// Initialize, steer, integrate over the species buckets. Used when BoidSimulation.Multithreading.Scheduling == 2.
+	TFlockPhasedRegion<3> PhasedRegion;
 	
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
 	TObjectPtr<UInstancedStaticMeshComponent> Mesh;
 
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	TObjectPtr<UFlockRenderComponent> RenderComponent;
+
+	// Resolved from Renderer on BeginPlay. When false Mesh holds no instances and nothing touches it per boid.
+	// False until then, so boids replicated or loaded earlier leave Mesh alone and BeginPlay adds all their instances at once, encoded the way it resolved.
+	bool bUpdateInstances = false;
+
+	// Resolved from Renderer on BeginPlay. The integrate phase fills RenderComponent's write frame. Neither this nor bUpdateInstances when headless.
+	bool bPublishRenderFrames = false;
+
+	// InstanceEncoding as of BeginPlay, which sized the ISM's custom data for it. Editing InstanceEncoding later must not change what gets written there.
+	EFlockInstanceEncoding ActiveInstanceEncoding = EFlockInstanceEncoding::Transform;
+
+	// Set once the integrate phase has filled RenderComponent's write frame, cleared when it's published.
+	bool bRenderFramePending = false;
+
+	UE_NODISCARD FORCEINLINE int32 GetNumSlots() const
+	{
+		return BoidLocations.Num();
+	}
+
+	UE_NODISCARD FORCEINLINE bool IsSlotAlive(const int32 Slot) const
+	{
+		return SlotHandles[Slot].IsValid();
+	}
+
+	// The parts of the parameter block that come from console variables, or from the server for lockstep clients.
+	struct FSimulationSwitches
+	{
+		EFlockSteeringMath SteeringMath;
+		bool bCompactState;
+		bool bFarField;
+	};
+	UE_NODISCARD FSimulationSwitches ResolveSimulationSwitches() const;
+
+	UE_NODISCARD TSharedRef<const FParameterBlock, ESPMode::ThreadSafe> BuildParameters() const;
+	void UpdateParameters();
+
 	UE_NODISCARD FORCEINLINE int32 GetHalfCellDimensions() const
 	{
 		return FMath::CeilToInt32(BoundsRadius / CELL_SIZE);
@@ -95,18 +689,31 @@ protected:
 		};
 	}
 	
-	FORCEINLINE void ForEachNearbyBoid(const FVector& RESTRICT Location, const TConstArrayView<FVector>& RESTRICT OtherLocations, const TFunctionRef<void(int32, const FVector&)>& Functor) const
+	// Where the grid walks read a neighbor's location from, given the center of the cell they found it in.
+	UE_NODISCARD static FORCEINLINE const FVector& GetOtherLocation(const TConstArrayView<FVector>& OtherLocations, const int32 Slot, const FVector& CellLocation)
+	{
+		return OtherLocations[Slot];
+	}
+
+	UE_NODISCARD static FORCEINLINE FVector GetOtherLocation(const TConstArrayView<FFlockCompactBoid>& OtherBoids, const int32 Slot, const FVector& CellLocation)
+	{
+		return FlockCompactState::DecodeLocation(OtherBoids[Slot], CellLocation, CELL_SIZE);
+	}
+
+	// OtherLocations is either full precision locations or FFlockCompactBoid, see GetOtherLocation.
+	template<typename OtherType>
+	FORCEINLINE void ForEachNearbyBoid(const FVector& RESTRICT Location, const TConstArrayView<OtherType>& RESTRICT OtherLocations, const double SearchRadius, const TFunctionRef<void(int32, const FVector&)>& Functor) const
 	{
 		const int32 CellDimensions = GetCellDimensions();
 		
-		const int32 StartX = FMath::Clamp(FMath::RoundToInt32((Location.X - BoidsSearchNearbyRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
-		const int32 EndX = FMath::Clamp(FMath::RoundToInt32((Location.X + BoidsSearchNearbyRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+		const int32 StartX = FMath::Clamp(FMath::RoundToInt32((Location.X - SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+		const int32 EndX = FMath::Clamp(FMath::RoundToInt32((Location.X + SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
 
-		const int32 StartY = FMath::Clamp(FMath::RoundToInt32((Location.Y - BoidsSearchNearbyRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
-		const int32 EndY = FMath::Clamp(FMath::RoundToInt32((Location.Y + BoidsSearchNearbyRadius + BoundsRadius) / CELL_SIZE), 0.0, CellDimensions - 1);
+		const int32 StartY = FMath::Clamp(FMath::RoundToInt32((Location.Y - SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+		const int32 EndY = FMath::Clamp(FMath::RoundToInt32((Location.Y + SearchRadius + BoundsRadius) / CELL_SIZE), 0.0, CellDimensions - 1);
 
-		const int32 StartZ = FMath::Clamp(FMath::RoundToInt32((Location.Z - BoidsSearchNearbyRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
-		const int32 EndZ = FMath::Clamp(FMath::RoundToInt32((Location.Z + BoidsSearchNearbyRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+		const int32 StartZ = FMath::Clamp(FMath::RoundToInt32((Location.Z - SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+		const int32 EndZ = FMath::Clamp(FMath::RoundToInt32((Location.Z + SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
 
 		for (int32 Z = StartZ; Z < EndZ + 1; ++Z)
 		{
@@ -116,29 +723,339 @@ protected:
 				{
 					const FIntVector CellCoordinates{X, Y, Z};
 					const FVector CellLocation = GetCellLocation(CellCoordinates);
-					if (!FMath::SphereAABBIntersection(Location, FMath::Square(static_cast<double>(BoidsSearchNearbyRadius)), FBox{CellLocation - FVector{CELL_SIZE / 2.0}, CellLocation + FVector{CELL_SIZE / 2.0}})) continue;
+					if (!FMath::SphereAABBIntersection(Location, FMath::Square(SearchRadius), FBox{CellLocation - FVector{CELL_SIZE / 2.0}, CellLocation + FVector{CELL_SIZE / 2.0}})) continue;
 					
 					for (const int32 OtherBoidIndex : BoidCells[GetCellIndex(CellCoordinates)])
 					{
-						if (FVector::DistSquared(Location, OtherLocations[OtherBoidIndex]) > FMath::Square(BoidsSearchNearbyRadius)) continue;
+						const FVector& OtherLocation = GetOtherLocation(OtherLocations, OtherBoidIndex, CellLocation);
+						if (FVector::DistSquared(Location, OtherLocation) > FMath::Square(SearchRadius)) continue;
+
+						Functor(OtherBoidIndex, OtherLocation);
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	 * Every cell ForEachNearbyBoid would walk, handed to CellFunctor with its center instead so the caller walks it however it likes.
+	 * Cells entirely inside FarFieldRadius that aren't adjacent to Location's own cell go to FarCellFunctor instead, to be taken as a whole.
+	 * Cells reaching into NearRadius never do, so rules that need every boid within it, like separation, still see them.
+	 */
+	template<typename CellFunctorType, typename FarCellFunctorType>
+	FORCEINLINE void ForEachNearbyCell(const FVector& RESTRICT Location, const double SearchRadius, const double FarFieldRadius, const double NearRadius, CellFunctorType&& CellFunctor, FarCellFunctorType&& FarCellFunctor) const
+	{
+		const int32 CellDimensions = GetCellDimensions();
+		const FIntVector OwnCellCoordinates = GetCellCoordinates(Location);
+		const double RadiusSquared = FMath::Square(SearchRadius);
+		const double NearRadiusSquared = FMath::Square(NearRadius);
+
+		const int32 StartX = FMath::Clamp(FMath::RoundToInt32((Location.X - SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+		const int32 EndX = FMath::Clamp(FMath::RoundToInt32((Location.X + SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+
+		const int32 StartY = FMath::Clamp(FMath::RoundToInt32((Location.Y - SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+		const int32 EndY = FMath::Clamp(FMath::RoundToInt32((Location.Y + SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+
+		const int32 StartZ = FMath::Clamp(FMath::RoundToInt32((Location.Z - SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+		const int32 EndZ = FMath::Clamp(FMath::RoundToInt32((Location.Z + SearchRadius + BoundsRadius) / CELL_SIZE), 0, CellDimensions - 1);
+
+		for (int32 Z = StartZ; Z < EndZ + 1; ++Z)
+		{
+			for (int32 Y = StartY; Y < EndY + 1; ++Y)
+			{
+				for (int32 X = StartX; X < EndX + 1; ++X)
+				{
+					const FIntVector CellCoordinates{X, Y, Z};
+					const FVector CellLocation = GetCellLocation(CellCoordinates);
+					if (!FMath::SphereAABBIntersection(Location, RadiusSquared, FBox{CellLocation - FVector{CELL_SIZE / 2.0}, CellLocation + FVector{CELL_SIZE / 2.0}})) continue;
+
+					const int32 CellIndex = GetCellIndex(CellCoordinates);
+
+					const bool bAdjacent = FMath::Abs(X - OwnCellCoordinates.X) <= 1 && FMath::Abs(Y - OwnCellCoordinates.Y) <= 1 && FMath::Abs(Z - OwnCellCoordinates.Z) <= 1;
 
-						Functor(OtherBoidIndex, OtherLocations[OtherBoidIndex]);
+					// Cells on the edge of the grid also hold every boid clamped into them from beyond it, which can be anywhere outside their box.
+					const bool bBorder = X == 0 || Y == 0 || Z == 0 || X == CellDimensions - 1 || Y == CellDimensions - 1 || Z == CellDimensions - 1;
+					if (FarFieldRadius > 0.0 && !bAdjacent && !bBorder)
+					{
+						// Farthest and nearest points of the cell from Location.
+						const FVector FarthestOffset = (Location - CellLocation).GetAbs() + FVector{CELL_SIZE / 2.0};
+						const FVector NearestOffset = ((Location - CellLocation).GetAbs() - FVector{CELL_SIZE / 2.0}).ComponentMax(FVector::ZeroVector);
+						if (FarthestOffset.SizeSquared() <= FMath::Square(FarFieldRadius) && NearestOffset.SizeSquared() > NearRadiusSquared)
+						{
+							FarCellFunctor(CellIndex);
+							continue;
+						}
 					}
+
+					CellFunctor(CellIndex, CellLocation);
 				}
 			}
 		}
 	}
 
+	// Hands Functor a cell's boids in runs, each tagged std::true_type when they're all of Species or std::false_type when none of them are.
+	template<typename FunctorType>
+	FORCEINLINE void ForEachCellRun(const FSpeciesCells& SpeciesCells, const int32 CellIndex, const int32 Species, FunctorType&& Functor) const
+	{
+		if (SpeciesCells.Offsets.IsEmpty())
+		{
+			Functor(TConstArrayView<int32>{BoidCells[CellIndex]}, std::true_type{});
+			return;
+		}
+
+		Functor(SpeciesCells.GetRun(CellIndex, 0, Species), std::false_type{});
+		Functor(SpeciesCells.GetRun(CellIndex, Species, Species + 1), std::true_type{});
+		Functor(SpeciesCells.GetRun(CellIndex, Species + 1, SpeciesCells.NumSpecies), std::false_type{});
+	}
+
+	/**
+	 * Collects up to K nearest boids accepted by Filter, and where they are, into OutBoids and OutLocations by searching shells of cells of growing Chebyshev distance around Location,
+	 * keeping the best K in a fixed size max-heap. Stops once no unvisited cell can hold anything closer than the current K-th candidate,
+	 * or as soon as MaxCandidates have been examined with a full heap, even mid cell, which is what bounds the cost inside very dense clumps (results become approximate there).
+	 * Boids of Species come first, the returned number of them, as told by the cell runs they were found in.
+	 */
+	template<int32 MaxK, typename OtherType, typename FilterType>
+	int32 FindNearestBoids(const FVector& RESTRICT Location, const TConstArrayView<OtherType>& RESTRICT OtherLocations, const FSpeciesCells& SpeciesCells, const int32 Species, const int32 K, const int32 MaxCandidates, FilterType&& Filter, TArray<int32, TInlineAllocator<32>>& OutBoids, TArray<FVector, TInlineAllocator<32>>& OutLocations) const
+	{
+		check(K > 0 && K <= MaxK);
+
+		struct FCandidate
+		{
+			double DistSquared;
+			int32 BoidIndex;
+			FVector Location;
+			bool bSameSpecies;
+
+			// Max-heap on distance.
+			UE_NODISCARD FORCEINLINE bool operator<(const FCandidate& Other) const
+			{
+				return DistSquared > Other.DistSquared;
+			}
+		};
+
+		TArray<FCandidate, TInlineAllocator<MaxK>> Heap;
+		int32 NumCandidates = 0;
+		bool bOutOfBudget = false;
+
+		const int32 CellDimensions = GetCellDimensions();
+		const FIntVector Own = GetCellCoordinates(Location);
+		const int32 MaxShell = FMath::Max3(FMath::Max(Own.X, CellDimensions - 1 - Own.X), FMath::Max(Own.Y, CellDimensions - 1 - Own.Y), FMath::Max(Own.Z, CellDimensions - 1 - Own.Z));
+
+		const auto VisitCell = [&](const int32 X, const int32 Y, const int32 Z) -> void
+		{
+			const FIntVector CellCoordinates{X, Y, Z};
+			const FVector CellLocation = GetCellLocation(CellCoordinates);
+
+			ForEachCellRun(SpeciesCells, GetCellIndex(CellCoordinates), Species, [&](const TConstArrayView<int32>& Run, const auto bSameSpecies) -> void
+			{
+				for (const int32 OtherBoidIndex : Run)
+				{
+					if (bOutOfBudget) return;
+
+					const FVector& OtherLocation = GetOtherLocation(OtherLocations, OtherBoidIndex, CellLocation);
+					if (!Filter(OtherBoidIndex, OtherLocation)) continue;
+
+					++NumCandidates;
+
+					const double DistSquared = FVector::DistSquared(Location, OtherLocation);
+					if (Heap.Num() < K)
+					{
+						Heap.HeapPush(FCandidate{DistSquared, OtherBoidIndex, OtherLocation, bSameSpecies});
+					}
+					else if (DistSquared < Heap.HeapTop().DistSquared)
+					{
+						Heap.HeapPopDiscard(false);
+						Heap.HeapPush(FCandidate{DistSquared, OtherBoidIndex, OtherLocation, bSameSpecies});
+					}
+
+					bOutOfBudget = Heap.Num() == K && NumCandidates >= MaxCandidates;
+				}
+			});
+		};
+
+		for (int32 Shell = 0; Shell <= MaxShell; ++Shell)
+		{
+			const int32 StartZ = FMath::Max(Own.Z - Shell, 0), EndZ = FMath::Min(Own.Z + Shell, CellDimensions - 1);
+			const int32 StartY = FMath::Max(Own.Y - Shell, 0), EndY = FMath::Min(Own.Y + Shell, CellDimensions - 1);
+			const int32 StartX = FMath::Max(Own.X - Shell, 0), EndX = FMath::Min(Own.X + Shell, CellDimensions - 1);
+
+			for (int32 Z = StartZ; Z <= EndZ && !bOutOfBudget; ++Z)
+			{
+				for (int32 Y = StartY; Y <= EndY && !bOutOfBudget; ++Y)
+				{
+					// Only the surface of the cube is new. Rows through the interior just contribute their two end cells.
+					if (FMath::Abs(Z - Own.Z) < Shell && FMath::Abs(Y - Own.Y) < Shell)
+					{
+						if (Own.X - Shell >= 0) VisitCell(Own.X - Shell, Y, Z);
+						if (!bOutOfBudget && Shell > 0 && Own.X + Shell < CellDimensions) VisitCell(Own.X + Shell, Y, Z);
+						continue;
+					}
+
+					for (int32 X = StartX; X <= EndX && !bOutOfBudget; ++X)
+					{
+						VisitCell(X, Y, Z);
+					}
+				}
+			}
+
+			if (bOutOfBudget) break;
+			if (Heap.Num() < K) continue;
+
+			// Location is within half a cell of its own cell's center, so anything beyond this shell is at least Shell cells away.
+			if (Heap.HeapTop().DistSquared <= FMath::Square(Shell * CELL_SIZE)) break;
+		}
+
+		int32 NumSameSpecies = 0;
+		for (const FCandidate& Candidate : Heap)
+		{
+			NumSameSpecies += Candidate.bSameSpecies;
+		}
+
+		OutBoids.SetNumUninitialized(Heap.Num());
+		OutLocations.SetNumUninitialized(Heap.Num());
+		for (int32 i = 0, SameIndex = 0, OtherIndex = NumSameSpecies; i < Heap.Num(); ++i)
+		{
+			const int32 OutIndex = Heap[i].bSameSpecies ? SameIndex++ : OtherIndex++;
+			OutBoids[OutIndex] = Heap[i].BoidIndex;
+			OutLocations[OutIndex] = Heap[i].Location;
+		}
+		return NumSameSpecies;
+	}
+
+	template<typename FunctorType>
+	void ForEachBoidInQuery(const FFlockSpatialQuery& Query, FunctorType&& Functor) const
+	{
+		const int32 CellDimensions = GetCellDimensions();
+
+		const FBox Bounds = Query.GetBounds();
+		const FIntVector Min = Bounds.IsValid ? GetCellCoordinates(Bounds.Min) : FIntVector{0};
+		const FIntVector Max = Bounds.IsValid ? GetCellCoordinates(Bounds.Max) : FIntVector{CellDimensions - 1};
+
+		for (int32 Z = Min.Z; Z <= Max.Z; ++Z)
+		{
+			for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+			{
+				for (int32 X = Min.X; X <= Max.X; ++X)
+				{
+					const FIntVector CellCoordinates{X, Y, Z};
+					if (!Query.MayIntersectCell(GetCellLocation(CellCoordinates), CELL_SIZE / 2.0)) continue;
+
+					for (const int32 Slot : BoidCells[GetCellIndex(CellCoordinates)])
+					{
+						if (Query.Contains(BoidLocations[Slot]))
+						{
+							Functor(Slot);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// EFlockInstanceEncoding::Direction only. Writes straight into the ISM's custom data, so distinct slots can be written from any thread.
+	FORCEINLINE void WriteInstanceDirection(const int32 Slot)
+	{
+		Mesh->PerInstanceSMCustomData.GetData()[Slot * FlockInstanceEncoding::NumCustomDataFloats] = FlockInstanceEncoding::PackDirection(BoidDirections[Slot]);
+	}
+
+	// Union of the occupied grid cells, relative to the flock. Cheap enough to run every tick, unlike walking the boids.
+	UE_NODISCARD FBox ComputeOccupiedBounds() const;
+
 	void RelocateBoidCell(const int32 BoidIndex, const FVector& LastLocation, const FVector& NewLocation);
 
-	void Avoid(FVector& RESTRICT OutDirection, const TConstArrayView<FVector>& Directions, const TConstArrayView<FVector>& Locations, const int32 BoidIndex, const TConstArrayView<int32>& OtherRelevantBoidIndices) const;
-	void Align(FVector& RESTRICT OutDirection, const TConstArrayView<FVector>& Directions, const TConstArrayView<FVector>& Locations, const int32 BoidIndex, const TConstArrayView<int32>& OtherRelevantBoidIndices) const;
-	void Cohere(FVector& RESTRICT OutDirection, const TConstArrayView<FVector>& Directions, const TConstArrayView<FVector>& Locations, const int32 BoidIndex, const TConstArrayView<int32>& OtherRelevantBoidIndices) const;
-	void Constrain(FVector& RESTRICT OutDirection, const FVector& RESTRICT Location, const int32 BoidIndex) const;
+	void Avoid(FVector& RESTRICT OutDirection, const FBoidNeighborhood& Neighborhood, const FBoidSpeciesRules& Rules) const;
+	void Align(FVector& RESTRICT OutDirection, const FBoidNeighborhood& Neighborhood, const FBoidSpeciesRules& Rules, const EFlockSteeringMath SteeringMath) const;
+	void Cohere(FVector& RESTRICT OutDirection, const FVector& RESTRICT Location, const FBoidNeighborhood& Neighborhood, const FBoidSpeciesRules& Rules, const EFlockSteeringMath SteeringMath) const;
+	void Constrain(FVector& RESTRICT OutDirection, const FVector& RESTRICT Location, const int32 BoidIndex, const FParameterBlock& InParameters) const;
+
+	// Sizes the grid. Must run before anything is added.
+	void InitializeSimulation();
+
+	// Spawns NumInstances boids spread uniformly over the bounds with random headings and species, all drawn from Stream.
+	void ScatterBoids(const FRandomStream& Stream);
+	void MakeScatterRequests(const FRandomStream& Stream, TArray<FSpawnRequest>& OutRequests);
+
+	// Replaces every boid with the baked ones in bulk. The flock must be empty.
+	void LoadWarmState(const UFlockWarmState& State);
+
+	// The block behind SaveState, LoadState and save game serialization.
+	void SerializeState(FArchive& Ar);
+
+	// Makes the grid, instances and everything derived from them match freshly loaded slots.
+	void ApplyLoadedState();
+
+	// Adds an ISM instance, plus its encoded direction, for every slot at once. Mesh must be empty.
+	void AddAllInstances();
+
+	// Rebuilds BoidCells from BoidLocations: cell indices in parallel, a counting sort by cell, then every cell fills its list in parallel.
+	void RebuildGrid();
+
+	// A replicated boid as the server last sent it.
+	struct FReplicatedBoid
+	{
+		FFlockBoidHandle Handle;
+		FVector Location;
+		FVector Direction;
+		uint8 Species = 0;
+	};
+
+	// Client only. Applies one replication update immediately, taking the simulation lock. Boids the flock doesn't have yet are added, removals of ones it doesn't have are ignored.
+	void ApplyReplicatedBoids(const TConstArrayView<FFlockBoidHandle>& Removed, const TConstArrayView<FReplicatedBoid>& Boids);
+
+	// Adds boids immediately. Game thread only, outside of the simulation.
+	void AddBoids(const TConstArrayView<FSpawnRequest>& Requests);
+	void RemoveBoids(const TConstArrayView<FFlockBoidHandle>& Handles);
+
+	// Safe point at the start of the tick. Applies queued spawns then despawns, and compacts the slots if enough of them are free.
+	void ApplyPendingSpawnRequests();
+	void CompactSlots();
+
+	// Steers a single boid, with every rule outside RuleMask compiled out. bCompactState picks which of FSteerContext's buffers neighbors are read from.
+	template<uint32 RuleMask, bool bCompactState>
+	void SteerBoid(const FSteerContext& Context, const int32 BoidIndex);
+
+	UE_NODISCARD static FSteerKernel GetSteerKernel(const uint32 RuleMask, const bool bCompactState);
+
+	// Species, or a single default one when there are none.
+	UE_NODISCARD TConstArrayView<FFlockSpecies> GetSpeciesOrDefault() const;
+
+	void BuildSpeciesBuckets(const int32 NumSpecies);
+	void BuildSpeciesCells(const int32 NumSpecies);
+
+	void UpdateBoidBVH();
+
+	// Builds BoidBVH from scratch right away, or empties it when traces are off. Under the write lock, or before anything can trace.
+	void RebuildBoidBVH();
+
+	// Links every pair of boids within the link radius in parallel, then reduces the resulting sets into Clusters.
+	void UpdateClusters(const FParameterBlock& InParameters);
+
+	void ConsumeCollisionProbes();
+	void IssueCollisionProbes(const FParameterBlock& InParameters);
+	void BuildCellAggregates(const TConstArrayView<FVector>& Directions, const FSpeciesCells& SpeciesCells);
+	void UpdateInfluenceField();
 
 	void SimulateSynchronously(float DeltaTime);
 	void SimulateAsynchronously(float DeltaTime);
+
+	UE_NODISCARD FORCEINLINE bool IsLockstepClient() const
+	{
+		return ReplicationMode == EFlockReplicationMode::Lockstep && !HasAuthority();
+	}
+
+	// Orders every cell's list by handle. Neighbor order feeds the floating point sums and the grid's lists are filled racily, so this is what makes a step repeatable.
+	void SortBoidCells();
+
+	// Scatters the whole flock from the shared seed and keeps this shard's slab. False when the flock is too small to split that many ways.
+	UE_NODISCARD bool StartShard(const FFlockShard::FConfig& Config);
 	
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	virtual void Tick(float DeltaTime) override;
+
+	virtual void PreSave(FObjectPreSaveContext SaveContext) override;
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
 };
@@ -0,0 +1,94 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockAdaptiveBatches.h"
+#include "Async/TaskGraphInterfaces.h"
+
+namespace BoidSimulationCVars
+{
+static TAutoConsoleVariable<int32> BatchSize{
+	TEXT("BoidSimulation.Multithreading.BatchSize"),
+	64,
+	TEXT("Initial number of boids per ParallelFor batch. Batches adapt to their measured cost from there on.")};
+
+static TAutoConsoleVariable<float> MinBatchMicroseconds{
+	TEXT("BoidSimulation.Multithreading.MinBatchMicroseconds"),
+	20.f,
+	TEXT("Lower bound on the cost of a single adaptive batch. Keeps cheap passes from flooding the task graph.")};
+
+static TAutoConsoleVariable<int32> BatchesPerWorker{
+	TEXT("BoidSimulation.Multithreading.BatchesPerWorker"),
+	4,
+	TEXT("Number of equally expensive batches to aim for per worker thread when the pass is expensive enough.")};
+}
+
+float FFlockAdaptiveBatches::GetAverageBatchMicroseconds() const
+{
+	if (BatchCycles.IsEmpty()) return 0.f;
+
+	uint64 TotalCycles = 0;
+	for (const uint64 Cycles : BatchCycles)
+	{
+		TotalCycles += Cycles;
+	}
+
+	return static_cast<float>(FPlatformTime::ToMilliseconds64(TotalCycles) * 1000.0 / static_cast<double>(BatchCycles.Num()));
+}
+
+void FFlockAdaptiveBatches::Repartition(const int32 Num)
+{
+	const int32 InitialBatchSize = FMath::Max(BoidSimulationCVars::BatchSize.GetValueOnAnyThread(), 1);
+
+	const bool bCanAdapt = BatchStarts.Num() > 1 && BatchStarts.Last() == Num && BatchCycles.Num() == GetNumBatches() && InitialBatchSize == LastInitialBatchSize;
+	if (!bCanAdapt)
+	{
+		LastInitialBatchSize = InitialBatchSize;
+
+		BatchStarts.Reset(Num / InitialBatchSize + 2);
+		for (int32 Start = 0; Start < Num; Start += InitialBatchSize)
+		{
+			BatchStarts.Add(Start);
+		}
+		BatchStarts.Add(Num);
+		return;
+	}
+
+	uint64 TotalCycles = 0;
+	for (const uint64 Cycles : BatchCycles)
+	{
+		TotalCycles += FMath::Max<uint64>(Cycles, 1);
+	}
+
+	// Aim for a handful of batches per worker so the scheduler can balance, but never go below the cost floor where task overhead dominates.
+	const int32 NumWorkers = FMath::Max(FTaskGraphInterface::Get().GetNumWorkerThreads(), 1) + 1;
+	const double MinBatchCycles = static_cast<double>(BoidSimulationCVars::MinBatchMicroseconds.GetValueOnAnyThread()) / (FPlatformTime::GetSecondsPerCycle64() * 1000000.0);
+	const double TargetCycles = FMath::Max(static_cast<double>(TotalCycles) / static_cast<double>(NumWorkers * FMath::Max(BoidSimulationCVars::BatchesPerWorker.GetValueOnAnyThread(), 1)), MinBatchCycles);
+
+	// Re-cut the piecewise constant cost of the previous run into pieces of TargetCycles each.
+	TArray<int32> NewBatchStarts;
+	NewBatchStarts.Reserve(BatchStarts.Num());
+	NewBatchStarts.Add(0);
+
+	double AccumulatedCycles = 0.0;
+	for (int32 BatchIndex = 0; BatchIndex < GetNumBatches(); ++BatchIndex)
+	{
+		const int32 End = BatchStarts[BatchIndex + 1];
+		const double CyclesPerItem = static_cast<double>(FMath::Max<uint64>(BatchCycles[BatchIndex], 1)) / static_cast<double>(End - BatchStarts[BatchIndex]);
+
+		for (int32 Item = BatchStarts[BatchIndex]; Item < End;)
+		{
+			const int32 NumToTake = FMath::Clamp(FMath::CeilToInt32((TargetCycles - AccumulatedCycles) / CyclesPerItem), 1, End - Item);
+			Item += NumToTake;
+			AccumulatedCycles += NumToTake * CyclesPerItem;
+
+			if (AccumulatedCycles >= TargetCycles && Item < Num)
+			{
+				NewBatchStarts.Add(Item);
+				AccumulatedCycles = 0.0;
+			}
+		}
+	}
+	NewBatchStarts.Add(Num);
+
+	BatchStarts = MoveTemp(NewBatchStarts);
+}
@@ -0,0 +1,74 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/ParallelFor.h"
+
+/**
+ * Splits a ParallelFor over [0, Num) into variable sized batches that adapt online to their measured cost.
+ * The first run (and any run after the item count or BoidSimulation.Multithreading.BatchSize changes) uses uniform batches
+ * of the CVar's size. Every following run re-cuts the previous run's per-batch cost into batches of roughly equal cost,
+ * so expensive (dense) index ranges end up in smaller batches and cheap passes coalesce into fewer, larger ones.
+ */
+class BOIDSIMULATION_API FFlockAdaptiveBatches
+{
+public:
+	explicit FFlockAdaptiveBatches(const TCHAR* InDebugName)
+		: DebugName{InDebugName}
+	{
+	}
+
+	template<typename BodyType>
+	void ParallelFor(const int32 Num, BodyType&& Body)
+	{
+		Repartition(Num);
+
+		const int32 NumBatches = GetNumBatches();
+		BatchCycles.SetNumUninitialized(NumBatches);
+
+		::ParallelFor(DebugName, NumBatches, 1, [&](const int32 BatchIndex) -> void
+		{
+			const uint64 StartCycles = FPlatformTime::Cycles64();
+
+			const int32 End = BatchStarts[BatchIndex + 1];
+			for (int32 i = BatchStarts[BatchIndex]; i < End; ++i)
+			{
+				Body(i);
+			}
+
+			BatchCycles[BatchIndex] = FPlatformTime::Cycles64() - StartCycles;
+		}, EParallelForFlags::Unbalanced);
+	}
+
+	UE_NODISCARD FORCEINLINE int32 GetNumBatches() const
+	{
+		return FMath::Max(BatchStarts.Num() - 1, 0);
+	}
+
+	UE_NODISCARD FORCEINLINE float GetAverageBatchSize() const
+	{
+		return GetNumBatches() > 0 ? static_cast<float>(BatchStarts.Last()) / static_cast<float>(GetNumBatches()) : 0.f;
+	}
+
+	// Average measured batch cost of the last run in microseconds.
+	UE_NODISCARD float GetAverageBatchMicroseconds() const;
+
+	// Forces the next run to start over from uniform batches of BoidSimulation.Multithreading.BatchSize.
+	FORCEINLINE void Reset()
+	{
+		BatchStarts.Reset();
+		BatchCycles.Reset();
+	}
+
+private:
+	void Repartition(const int32 Num);
+
+	const TCHAR* DebugName;
+
+	// NumBatches + 1 entries, BatchStarts.Last() == Num.
+	TArray<int32> BatchStarts;
+	TArray<uint64> BatchCycles;
+
+	int32 LastInitialBatchSize = 0;
+};
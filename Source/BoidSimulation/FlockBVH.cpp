@@ -0,0 +1,255 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockBVH.h"
+#include "Algo/Partition.h"
+#include "Async/ParallelFor.h"
+
+namespace FlockBVH
+{
+UE_NODISCARD FORCEINLINE double HalfSurfaceArea(const FVector& Min, const FVector& Max)
+{
+	const FVector Size = Max - Min;
+	return Size.X * Size.Y + Size.Y * Size.Z + Size.Z * Size.X;
+}
+
+// Slab test of the segment Start + T * Delta, T in [0, MaxT], against a box. Axes the segment is parallel to must contain Start.
+UE_NODISCARD FORCEINLINE bool SegmentIntersectsBox(const FVector& Start, const FVector& Delta, const FVector& InvDelta, const FVector& Min, const FVector& Max, const double MaxT, double& OutEnterT)
+{
+	double EnterT = 0.0;
+	double ExitT = MaxT;
+
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		if (FMath::Abs(Delta[Axis]) < UE_DOUBLE_SMALL_NUMBER)
+		{
+			if (Start[Axis] < Min[Axis] || Start[Axis] > Max[Axis]) return false;
+			continue;
+		}
+
+		double NearT = (Min[Axis] - Start[Axis]) * InvDelta[Axis];
+		double FarT = (Max[Axis] - Start[Axis]) * InvDelta[Axis];
+		if (NearT > FarT)
+		{
+			Swap(NearT, FarT);
+		}
+
+		EnterT = FMath::Max(EnterT, NearT);
+		ExitT = FMath::Min(ExitT, FarT);
+		if (EnterT > ExitT) return false;
+	}
+
+	OutEnterT = EnterT;
+	return true;
+}
+
+// Segment Start + T * Delta against a sphere. Starting inside counts as a hit at T == 0.
+UE_NODISCARD FORCEINLINE bool SegmentIntersectsSphere(const FVector& Start, const FVector& Delta, const FVector& Center, const double RadiusSquared, double& OutT)
+{
+	const FVector M = Start - Center;
+	const double C = M.SizeSquared() - RadiusSquared;
+	if (C <= 0.0)
+	{
+		OutT = 0.0;
+		return true;
+	}
+
+	const double A = Delta.SizeSquared();
+	const double B = M | Delta;
+	if (B >= 0.0) return false;// Moving away
+
+	const double Discriminant = B * B - A * C;
+	if (Discriminant < 0.0) return false;
+
+	OutT = (-B - FMath::Sqrt(Discriminant)) / A;
+	return true;
+}
+}
+
+void FFlockBVH::Reset()
+{
+	Nodes.Reset();
+	Slots.Reset();
+	LeafNodes.Reset();
+	BuildCost = 0.0;
+}
+
+void FFlockBVH::Build(const TConstArrayView<FVector>& Locations, const TFunctionRef<bool(int32)>& IsSlotAlive, const double InBoidRadius)
+{
+	BoidRadius = InBoidRadius;
+
+	Nodes.Reset();
+	Slots.Reset();
+	LeafNodes.Reset();
+	BuildCost = 0.0;
+
+	for (int32 Slot = 0; Slot < Locations.Num(); ++Slot)
+	{
+		if (IsSlotAlive(Slot))
+		{
+			Slots.Add(Slot);
+		}
+	}
+
+	if (Slots.IsEmpty()) return;
+
+	struct FBuildTask
+	{
+		int32 NodeIndex;
+		int32 First;
+		int32 Count;
+	};
+
+	TArray<FBuildTask, TInlineAllocator<64>> Stack;
+	Nodes.Reserve(2 * FMath::DivideAndRoundUp(Slots.Num(), MaxLeafSize));
+	Nodes.AddUninitialized();
+	Stack.Push(FBuildTask{0, 0, Slots.Num()});
+
+	while (!Stack.IsEmpty())
+	{
+		const FBuildTask Task = Stack.Pop(false);
+
+		FVector CentroidMin{UE_DOUBLE_BIG_NUMBER};
+		FVector CentroidMax{-UE_DOUBLE_BIG_NUMBER};
+		for (int32 i = Task.First; i < Task.First + Task.Count; ++i)
+		{
+			CentroidMin = CentroidMin.ComponentMin(Locations[Slots[i]]);
+			CentroidMax = CentroidMax.ComponentMax(Locations[Slots[i]]);
+		}
+
+		Nodes[Task.NodeIndex].Min = CentroidMin - FVector{BoidRadius};
+		Nodes[Task.NodeIndex].Max = CentroidMax + FVector{BoidRadius};
+
+		if (Task.Count <= MaxLeafSize)
+		{
+			Nodes[Task.NodeIndex].FirstOrLeft = Task.First;
+			Nodes[Task.NodeIndex].Count = Task.Count;
+			LeafNodes.Add(Task.NodeIndex);
+			continue;
+		}
+
+		// Spatial median along the longest centroid axis. Falls back to an even split when every centroid lands on one side.
+		const FVector CentroidSize = CentroidMax - CentroidMin;
+		const int32 Axis = CentroidSize.X >= CentroidSize.Y && CentroidSize.X >= CentroidSize.Z ? 0 : (CentroidSize.Y >= CentroidSize.Z ? 1 : 2);
+		const double Split = (CentroidMin[Axis] + CentroidMax[Axis]) * 0.5;
+
+		int32 NumLeft = Algo::Partition(Slots.GetData() + Task.First, Task.Count, [&](const int32 Slot) -> bool
+		{
+			return Locations[Slot][Axis] < Split;
+		});
+		if (NumLeft == 0 || NumLeft == Task.Count)
+		{
+			NumLeft = Task.Count / 2;
+		}
+
+		const int32 LeftIndex = Nodes.AddUninitialized(2);
+		Nodes[Task.NodeIndex].FirstOrLeft = LeftIndex;
+		Nodes[Task.NodeIndex].Count = 0;
+
+		Stack.Push(FBuildTask{LeftIndex, Task.First, NumLeft});
+		Stack.Push(FBuildTask{LeftIndex + 1, Task.First + NumLeft, Task.Count - NumLeft});
+	}
+
+	BuildCost = ComputeCost();
+}
+
+void FFlockBVH::Refit(const TConstArrayView<FVector>& Locations)
+{
+	ParallelFor(LeafNodes.Num(), [&](const int32 i) -> void
+	{
+		FNode& Node = Nodes[LeafNodes[i]];
+
+		FVector Min{UE_DOUBLE_BIG_NUMBER};
+		FVector Max{-UE_DOUBLE_BIG_NUMBER};
+		for (int32 SlotIndex = Node.FirstOrLeft; SlotIndex < Node.FirstOrLeft + Node.Count; ++SlotIndex)
+		{
+			Min = Min.ComponentMin(Locations[Slots[SlotIndex]]);
+			Max = Max.ComponentMax(Locations[Slots[SlotIndex]]);
+		}
+
+		Node.Min = Min - FVector{BoidRadius};
+		Node.Max = Max + FVector{BoidRadius};
+	});
+
+	for (int32 NodeIndex = Nodes.Num() - 1; NodeIndex >= 0; --NodeIndex)
+	{
+		FNode& Node = Nodes[NodeIndex];
+		if (Node.IsLeaf()) continue;
+
+		const FNode& Left = Nodes[Node.FirstOrLeft];
+		const FNode& Right = Nodes[Node.FirstOrLeft + 1];
+		Node.Min = Left.Min.ComponentMin(Right.Min);
+		Node.Max = Left.Max.ComponentMax(Right.Max);
+	}
+}
+
+double FFlockBVH::ComputeCost() const
+{
+	if (Nodes.IsEmpty()) return 0.0;
+
+	double TotalArea = 0.0;
+	for (const FNode& Node : Nodes)
+	{
+		TotalArea += FlockBVH::HalfSurfaceArea(Node.Min, Node.Max);
+	}
+
+	return TotalArea / FMath::Max(FlockBVH::HalfSurfaceArea(Nodes[0].Min, Nodes[0].Max), UE_DOUBLE_SMALL_NUMBER);
+}
+
+int32 FFlockBVH::Sweep(const FVector& Start, const FVector& End, const double SweepRadius, const TConstArrayView<FVector>& Locations, const TFunctionRef<bool(int32)>& IsSlotAlive, double& OutTime) const
+{
+	if (Nodes.IsEmpty()) return INDEX_NONE;
+
+	const FVector Delta = End - Start;
+	const FVector InvDelta
+	{
+		FMath::Abs(Delta.X) > UE_DOUBLE_SMALL_NUMBER ? 1.0 / Delta.X : 0.0,
+		FMath::Abs(Delta.Y) > UE_DOUBLE_SMALL_NUMBER ? 1.0 / Delta.Y : 0.0,
+		FMath::Abs(Delta.Z) > UE_DOUBLE_SMALL_NUMBER ? 1.0 / Delta.Z : 0.0
+	};
+	const FVector Inflation{SweepRadius};
+	const double HitRadiusSquared = FMath::Square(BoidRadius + SweepRadius);
+
+	int32 BestSlot = INDEX_NONE;
+	double BestT = 1.0;
+
+	TArray<int32, TInlineAllocator<64>> Stack;
+	Stack.Push(0);
+
+	while (!Stack.IsEmpty())
+	{
+		const FNode& Node = Nodes[Stack.Pop(false)];
+
+		double EnterT;
+		if (!FlockBVH::SegmentIntersectsBox(Start, Delta, InvDelta, Node.Min - Inflation, Node.Max + Inflation, BestT, EnterT)) continue;
+
+		if (Node.IsLeaf())
+		{
+			for (int32 SlotIndex = Node.FirstOrLeft; SlotIndex < Node.FirstOrLeft + Node.Count; ++SlotIndex)
+			{
+				// Slots only shrink under the owner's write lock, which rebuilds the tree right away, but a stale tree must never read past the end.
+				const int32 Slot = Slots[SlotIndex];
+				if (Slot >= Locations.Num() || !IsSlotAlive(Slot)) continue;
+
+				double HitT;
+				if (FlockBVH::SegmentIntersectsSphere(Start, Delta, Locations[Slot], HitRadiusSquared, HitT) && HitT <= BestT)
+				{
+					BestT = HitT;
+					BestSlot = Slot;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first so BestT shrinks as early as possible.
+		const FNode& Left = Nodes[Node.FirstOrLeft];
+		const FNode& Right = Nodes[Node.FirstOrLeft + 1];
+		const bool bLeftFirst = (((Left.Min + Left.Max) * 0.5 - Start) | Delta) <= (((Right.Min + Right.Max) * 0.5 - Start) | Delta);
+
+		Stack.Push(bLeftFirst ? Node.FirstOrLeft + 1 : Node.FirstOrLeft);
+		Stack.Push(bLeftFirst ? Node.FirstOrLeft : Node.FirstOrLeft + 1);
+	}
+
+	OutTime = BestT;
+	return BestSlot;
+}
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Binary bounding volume hierarchy over boid slots, each boid treated as a sphere of a fixed radius.
+ * Meant to be built once and refit every tick. Refitting keeps the topology so it's cheap, but the boxes loosen as boids drift apart,
+ * which GetQualityRatio tracks so the owner can decide when to pay for a rebuild.
+ */
+class BOIDSIMULATION_API FFlockBVH
+{
+public:
+	// Builds over the slots for which IsSlotAlive returns true.
+	void Build(const TConstArrayView<FVector>& Locations, const TFunctionRef<bool(int32)>& IsSlotAlive, const double InBoidRadius);
+
+	// Recomputes every box from the current locations without touching the topology.
+	void Refit(const TConstArrayView<FVector>& Locations);
+
+	// Current summed node surface area relative to the root, divided by the same ratio right after the last build. Grows as refits degrade.
+	UE_NODISCARD FORCEINLINE double GetQualityRatio() const
+	{
+		return BuildCost > 0.0 ? ComputeCost() / BuildCost : 1.0;
+	}
+
+	// Drops every node, so sweeps miss until the next build.
+	void Reset();
+
+	UE_NODISCARD FORCEINLINE bool IsEmpty() const
+	{
+		return Nodes.IsEmpty();
+	}
+
+	UE_NODISCARD FORCEINLINE int32 GetNumNodes() const
+	{
+		return Nodes.Num();
+	}
+
+	/**
+	 * Finds the first boid hit by a sphere of SweepRadius moving from Start to End (a line trace for SweepRadius == 0).
+	 * IsSlotAlive filters out slots that were despawned since the last build, slots past the end of Locations are skipped. Returns INDEX_NONE on a miss.
+	 */
+	UE_NODISCARD int32 Sweep(const FVector& Start, const FVector& End, const double SweepRadius, const TConstArrayView<FVector>& Locations, const TFunctionRef<bool(int32)>& IsSlotAlive, double& OutTime) const;
+
+private:
+	struct FNode
+	{
+		FVector Min;
+		FVector Max;
+
+		// Leaves: first index into Slots and Count > 0. Internal nodes: index of the left child (right child follows it) and Count == 0.
+		int32 FirstOrLeft;
+		int32 Count;
+
+		UE_NODISCARD FORCEINLINE bool IsLeaf() const
+		{
+			return Count > 0;
+		}
+	};
+
+	UE_NODISCARD double ComputeCost() const;
+
+	static constexpr int32 MaxLeafSize = 4;
+
+	// Children are always stored after their parent, so walking backwards visits children before parents.
+	TArray<FNode> Nodes;
+	TArray<int32> Slots;
+	TArray<int32> LeafNodes;
+
+	double BoidRadius = 0.0;
+	double BuildCost = 0.0;
+};
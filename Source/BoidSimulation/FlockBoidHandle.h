@@ -0,0 +1,34 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Stable reference to a single boid of an AFlock. Survives slot recycling and compaction.
+ * Ids are never reused, so a handle to a despawned boid stays invalid rather than aliasing a newer boid.
+ */
+struct FFlockBoidHandle
+{
+	uint64 Id = 0;
+
+	UE_NODISCARD FORCEINLINE bool IsValid() const
+	{
+		return Id != 0;
+	}
+
+	UE_NODISCARD FORCEINLINE bool operator==(const FFlockBoidHandle& Other) const
+	{
+		return Id == Other.Id;
+	}
+
+	UE_NODISCARD FORCEINLINE bool operator!=(const FFlockBoidHandle& Other) const
+	{
+		return Id != Other.Id;
+	}
+
+	UE_NODISCARD friend FORCEINLINE uint32 GetTypeHash(const FFlockBoidHandle& Handle)
+	{
+		return ::GetTypeHash(Handle.Id);
+	}
+};
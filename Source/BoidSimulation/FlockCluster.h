@@ -0,0 +1,20 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockBoidHandle.h"
+
+/**
+ * A sub-flock: boids connected through chains of neighbors no further apart than the flock's ClusterLinkRadius.
+ * Everything is relative to the flock.
+ */
+struct FFlockCluster
+{
+	// The oldest boid in the cluster. Stays the same across updates for as long as that boid stays in it, so it doubles as an identity.
+	FFlockBoidHandle Anchor;
+
+	FVector Centroid = FVector::ZeroVector;
+	FBox Bounds{ForceInit};
+	int32 NumBoids = 0;
+};
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockInstanceEncoding.h"
+
+/**
+ * 12 byte snapshot of a boid for the neighbor loop, against 48 for the full precision location and direction.
+ * The location is 16 bit fixed point relative to the center of the grid cell the boid is in, so it can only be decoded by something that knows
+ * that cell, which the grid walks always do. The direction is octahedral with 16 bits per component.
+ *
+ * Precision, checked by the BoidSimulation.CompactState automation tests:
+ * - Locations within one cell size of their cell's center are off by at most CellSize / 65534 per axis, 0.0033 units in total for 125 unit cells.
+ *   Boids further out, which only happens past the edge of the grid, are clamped to that range.
+ * - Directions are off by at most 6.5e-5 radians.
+ */
+struct FFlockCompactBoid
+{
+	int16 Offset[3];
+	int16 Padding;
+	uint32 Direction;
+};
+static_assert(sizeof(FFlockCompactBoid) == 12);
+
+namespace FlockCompactState
+{
+UE_NODISCARD FORCEINLINE int16 QuantizeSNorm16(const double Value)
+{
+	return static_cast<int16>(FMath::RoundToInt32(FMath::Clamp(Value, -1.0, 1.0) * MAX_int16));
+}
+
+// Octahedral, 16 bits per component.
+UE_NODISCARD FORCEINLINE uint32 EncodeDirection(const FVector& Direction)
+{
+	const FVector2f Octahedral = FlockInstanceEncoding::EncodeDirection(Direction);
+	return static_cast<uint16>(QuantizeSNorm16(Octahedral.X)) | static_cast<uint32>(static_cast<uint16>(QuantizeSNorm16(Octahedral.Y))) << 16;
+}
+
+UE_NODISCARD FORCEINLINE FVector DecodeDirection(const uint32 Encoded)
+{
+	const FVector2f Octahedral
+	{
+		static_cast<int16>(Encoded & 0xffff) / static_cast<float>(MAX_int16),
+		static_cast<int16>(Encoded >> 16) / static_cast<float>(MAX_int16)
+	};
+	return FlockInstanceEncoding::DecodeDirection(Octahedral);
+}
+
+UE_NODISCARD FORCEINLINE FFlockCompactBoid Encode(const FVector& Location, const FVector& CellCenter, const FVector& Direction, const double CellSize)
+{
+	const FVector Offset = (Location - CellCenter) / CellSize;
+
+	FFlockCompactBoid Boid;
+	Boid.Offset[0] = QuantizeSNorm16(Offset.X);
+	Boid.Offset[1] = QuantizeSNorm16(Offset.Y);
+	Boid.Offset[2] = QuantizeSNorm16(Offset.Z);
+	Boid.Padding = 0;
+	Boid.Direction = EncodeDirection(Direction);
+	return Boid;
+}
+
+UE_NODISCARD FORCEINLINE FVector DecodeLocation(const FFlockCompactBoid& Boid, const FVector& CellCenter, const double CellSize)
+{
+	const double Scale = CellSize / MAX_int16;
+	return CellCenter + FVector{Boid.Offset[0] * Scale, Boid.Offset[1] * Scale, Boid.Offset[2] * Scale};
+}
+
+UE_NODISCARD FORCEINLINE FVector DecodeDirection(const FFlockCompactBoid& Boid)
+{
+	return DecodeDirection(Boid.Direction);
+}
+}
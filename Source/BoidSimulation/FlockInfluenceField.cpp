@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockInfluenceField.h"
+#include "BoidSimulation.h"
+#include "Async/ParallelFor.h"
+
+DECLARE_CYCLE_STAT(TEXT("Splat Influences"), STAT_SplatInfluences, STATGROUP_BoidSimulation);
+
+void FFlockInfluenceField::Build(const TConstArrayView<FFlockInfluence>& Influences, const double InHalfExtent, const int32 InResolution)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SplatInfluences);
+
+	check(InResolution >= 2);
+
+	Resolution = InResolution;
+	HalfExtent = InHalfExtent;
+	VoxelSize = (HalfExtent * 2.0) / Resolution;
+	InvVoxelSize = 1.0 / VoxelSize;
+
+	Voxels.SetNumUninitialized(FMath::Cube(Resolution));
+
+	// Voxel range of each influence, found once rather than per slice. Unbounded ones cover everything.
+	TArray<FIntVector, TInlineAllocator<64>> Mins;
+	TArray<FIntVector, TInlineAllocator<64>> Maxs;
+	Mins.SetNumUninitialized(Influences.Num());
+	Maxs.SetNumUninitialized(Influences.Num());
+	for (int32 i = 0; i < Influences.Num(); ++i)
+	{
+		const FFlockInfluence& Influence = Influences[i];
+		if (Influence.Radius <= 0.f)
+		{
+			Mins[i] = FIntVector{0};
+			Maxs[i] = FIntVector{Resolution - 1};
+			continue;
+		}
+
+		const auto ToVoxel = [this](const double Value) -> int32
+		{
+			return FMath::Clamp(FMath::FloorToInt32((Value + HalfExtent) * InvVoxelSize), 0, Resolution - 1);
+		};
+		Mins[i] = FIntVector{ToVoxel(Influence.Location.X - Influence.Radius), ToVoxel(Influence.Location.Y - Influence.Radius), ToVoxel(Influence.Location.Z - Influence.Radius)};
+		Maxs[i] = FIntVector{ToVoxel(Influence.Location.X + Influence.Radius), ToVoxel(Influence.Location.Y + Influence.Radius), ToVoxel(Influence.Location.Z + Influence.Radius)};
+	}
+
+	// Each slice is owned by a single worker, which clears it and then adds every influence reaching into it.
+	ParallelFor(Resolution, [&](const int32 Z) -> void
+	{
+		FVector3f* RESTRICT Slice = Voxels.GetData() + GetVoxelIndex(0, 0, Z);
+		FMemory::Memzero(Slice, sizeof(FVector3f) * Resolution * Resolution);
+
+		for (int32 i = 0; i < Influences.Num(); ++i)
+		{
+			if (Z < Mins[i].Z || Z > Maxs[i].Z) continue;
+
+			const FFlockInfluence& Influence = Influences[i];
+			const FVector WindDirection = Influence.Type == EFlockInfluenceType::Wind ? Influence.Direction.GetSafeNormal() : FVector::ZeroVector;
+
+			for (int32 Y = Mins[i].Y; Y <= Maxs[i].Y; ++Y)
+			{
+				for (int32 X = Mins[i].X; X <= Maxs[i].X; ++X)
+				{
+					const FVector ToInfluence = Influence.Location - GetVoxelCenter(X, Y, Z);
+					const double Dist = ToInfluence.Size();
+
+					double Weight = Influence.Strength;
+					if (Influence.Radius > 0.f)
+					{
+						if (Dist >= Influence.Radius) continue;
+						Weight *= 1.0 - Dist / Influence.Radius;
+					}
+
+					FVector Contribution;
+					switch (Influence.Type)
+					{
+					case EFlockInfluenceType::Attractor:
+						Contribution = Dist > UE_DOUBLE_SMALL_NUMBER ? ToInfluence * (Weight / Dist) : FVector::ZeroVector;
+						break;
+					case EFlockInfluenceType::Repulsor:
+						Contribution = Dist > UE_DOUBLE_SMALL_NUMBER ? ToInfluence * (-Weight / Dist) : FVector::ZeroVector;
+						break;
+					default:
+						Contribution = WindDirection * Weight;
+						break;
+					}
+
+					Slice[X + Y * Resolution] += FVector3f{Contribution};
+				}
+			}
+		}
+	});
+}
+
+void FFlockInfluenceField::Empty()
+{
+	Voxels.Empty();
+	Resolution = 0;
+}
@@ -0,0 +1,106 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockInfluenceField.generated.h"
+
+UENUM(BlueprintType)
+enum class EFlockInfluenceType : uint8
+{
+	// Steers towards Location.
+	Attractor,
+
+	// Steers away from Location.
+	Repulsor,
+
+	// Steers along Direction.
+	Wind,
+};
+
+/**
+ * Something boids steer towards, away from or along, relative to the flock. Its pull is added to a boid's heading, so a Strength of 1 is as strong as
+ * the boid's own steering, and falls off linearly to nothing at Radius.
+ */
+USTRUCT(BlueprintType)
+struct BOIDSIMULATION_API FFlockInfluence
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Influence")
+	EFlockInfluenceType Type = EFlockInfluenceType::Attractor;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Influence")
+	FVector Location = FVector::ZeroVector;
+
+	// Wind only. Normalized when splatted.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Influence", meta=(EditCondition="Type == EFlockInfluenceType::Wind"))
+	FVector Direction = FVector::ForwardVector;
+
+	// Zero reaches the whole flock with no falloff.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Influence", meta=(ClampMin=0))
+	float Radius = 500.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Influence", meta=(ClampMin=0))
+	float Strength = 1.f;
+};
+
+/**
+ * Coarse grid of steering vectors covering the flock's bounds, the sum of every influence sampled at each voxel's center.
+ * Building costs one pass over the voxels each influence reaches, split over Z slices so no two workers touch the same voxel.
+ * Sampling is a single trilinear lookup however many influences went into it.
+ */
+class BOIDSIMULATION_API FFlockInfluenceField
+{
+public:
+	// Covers the cube of half size HalfExtent around the flock's origin with Resolution voxels along each axis.
+	void Build(const TConstArrayView<FFlockInfluence>& Influences, const double HalfExtent, const int32 Resolution);
+
+	void Empty();
+
+	UE_NODISCARD FORCEINLINE bool IsEmpty() const
+	{
+		return Voxels.IsEmpty();
+	}
+
+	// Clamped to the outermost voxel centers, so anything outside the bounds sees the nearest edge of the field.
+	UE_NODISCARD FORCEINLINE FVector Sample(const FVector& Location) const
+	{
+		const FVector Coordinates = ((Location + FVector{HalfExtent}) * InvVoxelSize - FVector{0.5}).BoundToBox(FVector::ZeroVector, FVector{static_cast<double>(Resolution - 1)});
+
+		const FIntVector Min
+		{
+			FMath::Min(FMath::FloorToInt32(Coordinates.X), Resolution - 2),
+			FMath::Min(FMath::FloorToInt32(Coordinates.Y), Resolution - 2),
+			FMath::Min(FMath::FloorToInt32(Coordinates.Z), Resolution - 2)
+		};
+		const FVector3f Alpha{Coordinates - FVector{Min}};
+
+		const FVector3f* RESTRICT Base = Voxels.GetData() + GetVoxelIndex(Min.X, Min.Y, Min.Z);
+		const int32 StrideY = Resolution;
+		const int32 StrideZ = Resolution * Resolution;
+
+		const FVector3f Y0 = FMath::Lerp(FMath::Lerp(Base[0], Base[1], Alpha.X), FMath::Lerp(Base[StrideY], Base[StrideY + 1], Alpha.X), Alpha.Y);
+		const FVector3f Y1 = FMath::Lerp(FMath::Lerp(Base[StrideZ], Base[StrideZ + 1], Alpha.X), FMath::Lerp(Base[StrideZ + StrideY], Base[StrideZ + StrideY + 1], Alpha.X), Alpha.Y);
+		return FVector{FMath::Lerp(Y0, Y1, Alpha.Z)};
+	}
+
+private:
+	UE_NODISCARD FORCEINLINE int32 GetVoxelIndex(const int32 X, const int32 Y, const int32 Z) const
+	{
+		return X + (Y + Z * Resolution) * Resolution;
+	}
+
+	UE_NODISCARD FORCEINLINE FVector GetVoxelCenter(const int32 X, const int32 Y, const int32 Z) const
+	{
+		return FVector{X + 0.5, Y + 0.5, Z + 0.5} * VoxelSize - FVector{HalfExtent};
+	}
+
+	// Single precision to keep the whole field in cache. The vectors are small and get normalized into the heading anyway.
+	TArray<FVector3f> Voxels;
+
+	int32 Resolution = 0;
+	double HalfExtent = 0.0;
+	double VoxelSize = 0.0;
+	double InvVoxelSize = 0.0;
+};
@@ -0,0 +1,84 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockInstanceEncoding.generated.h"
+
+// How a boid's orientation reaches its instance.
+UENUM()
+enum class EFlockInstanceEncoding : uint8
+{
+	// Full instance transform, rotation included. Works with any material.
+	Transform,
+
+	// Translation only, with the direction octahedrally encoded and packed into a single per-instance custom data float.
+	// Requires a material that rotates vertices itself, see Shaders/FlockInstanceEncoding.ush.
+	Direction,
+};
+
+namespace FlockInstanceEncoding
+{
+inline constexpr int32 NumCustomDataFloats = 1;
+
+// Bits per octahedral component in the packed float. Both together make an integer below 2^24, which a float holds exactly,
+// so the value survives the trip to the GPU whatever it does to NaNs and denormals, unlike bits cast into a float.
+inline constexpr int32 PackedComponentBits = 12;
+inline constexpr float PackedComponentScale = 1 << PackedComponentBits;
+inline constexpr float PackedComponentMax = PackedComponentScale - 1.f;
+
+UE_NODISCARD FORCEINLINE float SignNotZero(const float Value)
+{
+	return Value >= 0.f ? 1.f : -1.f;
+}
+
+/**
+ * Octahedral encoding of a normalized direction into [-1, 1]^2. Decoding in float precision lands within ~1e-6 radians of the original,
+ * well under anything visible on a boid. Must stay in sync with FlockDecodeDirection in Shaders/FlockInstanceEncoding.ush.
+ */
+UE_NODISCARD FORCEINLINE FVector2f EncodeDirection(const FVector& Direction)
+{
+	const FVector3f D{Direction};
+	const float InvL1Norm = 1.f / (FMath::Abs(D.X) + FMath::Abs(D.Y) + FMath::Abs(D.Z));
+
+	FVector2f Encoded{D.X * InvL1Norm, D.Y * InvL1Norm};
+	if (D.Z < 0.f)
+	{
+		// Fold the lower hemisphere over the diagonals.
+		Encoded = FVector2f{(1.f - FMath::Abs(Encoded.Y)) * SignNotZero(Encoded.X), (1.f - FMath::Abs(Encoded.X)) * SignNotZero(Encoded.Y)};
+	}
+
+	return Encoded;
+}
+
+// CPU mirror of the shader side decode. Also decodes every octahedral direction on the CPU, as FlockCompactState::DecodeDirection, so it's on the steering hot path.
+UE_NODISCARD FORCEINLINE FVector DecodeDirection(const FVector2f& Encoded)
+{
+	FVector3f D{Encoded.X, Encoded.Y, 1.f - FMath::Abs(Encoded.X) - FMath::Abs(Encoded.Y)};
+	const float T = FMath::Max(-D.Z, 0.f);
+	D.X += D.X >= 0.f ? -T : T;
+	D.Y += D.Y >= 0.f ? -T : T;
+
+	return FVector{D.GetUnsafeNormal()};
+}
+
+/**
+ * EncodeDirection quantized to PackedComponentBits per component, as written into the instance's custom data.
+ * Unpacks within 1.1e-3 radians (0.06 degrees) of the original. Must stay in sync with FlockUnpackDirection in Shaders/FlockInstanceEncoding.ush.
+ */
+UE_NODISCARD FORCEINLINE float PackDirection(const FVector& Direction)
+{
+	const FVector2f Encoded = EncodeDirection(Direction);
+	const uint32 X = FMath::Clamp(FMath::RoundToInt32((Encoded.X * 0.5f + 0.5f) * PackedComponentMax), 0, static_cast<int32>(PackedComponentMax));
+	const uint32 Y = FMath::Clamp(FMath::RoundToInt32((Encoded.Y * 0.5f + 0.5f) * PackedComponentMax), 0, static_cast<int32>(PackedComponentMax));
+	return static_cast<float>(X | Y << PackedComponentBits);
+}
+
+// CPU mirror of the shader side unpack, step for step. Only used to validate the encoding.
+UE_NODISCARD FORCEINLINE FVector UnpackDirection(const float Packed)
+{
+	const float Y = FMath::FloorToFloat(Packed / PackedComponentScale);
+	const float X = Packed - Y * PackedComponentScale;
+	return DecodeDirection(FVector2f{X * (2.f / PackedComponentMax) - 1.f, Y * (2.f / PackedComponentMax) - 1.f});
+}
+}
@@ -0,0 +1,491 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockLockstep.h"
+#include "BoidSimulation.h"
+#include "Flock.h"
+#include "FlockWarmState.h"
+#include "Async/ParallelFor.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "Misc/Crc.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Lockstep Steps"), STAT_LockstepSteps, STATGROUP_BoidSimulation);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Lockstep Resyncs"), STAT_LockstepResyncs, STATGROUP_BoidSimulation);
+
+UFlockLockstepComponent::UFlockLockstepComponent()
+{
+	SetIsReplicatedByDefault(true);
+}
+
+void UFlockLockstepComponent::ServerRequestResync_Implementation(AFlock* Flock, const TArray<int32>& Regions)
+{
+	if (Flock)
+	{
+		Flock->Lockstep.QueueResync(*Flock, *this, Regions);
+	}
+}
+
+void UFlockLockstepComponent::ClientReceiveResync_Implementation(AFlock* Flock, uint32 Tick, const TArray<int32>& Regions, const TArray<FFlockLockstepBoid>& Boids, bool bFinal)
+{
+	if (Flock)
+	{
+		Flock->Lockstep.ReceiveResync(Tick, Regions, Boids, bFinal);
+	}
+}
+
+int32 FFlockLockstep::GetRegionCells(const AFlock& Flock)
+{
+	// Replicated arrays are capped at 2048 elements, which MaxRegionsPerAxis cubed checksums stay under.
+	return FMath::Max3(Flock.LockstepRegionCells, 1, FMath::DivideAndRoundUp(Flock.GetCellDimensions(), MaxRegionsPerAxis));
+}
+
+int32 FFlockLockstep::GetNumRegions(const AFlock& Flock)
+{
+	return FMath::Cube(FMath::DivideAndRoundUp(Flock.GetCellDimensions(), GetRegionCells(Flock)));
+}
+
+int32 FFlockLockstep::GetRegion(const AFlock& Flock, const FVector& Location)
+{
+	const int32 RegionCells = GetRegionCells(Flock);
+	const int32 RegionsPerAxis = FMath::DivideAndRoundUp(Flock.GetCellDimensions(), RegionCells);
+	const FIntVector Region = Flock.GetCellCoordinates(Location) / RegionCells;
+	return Region.X + (Region.Y + Region.Z * RegionsPerAxis) * RegionsPerAxis;
+}
+
+void FFlockLockstep::GatherRegion(const AFlock& Flock, const int32 Region, TArray<int32>& OutSlots)
+{
+	const int32 CellDimensions = Flock.GetCellDimensions();
+	const int32 RegionCells = GetRegionCells(Flock);
+	const int32 RegionsPerAxis = FMath::DivideAndRoundUp(CellDimensions, RegionCells);
+
+	const FIntVector First = FIntVector{Region % RegionsPerAxis, (Region / RegionsPerAxis) % RegionsPerAxis, Region / (RegionsPerAxis * RegionsPerAxis)} * RegionCells;
+	const FIntVector Last{FMath::Min(First.X + RegionCells, CellDimensions), FMath::Min(First.Y + RegionCells, CellDimensions), FMath::Min(First.Z + RegionCells, CellDimensions)};
+
+	OutSlots.Reset();
+	for (int32 Z = First.Z; Z < Last.Z; ++Z)
+	{
+		for (int32 Y = First.Y; Y < Last.Y; ++Y)
+		{
+			for (int32 X = First.X; X < Last.X; ++X)
+			{
+				OutSlots.Append(Flock.BoidCells[Flock.GetCellIndex(FIntVector{X, Y, Z})]);
+			}
+		}
+	}
+
+	OutSlots.Sort([&Flock](const int32 A, const int32 B) -> bool
+	{
+		return Flock.SlotHandles[A].Id < Flock.SlotHandles[B].Id;
+	});
+}
+
+void FFlockLockstep::ComputeChecksums(const AFlock& Flock, TArray<uint32>& OutChecksums)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Lockstep Checksums"), STAT_LockstepChecksums, STATGROUP_BoidSimulation);
+
+	OutChecksums.SetNumUninitialized(GetNumRegions(Flock));
+	ParallelFor(OutChecksums.Num(), [&](const int32 Region) -> void
+	{
+		TArray<int32> Slots;
+		GatherRegion(Flock, Region, Slots);
+
+		// Every bit of the state, so the slightest drift shows.
+		uint32 Crc = 0;
+		for (const int32 Slot : Slots)
+		{
+			Crc = FCrc::MemCrc32(&Flock.SlotHandles[Slot].Id, sizeof(uint64), Crc);
+			Crc = FCrc::MemCrc32(&Flock.BoidLocations[Slot], sizeof(FVector), Crc);
+			Crc = FCrc::MemCrc32(&Flock.BoidDirections[Slot], sizeof(FVector), Crc);
+			Crc = FCrc::MemCrc32(&Flock.BoidSpecies[Slot], sizeof(uint8), Crc);
+		}
+		OutChecksums[Region] = Crc;
+	}, EParallelForFlags::Unbalanced);
+}
+
+void FFlockLockstep::Start(AFlock& Flock)
+{
+	if (Flock.WarmState && Flock.WarmState->IsCompatible(Flock))
+	{
+		Flock.LoadWarmState(*Flock.WarmState);
+	}
+	else
+	{
+		Flock.ScatterBoids(FRandomStream{Flock.LockstepState.Seed});
+	}
+
+	CurrentTick = 0;
+	TimeAccumulator = 0.f;
+	bStarted = true;
+}
+
+void FFlockLockstep::Step(AFlock& Flock)
+{
+	Flock.SortBoidCells();
+
+	if (CurrentTick % static_cast<uint32>(FMath::Max(Flock.LockstepChecksumInterval, 1)) == 0)
+	{
+		if (Flock.IsLockstepClient())
+		{
+			FChecksums& Entry = ChecksumHistory.AddDefaulted_GetRef();
+			Entry.Tick = CurrentTick;
+			ComputeChecksums(Flock, Entry.Checksums);
+
+			// Enough for the server's to arrive through a few hundred milliseconds of latency.
+			if (ChecksumHistory.Num() > 8)
+			{
+				ChecksumHistory.RemoveAt(0);
+			}
+		}
+		else
+		{
+			ComputeChecksums(Flock, Flock.LockstepState.Checksums);
+			Flock.LockstepState.ChecksumTick = CurrentTick;
+		}
+	}
+
+	Flock.SimulateAsynchronously(FMath::Max(Flock.LockstepTimeStep, 0.001f));
+	++CurrentTick;
+}
+
+void FFlockLockstep::Tick(AFlock& Flock, const float DeltaTime)
+{
+	FFlockLockstepState& State = Flock.LockstepState;
+	const float TimeStep = FMath::Max(Flock.LockstepTimeStep, 0.001f);
+	const int32 MaxSteps = FMath::Max(Flock.MaxLockstepStepsPerFrame, 1);
+	int32 NumSteps = 0;
+
+	if (!Flock.IsLockstepClient())
+	{
+		// Only not yet set when the flock started from a loaded state rather than the seed, see AFlock::BeginPlay. Clients then join through a full resync.
+		bStarted = true;
+
+		for (TimeAccumulator += DeltaTime; TimeAccumulator >= TimeStep && NumSteps < MaxSteps; ++NumSteps)
+		{
+			TimeAccumulator -= TimeStep;
+			Step(Flock);
+		}
+
+		// Dropped rather than carried over, a server that can't keep up would only fall further behind.
+		TimeAccumulator = FMath::Min(TimeAccumulator, TimeStep);
+
+		const AFlock::FParameterBlock& Parameters = *Flock.Parameters;
+		State.bStarted = true;
+		State.Tick = CurrentTick;
+		State.SteeringMath = Parameters.SteeringMath == EFlockSteeringMath::Fast ? 1 : 0;
+		State.bCompactState = Parameters.bCompactState;
+		State.bFarField = Parameters.bFarField;
+		State.ParametersHash = Parameters.Hash;
+
+		SendResyncs(Flock);
+		SET_DWORD_STAT(STAT_LockstepSteps, NumSteps);
+		return;
+	}
+
+	if (!State.bStarted) return;
+
+	if (!bWarnedParameters && Flock.Parameters->Hash != State.ParametersHash)
+	{
+		UE_LOG(LogBoidSimulation, Warning, TEXT("%s: Resolved different parameters than the server, so it will keep diverging and resyncing. Check both run the same build and assets."), *Flock.GetName());
+		bWarnedParameters = true;
+	}
+
+	// Paused while a resync is on its way, then stepped to exactly where the server took it.
+	if (bResyncRequested)
+	{
+		if (!IncomingResync.bComplete) return;
+
+		if (bStarted && CurrentTick > IncomingResync.Tick)
+		{
+			// Too late to apply. If the regions still differ the next checksums ask again.
+			IncomingResync = FResync{};
+			bResyncRequested = false;
+		}
+		else
+		{
+			if (bStarted)
+			{
+				for (; CurrentTick < IncomingResync.Tick && NumSteps < MaxSteps; ++NumSteps)
+				{
+					Step(Flock);
+				}
+
+				if (CurrentTick < IncomingResync.Tick)
+				{
+					SET_DWORD_STAT(STAT_LockstepSteps, NumSteps);
+					return;
+				}
+			}
+
+			ApplyResync(Flock);
+		}
+	}
+
+	if (!bStarted)
+	{
+		if (bResyncRequested) return;
+
+		if (State.Seed == 0 || State.Tick > static_cast<uint32>(FMath::Max(Flock.MaxLockstepCatchUpSteps, 0)))
+		{
+			RequestResync(Flock, TArray<int32>{INDEX_NONE});
+			return;
+		}
+
+		FRWScopeLock Lock{Flock.SimulationLock, SLT_Write};
+		Start(Flock);
+	}
+
+	// Paced like the server while close to it, as fast as allowed while catching up.
+	TimeAccumulator += DeltaTime;
+	for (; CurrentTick < State.Tick && NumSteps < MaxSteps; ++NumSteps)
+	{
+		const bool bCatchingUp = State.Tick - CurrentTick > static_cast<uint32>(MaxSteps);
+		if (!bCatchingUp && TimeAccumulator < TimeStep) break;
+
+		TimeAccumulator = FMath::Max(TimeAccumulator - TimeStep, 0.f);
+		Step(Flock);
+	}
+	TimeAccumulator = FMath::Min(TimeAccumulator, TimeStep);
+
+	CompareChecksums(Flock);
+	SET_DWORD_STAT(STAT_LockstepSteps, NumSteps);
+}
+
+void FFlockLockstep::CompareChecksums(AFlock& Flock)
+{
+	const FFlockLockstepState& State = Flock.LockstepState;
+
+	// A checksum of step N is taken while stepping from N, so it's only comparable once past it.
+	const uint32 ChecksumTick = State.ChecksumTick;
+	if (bResyncRequested || ChecksumTick == LastComparedChecksumTick || CurrentTick <= ChecksumTick) return;
+
+	LastComparedChecksumTick = ChecksumTick;
+
+	const FChecksums* Local = ChecksumHistory.FindByPredicate([ChecksumTick](const FChecksums& Entry) -> bool
+	{
+		return Entry.Tick == ChecksumTick;
+	});
+	if (!Local || Local->Checksums.Num() != State.Checksums.Num()) return;
+
+	TArray<int32> DivergedRegions;
+	for (int32 Region = 0; Region < Local->Checksums.Num(); ++Region)
+	{
+		if (Local->Checksums[Region] != State.Checksums[Region])
+		{
+			DivergedRegions.Add(Region);
+		}
+	}
+
+	if (!DivergedRegions.IsEmpty())
+	{
+		UE_LOG(LogBoidSimulation, Verbose, TEXT("%s: %i regions diverged by step %u, resyncing them."), *Flock.GetName(), DivergedRegions.Num(), ChecksumTick);
+		RequestResync(Flock, DivergedRegions);
+	}
+}
+
+void FFlockLockstep::RequestResync(AFlock& Flock, const TArray<int32>& Regions)
+{
+	// The player controller may not have replicated yet, in which case this is simply retried.
+	const APlayerController* PlayerController = Flock.GetWorld()->GetFirstPlayerController();
+	if (!PlayerController) return;
+
+	UFlockLockstepComponent* Component = PlayerController->FindComponentByClass<UFlockLockstepComponent>();
+	if (!Component)
+	{
+		UE_CLOG(!bWarnedComponent, LogBoidSimulation, Warning, TEXT("%s: %s has no UFlockLockstepComponent, so lockstep can't resync."), *Flock.GetName(), *PlayerController->GetName());
+		bWarnedComponent = true;
+		return;
+	}
+
+	IncomingResync = FResync{};
+	bResyncRequested = true;
+	Component->ServerRequestResync(&Flock, Regions);
+
+	INC_DWORD_STAT(STAT_LockstepResyncs);
+}
+
+void FFlockLockstep::QueueResync(const AFlock& Flock, UFlockLockstepComponent& Requester, const TArray<int32>& Regions)
+{
+	if (Flock.ReplicationMode != EFlockReplicationMode::Lockstep || !Flock.HasAuthority() || !bStarted) return;
+
+	// Sent by a client, so checked rather than trusted.
+	const int32 NumRegions = GetNumRegions(Flock);
+	const bool bEverything = Regions.Num() == 1 && Regions[0] == INDEX_NONE;
+	if (!bEverything && (Regions.IsEmpty() || Regions.Num() > NumRegions || Regions.ContainsByPredicate([NumRegions](const int32 Region) -> bool { return Region < 0 || Region >= NumRegions; }))) return;
+
+	// Supersedes whatever this client asked for before.
+	OutgoingResyncs.RemoveAll([&Requester](const FResync& Resync) -> bool
+	{
+		return Resync.Requester == &Requester;
+	});
+
+	TArray<int32> Slots;
+	if (bEverything)
+	{
+		Slots.Reserve(Flock.GetNumBoids());
+		for (int32 Slot = 0; Slot < Flock.GetNumSlots(); ++Slot)
+		{
+			if (Flock.IsSlotAlive(Slot))
+			{
+				Slots.Add(Slot);
+			}
+		}
+	}
+	else
+	{
+		TBitArray<> bGathered{false, NumRegions};
+		TArray<int32> RegionSlots;
+		for (const int32 Region : Regions)
+		{
+			if (bGathered[Region]) continue;
+			bGathered[Region] = true;
+
+			GatherRegion(Flock, Region, RegionSlots);
+			Slots.Append(RegionSlots);
+		}
+	}
+
+	// Captured now rather than as chunks go out, so the whole resync is of a single step.
+	FResync& Resync = OutgoingResyncs.AddDefaulted_GetRef();
+	Resync.Requester = &Requester;
+	Resync.Tick = CurrentTick;
+	Resync.Regions = Regions;
+	Resync.Boids.SetNum(Slots.Num());
+	for (int32 i = 0; i < Slots.Num(); ++i)
+	{
+		FFlockLockstepBoid& Boid = Resync.Boids[i];
+		Boid.Id = Flock.SlotHandles[Slots[i]].Id;
+		Boid.Location = Flock.BoidLocations[Slots[i]];
+		Boid.Direction = Flock.BoidDirections[Slots[i]];
+		Boid.Species = Flock.BoidSpecies[Slots[i]];
+	}
+}
+
+void FFlockLockstep::SendResyncs(AFlock& Flock)
+{
+	static const TArray<int32> NoRegions;
+
+	int32 ChunkBudget = FMath::Max(Flock.LockstepResyncChunksPerFrame, 1);
+	for (int32 i = 0; i < OutgoingResyncs.Num() && ChunkBudget > 0;)
+	{
+		FResync& Resync = OutgoingResyncs[i];
+		UFlockLockstepComponent* Requester = Resync.Requester.Get();
+		if (!Requester)
+		{
+			OutgoingResyncs.RemoveAt(i);
+			continue;
+		}
+
+		for (; ChunkBudget > 0 && !Resync.bComplete; --ChunkBudget)
+		{
+			const int32 NumBoids = FMath::Min(ResyncChunkSize, Resync.Boids.Num() - Resync.NumSent);
+			const bool bFirst = Resync.NumSent == 0;
+			Resync.bComplete = Resync.NumSent + NumBoids == Resync.Boids.Num();
+
+			Requester->ClientReceiveResync(&Flock, Resync.Tick, bFirst ? Resync.Regions : NoRegions, TArray<FFlockLockstepBoid>{Resync.Boids.GetData() + Resync.NumSent, NumBoids}, Resync.bComplete);
+			Resync.NumSent += NumBoids;
+		}
+
+		if (Resync.bComplete)
+		{
+			OutgoingResyncs.RemoveAt(i);
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+void FFlockLockstep::ReceiveResync(const uint32 Tick, const TArray<int32>& Regions, const TArray<FFlockLockstepBoid>& Boids, const bool bFinal)
+{
+	if (!bResyncRequested || IncomingResync.bComplete) return;
+
+	// Only first chunks carry regions. Anything before one is the tail of a resync this flock no longer waits for.
+	if (IncomingResync.Regions.IsEmpty())
+	{
+		if (Regions.IsEmpty()) return;
+
+		IncomingResync.Tick = Tick;
+		IncomingResync.Regions = Regions;
+	}
+	else if (Tick != IncomingResync.Tick)
+	{
+		return;
+	}
+
+	IncomingResync.Boids.Append(Boids);
+	IncomingResync.bComplete = bFinal;
+}
+
+void FFlockLockstep::ApplyResync(AFlock& Flock)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Apply Lockstep Resync"), STAT_ApplyLockstepResync, STATGROUP_BoidSimulation);
+
+	const FResync Resync = MoveTemp(IncomingResync);
+	IncomingResync = FResync{};
+	bResyncRequested = false;
+
+	FRWScopeLock Lock{Flock.SimulationLock, SLT_Write};
+
+	const int32 NumRegions = GetNumRegions(Flock);
+	const bool bEverything = Resync.Regions.Num() == 1 && Resync.Regions[0] == INDEX_NONE;
+	TBitArray<> bResynced{bEverything, NumRegions};
+	for (const int32 Region : Resync.Regions)
+	{
+		if (Region >= 0 && Region < NumRegions)
+		{
+			bResynced[Region] = true;
+		}
+	}
+
+	TSet<uint64> ResyncedIds;
+	ResyncedIds.Reserve(Resync.Boids.Num());
+	for (const FFlockLockstepBoid& Boid : Resync.Boids)
+	{
+		ResyncedIds.Add(Boid.Id);
+	}
+
+	// Whatever the server doesn't have in those regions, despawned there or moved on to a region that'll resync on its own if it differs.
+	TArray<FFlockBoidHandle> Removed;
+	for (int32 Slot = 0; Slot < Flock.GetNumSlots(); ++Slot)
+	{
+		if (Flock.IsSlotAlive(Slot) && bResynced[GetRegion(Flock, Flock.BoidLocations[Slot])] && !ResyncedIds.Contains(Flock.SlotHandles[Slot].Id))
+		{
+			Removed.Add(Flock.SlotHandles[Slot]);
+		}
+	}
+	Flock.RemoveBoids(Removed);
+
+	TArray<AFlock::FSpawnRequest> Added;
+	TArray<int32> AddedBoids;
+	for (int32 i = 0; i < Resync.Boids.Num(); ++i)
+	{
+		const FFlockLockstepBoid& Boid = Resync.Boids[i];
+		const uint8 BoidSpeciesIndex = Boid.Species < Flock.GetNumSpecies() ? Boid.Species : 0;
+		if (const int32* Slot = Flock.HandleToSlot.Find(FFlockBoidHandle{Boid.Id}))
+		{
+			Flock.RelocateBoidCell(*Slot, Flock.BoidLocations[*Slot], Boid.Location);
+			Flock.BoidLocations[*Slot] = Boid.Location;
+			Flock.BoidDirections[*Slot] = Boid.Direction;
+			Flock.BoidSpecies[*Slot] = BoidSpeciesIndex;
+		}
+		else
+		{
+			Added.Add(AFlock::FSpawnRequest{FFlockBoidHandle{Boid.Id}, FTransform{Boid.Direction.ToOrientationQuat(), Boid.Location}, BoidSpeciesIndex});
+			AddedBoids.Add(i);
+		}
+	}
+	Flock.AddBoids(Added);
+
+	// The round trip through a rotation isn't exact, and lockstep needs every bit.
+	for (int32 i = 0; i < Added.Num(); ++i)
+	{
+		Flock.BoidDirections[Flock.HandleToSlot.FindChecked(Added[i].Handle)] = Resync.Boids[AddedBoids[i]].Direction;
+	}
+
+	CurrentTick = Resync.Tick;
+	ChecksumHistory.Reset();
+	bStarted = true;
+	Flock.bBoidBVHNeedsRebuild = true;
+}
@@ -0,0 +1,183 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+#include "FlockLockstep.generated.h"
+
+class AFlock;
+
+UENUM()
+enum class EFlockReplicationMode : uint8
+{
+	// The server streams quantized boids to every client, see FFlockReplicatedState.
+	Snapshots,
+
+	/**
+	 * Clients run the same deterministic simulation as the server in fixed steps, from the same seed. Only the step count, the simulation
+	 * switches and per region checksums are replicated. Clients resync regions whose checksums stop matching.
+	 */
+	Lockstep,
+};
+
+// Everything the server replicates of a lockstep flock.
+USTRUCT()
+struct FFlockLockstepState
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	bool bStarted = false;
+
+	// Zero when the server didn't start from one, like after loading a saved state. Clients then need a full resync.
+	UPROPERTY()
+	int32 Seed = 0;
+
+	// Steps the server has taken.
+	UPROPERTY()
+	uint32 Tick = 0;
+
+	// The parts of the parameter block that otherwise come from each process' console variables.
+	UPROPERTY()
+	uint8 SteeringMath = 0;
+
+	UPROPERTY()
+	bool bCompactState = false;
+
+	UPROPERTY()
+	bool bFarField = false;
+
+	// Of the rest of the parameter block, which clients resolve from the same level and assets.
+	UPROPERTY()
+	uint32 ParametersHash = 0;
+
+	// One per region, of the state after ChecksumTick steps.
+	UPROPERTY()
+	uint32 ChecksumTick = 0;
+
+	UPROPERTY()
+	TArray<uint32> Checksums;
+};
+
+// A boid in full precision, as resyncs send it. Anything less would just diverge again.
+USTRUCT()
+struct FFlockLockstepBoid
+{
+	GENERATED_BODY()
+
+	uint64 Id = 0;
+	FVector Location = FVector::ZeroVector;
+	FVector Direction = FVector::ForwardVector;
+	uint8 Species = 0;
+
+	bool NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+	{
+		Ar << Id;
+		Ar << Location.X << Location.Y << Location.Z;
+		Ar << Direction.X << Direction.Y << Direction.Z;
+		Ar << Species;
+
+		bOutSuccess = !Ar.IsError();
+		return true;
+	}
+};
+
+template<>
+struct TStructOpsTypeTraits<FFlockLockstepBoid> : public TStructOpsTypeTraitsBase2<FFlockLockstepBoid>
+{
+	enum
+	{
+		WithNetSerializer = true,
+	};
+};
+
+/**
+ * A client's line to the server's lockstep flocks, which it can't call RPCs on directly since it doesn't own them.
+ * Add it to the player controller of any game with lockstep flocks. Without it clients can't resync and only ever start from the seed.
+ */
+UCLASS(ClassGroup=Boids, meta=(BlueprintSpawnableComponent))
+class BOIDSIMULATION_API UFlockLockstepComponent : public UActorComponent
+{
+	GENERATED_BODY()
+public:
+	UFlockLockstepComponent();
+
+	// Asks for the boids in Regions, or all of them for a single INDEX_NONE, as of the server's current step.
+	UFUNCTION(Server, Reliable)
+	void ServerRequestResync(AFlock* Flock, const TArray<int32>& Regions);
+
+	// One chunk of a resync. Only the first carries the regions, the last has bFinal set.
+	UFUNCTION(Client, Reliable)
+	void ClientReceiveResync(AFlock* Flock, uint32 Tick, const TArray<int32>& Regions, const TArray<FFlockLockstepBoid>& Boids, bool bFinal);
+};
+
+/**
+ * A flock's lockstep machinery, see EFlockReplicationMode::Lockstep: fixed steps, per region checksums of the state, and resyncs of the regions whose
+ * checksums stop matching. Works on the flock it's a member of, which AFlock::Tick hands it every frame, and only ever on the game thread.
+ */
+class FFlockLockstep
+{
+public:
+	// Starts from the warm state when there is a compatible one, otherwise scatters from the seed. Identical on every peer.
+	void Start(AFlock& Flock);
+
+	// Steps towards the server, or up to the present on the server, then checksums or resyncs.
+	void Tick(AFlock& Flock, const float DeltaTime);
+
+	// Server only, from a client's UFlockLockstepComponent. Captures the regions right away, as of the current step.
+	void QueueResync(const AFlock& Flock, UFlockLockstepComponent& Requester, const TArray<int32>& Regions);
+
+	// Client only. Applied once every chunk is in and the flock has stepped to the resync's step.
+	void ReceiveResync(const uint32 Tick, const TArray<int32>& Regions, const TArray<FFlockLockstepBoid>& Boids, const bool bFinal);
+
+private:
+	static constexpr int32 ResyncChunkSize = 512;
+	static constexpr int32 MaxRegionsPerAxis = 12;
+
+	UE_NODISCARD static int32 GetRegionCells(const AFlock& Flock);
+	UE_NODISCARD static int32 GetNumRegions(const AFlock& Flock);
+	UE_NODISCARD static int32 GetRegion(const AFlock& Flock, const FVector& Location);
+
+	// Live slots in the region, sorted by handle so every peer walks them in the same order.
+	static void GatherRegion(const AFlock& Flock, const int32 Region, TArray<int32>& OutSlots);
+	static void ComputeChecksums(const AFlock& Flock, TArray<uint32>& OutChecksums);
+
+	// One fixed step, from sorted cells.
+	void Step(AFlock& Flock);
+
+	void CompareChecksums(AFlock& Flock);
+	void RequestResync(AFlock& Flock, const TArray<int32>& Regions);
+	void ApplyResync(AFlock& Flock);
+	void SendResyncs(AFlock& Flock);
+
+	// Steps taken since the seed, or since the state a resync was taken at.
+	uint32 CurrentTick = 0;
+	float TimeAccumulator = 0.f;
+	bool bStarted = false;
+
+	// Client only. The last few checksums, until the server's for the same step arrive.
+	struct FChecksums
+	{
+		uint32 Tick;
+		TArray<uint32> Checksums;
+	};
+	TArray<FChecksums> ChecksumHistory;
+	uint32 LastComparedChecksumTick = 0;
+	bool bWarnedParameters = false;
+	bool bWarnedComponent = false;
+
+	// Every boid of some regions as of one step. Queued per requester on the server, assembled from chunks on the client.
+	struct FResync
+	{
+		TWeakObjectPtr<UFlockLockstepComponent> Requester;
+		uint32 Tick = 0;
+		TArray<int32> Regions;
+		TArray<FFlockLockstepBoid> Boids;
+		int32 NumSent = 0;
+		bool bComplete = false;
+	};
+	TArray<FResync> OutgoingResyncs;
+	FResync IncomingResync;
+	bool bResyncRequested = false;
+};
@@ -0,0 +1,115 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/ParallelFor.h"
+#include <atomic>
+
+/**
+ * Runs several dependent passes over [0, Num) inside a single ParallelFor rather than one fork/join per pass.
+ * [0, Num) is split into NumPartitions contiguous partitions and each participating thread claims a home partition it keeps across
+ * every phase, so the data it touched in one phase is still in its cache for the next. Phases are separated by spin-then-wait barriers.
+ *
+ * The barrier counts completed partitions rather than arrived threads: before waiting, a thread claims and runs any partition of the
+ * current phase nobody has started yet. So the region can't deadlock when fewer threads than partitions show up (e.g. workers busy with
+ * unrelated tasks), it just loses affinity for the partitions that had to be picked up by someone else.
+ */
+template<int32 NumPhases>
+class TFlockPhasedRegion
+{
+public:
+	// Body(Phase, Begin, End) is invoked exactly once per phase per partition [Begin, End), so the body can split its range as it likes.
+	// Every partition of phase P completes before any partition of phase P + 1 starts.
+	template<typename BodyType>
+	void Run(const int32 Num, const int32 NumPartitions, BodyType&& Body)
+	{
+		check(NumPartitions > 0);
+
+		for (int32 Phase = 0; Phase < NumPhases; ++Phase)
+		{
+			if (Claimed[Phase].Num() != NumPartitions)
+			{
+				Claimed[Phase].Empty(NumPartitions);
+				Claimed[Phase].SetNum(NumPartitions);
+			}
+			for (std::atomic<bool>& Flag : Claimed[Phase])
+			{
+				Flag.store(false, std::memory_order_relaxed);
+			}
+			Completed[Phase].Value.store(0, std::memory_order_relaxed);
+		}
+		NextHomePartition.store(0, std::memory_order_relaxed);
+
+		const auto RunPartition = [&](const int32 Phase, const int32 Partition) -> void
+		{
+			const int32 Begin = static_cast<int32>(static_cast<int64>(Num) * Partition / NumPartitions);
+			const int32 End = static_cast<int32>(static_cast<int64>(Num) * (Partition + 1) / NumPartitions);
+			Body(Phase, Begin, End);
+
+			if (Completed[Phase].Value.fetch_add(1, std::memory_order_acq_rel) + 1 == NumPartitions)
+			{
+				Completed[Phase].Value.notify_all();
+			}
+		};
+
+		const auto TryClaim = [&](const int32 Phase, const int32 Partition) -> bool
+		{
+			std::atomic<bool>& Flag = Claimed[Phase][Partition];
+			return !Flag.load(std::memory_order_relaxed) && !Flag.exchange(true, std::memory_order_acquire);
+		};
+
+		::ParallelFor(TEXT("BoidSimulation.PhasedRegion"), NumPartitions, 1, [&](int32) -> void
+		{
+			const int32 HomePartition = NextHomePartition.fetch_add(1, std::memory_order_relaxed);
+
+			for (int32 Phase = 0; Phase < NumPhases; ++Phase)
+			{
+				if (HomePartition < NumPartitions && TryClaim(Phase, HomePartition))
+				{
+					RunPartition(Phase, HomePartition);
+				}
+
+				// Pick up stragglers nobody has started, starting with our neighbors'.
+				for (int32 Offset = 1; Offset < NumPartitions; ++Offset)
+				{
+					const int32 Partition = (FMath::Max(HomePartition, 0) + Offset) % NumPartitions;
+					if (TryClaim(Phase, Partition))
+					{
+						RunPartition(Phase, Partition);
+					}
+				}
+
+				WaitForPhase(Phase, NumPartitions);
+			}
+		}, EParallelForFlags::Unbalanced);
+	}
+
+private:
+	void WaitForPhase(const int32 Phase, const int32 NumPartitions)
+	{
+		std::atomic<int32>& Value = Completed[Phase].Value;
+
+		for (int32 Spin = 0; Spin < NumSpins; ++Spin)
+		{
+			if (Value.load(std::memory_order_acquire) == NumPartitions) return;
+			FPlatformProcess::YieldCycles(64);
+		}
+
+		for (int32 Current; (Current = Value.load(std::memory_order_acquire)) != NumPartitions;)
+		{
+			Value.wait(Current, std::memory_order_acquire);
+		}
+	}
+
+	static constexpr int32 NumSpins = 256;
+
+	struct alignas(PLATFORM_CACHE_LINE_SIZE) FCounter
+	{
+		std::atomic<int32> Value{0};
+	};
+
+	FCounter Completed[NumPhases];
+	TArray<std::atomic<bool>> Claimed[NumPhases];
+	alignas(PLATFORM_CACHE_LINE_SIZE) std::atomic<int32> NextHomePartition{0};
+};
@@ -0,0 +1,287 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockRenderComponent.h"
+#include "BoidSimulation.h"
+#include "DynamicMeshBuilder.h"
+#include "LocalVertexFactory.h"
+#include "MaterialDomain.h"
+#include "PrimitiveSceneProxy.h"
+#include "SceneInterface.h"
+#include "SceneManagement.h"
+#include "Async/ParallelFor.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialRenderProxy.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Render Frames Latched"), STAT_RenderFramesLatched, STATGROUP_BoidSimulation);
+
+namespace FlockRenderComponent
+{
+// A dart: the tip, then three base corners around the tail.
+constexpr int32 NumVerticesPerBoid = 4;
+constexpr int32 NumIndicesPerBoid = 12;
+
+constexpr uint32 DartIndices[NumIndicesPerBoid] = {0, 1, 2, 0, 2, 3, 0, 3, 1, 1, 3, 2};
+
+// Base corners, in units of BoidSize along (Forward, Right, Up).
+const FVector3f DartCorners[NumVerticesPerBoid] =
+{
+	FVector3f{0.5f, 0.f, 0.f},
+	FVector3f{-0.5f, 0.f, 0.2f},
+	FVector3f{-0.5f, 0.17f, -0.1f},
+	FVector3f{-0.5f, -0.17f, -0.1f},
+};
+}
+
+class FFlockSceneProxy final : public FPrimitiveSceneProxy
+{
+public:
+	explicit FFlockSceneProxy(const UFlockRenderComponent* Component)
+		: FPrimitiveSceneProxy(Component)
+		, Frames(Component->GetFrames())
+		, Material(Component->GetMaterial(0))
+		, MaterialRelevance(Material->GetRelevance_Concurrent(GetScene().GetFeatureLevel()))
+		, BoidSize(Component->BoidSize)
+		, VertexFactory(GetScene().GetFeatureLevel(), "FFlockSceneProxy")
+	{
+		bVerifyUsedMaterials = false;
+	}
+
+	virtual ~FFlockSceneProxy() override
+	{
+		VertexBuffers.PositionVertexBuffer.ReleaseResource();
+		VertexBuffers.StaticMeshVertexBuffer.ReleaseResource();
+		VertexBuffers.ColorVertexBuffer.ReleaseResource();
+		IndexBuffer.ReleaseResource();
+		VertexFactory.ReleaseResource();
+	}
+
+	virtual SIZE_T GetTypeHash() const override
+	{
+		static size_t UniquePointer;
+		return reinterpret_cast<size_t>(&UniquePointer);
+	}
+
+	virtual uint32 GetMemoryFootprint() const override
+	{
+		return sizeof(*this) + GetAllocatedSize() + IndexBuffer.Indices.GetAllocatedSize();
+	}
+
+	virtual FPrimitiveViewRelevance GetViewRelevance(const FSceneView* View) const override
+	{
+		FPrimitiveViewRelevance Result;
+		Result.bDrawRelevance = IsShown(View);
+		Result.bShadowRelevance = IsShadowCast(View);
+		Result.bDynamicRelevance = true;
+		Result.bRenderInMainPass = ShouldRenderInMainPass();
+		MaterialRelevance.SetPrimitiveViewRelevance(Result);
+		return Result;
+	}
+
+	virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, const uint32 VisibilityMap, FMeshElementCollector& Collector) const override
+	{
+		DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Flock Dynamic Mesh Elements"), STAT_FlockDynamicMeshElements, STATGROUP_BoidSimulation);
+
+		using namespace FlockRenderComponent;
+
+		// Latch at most once per view family, so every view and pass of a frame draws the same simulation frame.
+		if (ViewFamily.FrameNumber != LatchedFrameNumber)
+		{
+			LatchedFrameNumber = ViewFamily.FrameNumber;
+			if (Frames->Latch())
+			{
+				UpdateBuffers(Frames->GetReadBuffer());
+				INC_DWORD_STAT(STAT_RenderFramesLatched);
+			}
+		}
+
+		if (NumBoids == 0) return;
+
+		// The buffers are shared by every view, each only gets a mesh batch pointing at them.
+		const FMaterialRenderProxy* MaterialProxy = Material->GetRenderProxy();
+		for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+		{
+			if ((VisibilityMap & (1 << ViewIndex)) == 0) continue;
+
+			FMeshBatch& Mesh = Collector.AllocateMesh();
+			Mesh.VertexFactory = &VertexFactory;
+			Mesh.MaterialRenderProxy = MaterialProxy;
+			Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
+			Mesh.Type = PT_TriangleList;
+			Mesh.DepthPriorityGroup = SDPG_World;
+			Mesh.bCanApplyViewModeOverrides = false;
+
+			FMeshBatchElement& Element = Mesh.Elements[0];
+			Element.IndexBuffer = &IndexBuffer;
+			Element.PrimitiveUniformBuffer = GetUniformBuffer();
+			Element.FirstIndex = 0;
+			Element.NumPrimitives = NumBoids * NumIndicesPerBoid / 3;
+			Element.MinVertexIndex = 0;
+			Element.MaxVertexIndex = NumBoids * NumVerticesPerBoid - 1;
+
+			Collector.AddMesh(ViewIndex, Mesh);
+		}
+	}
+
+private:
+	// Positions and tangents of boid I's dart, relative to the component.
+	template<typename FunctorType>
+	void ForEachDartVertex(const FFlockRenderFrame& Frame, const int32 i, FunctorType&& Functor) const
+	{
+		using namespace FlockRenderComponent;
+
+		const FVector3f& Forward = Frame.Directions[i];
+
+		// Empty slots collapse to a point, which rasterizes to nothing.
+		const float Size = Forward.IsZero() ? 0.f : BoidSize;
+
+		const FVector3f Right = FMath::Abs(Forward.Z) < 0.999f ? (FVector3f::UpVector ^ Forward).GetSafeNormal() : FVector3f::RightVector;
+		const FVector3f Up = Forward ^ Right;
+
+		for (int32 j = 0; j < NumVerticesPerBoid; ++j)
+		{
+			const FVector3f Offset = (Forward * DartCorners[j].X + Right * DartCorners[j].Y + Up * DartCorners[j].Z) * Size;
+			Functor(i * NumVerticesPerBoid + j, Frame.Locations[i] + Offset, Right, Offset.GetSafeNormal());
+		}
+	}
+
+	// Render thread only. The buffers only grow, a frame with fewer boids than they hold rewrites and draws a prefix of them.
+	void UpdateBuffers(const FFlockRenderFrame& Frame) const
+	{
+		using namespace FlockRenderComponent;
+
+		NumBoids = Frame.Locations.Num();
+		if (NumBoids == 0) return;
+
+		if (NumBoids > Capacity)
+		{
+			Resize(Frame);
+			return;
+		}
+
+		FPositionVertexBuffer& Positions = VertexBuffers.PositionVertexBuffer;
+		FStaticMeshVertexBuffer& Tangents = VertexBuffers.StaticMeshVertexBuffer;
+		ParallelFor(NumBoids, [&](const int32 i) -> void
+		{
+			ForEachDartVertex(Frame, i, [&](const int32 Vertex, const FVector3f& Position, const FVector3f& TangentX, const FVector3f& TangentZ) -> void
+			{
+				Positions.VertexPosition(Vertex) = Position;
+				Tangents.SetVertexTangents(Vertex, TangentX, TangentZ ^ TangentX, TangentZ);
+			});
+		});
+
+		// Texture coordinates and colors never change, so only positions and tangents are uploaded.
+		const int32 NumVertices = NumBoids * NumVerticesPerBoid;
+		const auto Upload = [NumVertices](FRHIBuffer* Buffer, const void* Data, const uint32 Stride) -> void
+		{
+			const uint32 Size = NumVertices * Stride;
+			void* Locked = RHILockBuffer(Buffer, 0, Size, RLM_WriteOnly);
+			FMemory::Memcpy(Locked, Data, Size);
+			RHIUnlockBuffer(Buffer);
+		};
+
+		Upload(Positions.VertexBufferRHI, Positions.GetVertexData(), Positions.GetStride());
+		Upload(Tangents.TangentsVertexBuffer.VertexBufferRHI, Tangents.GetTangentData(), Tangents.GetTangentSize() / Tangents.GetNumVertices());
+	}
+
+	// Render thread only. Recreates every buffer for the frame's boid count, which becomes the new capacity.
+	void Resize(const FFlockRenderFrame& Frame) const
+	{
+		using namespace FlockRenderComponent;
+
+		TArray<FDynamicMeshVertex> Vertices;
+		Vertices.SetNumUninitialized(NumBoids * NumVerticesPerBoid);
+		ParallelFor(NumBoids, [&](const int32 i) -> void
+		{
+			ForEachDartVertex(Frame, i, [&](const int32 Vertex, const FVector3f& Position, const FVector3f& TangentX, const FVector3f& TangentZ) -> void
+			{
+				Vertices[Vertex] = FDynamicMeshVertex{Position, TangentX, TangentZ, FVector2f{static_cast<float>(Vertex % NumVerticesPerBoid != 0), 0.f}, FColor::White};
+			});
+		});
+
+		// Runs its initialization inline, being on the render thread already.
+		VertexBuffers.InitFromDynamicVertex(&VertexFactory, Vertices);
+
+		IndexBuffer.Indices.SetNumUninitialized(NumBoids * NumIndicesPerBoid);
+		for (int32 i = 0; i < NumBoids; ++i)
+		{
+			for (int32 j = 0; j < NumIndicesPerBoid; ++j)
+			{
+				IndexBuffer.Indices[i * NumIndicesPerBoid + j] = i * NumVerticesPerBoid + DartIndices[j];
+			}
+		}
+
+		if (IndexBuffer.IsInitialized())
+		{
+			BeginUpdateResourceRHI(&IndexBuffer);
+		}
+		else
+		{
+			BeginInitResource(&IndexBuffer);
+		}
+
+		Capacity = NumBoids;
+	}
+
+	TSharedRef<FFlockRenderFrames, ESPMode::ThreadSafe> Frames;
+
+	UMaterialInterface* Material;
+	FMaterialRelevance MaterialRelevance;
+	float BoidSize;
+
+	// Render thread only. Geometry of the latched frame, kept on the GPU across frames and only rewritten when a newer one was published.
+	mutable uint32 LatchedFrameNumber = TNumericLimits<uint32>::Max();
+	mutable int32 NumBoids = 0;
+	mutable int32 Capacity = 0;
+	mutable FStaticMeshVertexBuffers VertexBuffers;
+	mutable FDynamicMeshIndexBuffer32 IndexBuffer;
+	mutable FLocalVertexFactory VertexFactory;
+};
+
+UFlockRenderComponent::UFlockRenderComponent(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	PrimaryComponentTick.bCanEverTick = false;
+	SetCollisionProfileName(UCollisionProfile::NoCollision_ProfileName);
+	SetCanEverAffectNavigation(false);
+	CastShadow = true;
+	bUseAsOccluder = false;
+}
+
+void UFlockRenderComponent::PublishFrame(const FBox& InLocalBounds)
+{
+	Frames->Publish();
+
+	// Bounds go through the cheap transform update, never a render state recreation.
+	if (!InLocalBounds.Equals(LocalBounds))
+	{
+		LocalBounds = InLocalBounds;
+		UpdateBounds();
+		MarkRenderTransformDirty();
+	}
+}
+
+FPrimitiveSceneProxy* UFlockRenderComponent::CreateSceneProxy()
+{
+	return new FFlockSceneProxy(this);
+}
+
+FBoxSphereBounds UFlockRenderComponent::CalcBounds(const FTransform& LocalToWorld) const
+{
+	return LocalBounds.IsValid ? FBoxSphereBounds{LocalBounds.TransformBy(LocalToWorld)} : FBoxSphereBounds{LocalToWorld.GetLocation(), FVector::ZeroVector, 0.0};
+}
+
+int32 UFlockRenderComponent::GetNumMaterials() const
+{
+	return 1;
+}
+
+UMaterialInterface* UFlockRenderComponent::GetMaterial(const int32 ElementIndex) const
+{
+	return Material ? Material.Get() : UMaterial::GetDefaultMaterial(MD_Surface);
+}
+
+void UFlockRenderComponent::GetUsedMaterials(TArray<UMaterialInterface*>& OutMaterials, const bool bGetDebugMaterials) const
+{
+	OutMaterials.Add(GetMaterial(0));
+}
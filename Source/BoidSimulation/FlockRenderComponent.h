@@ -0,0 +1,82 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/PrimitiveComponent.h"
+#include "FlockTripleBuffer.h"
+#include "FlockRenderComponent.generated.h"
+
+UENUM()
+enum class EFlockRenderer : uint8
+{
+	// One ISM instance per boid, updated on the game thread every tick.
+	InstancedStaticMesh,
+
+	// UFlockRenderComponent, fed straight from the simulation's worker threads.
+	FlockComponent,
+
+	// Nothing. The boids only exist in the simulation buffers, for gameplay queries and replication.
+	// Every flock falls back to this when the process can't render at all, e.g. a dedicated server or -nullrhi.
+	None,
+};
+
+// One published frame of the flock, relative to the component.
+struct FFlockRenderFrame
+{
+	TArray<FVector3f> Locations;
+
+	// Zero for slots that don't hold a boid.
+	TArray<FVector3f> Directions;
+};
+
+using FFlockRenderFrames = TFlockTripleBuffer<FFlockRenderFrame>;
+
+/**
+ * Draws a flock as one mesh of small darts, straight from the frames the simulation publishes.
+ * The game thread never copies or re-registers anything per tick: the simulation writes into the triple buffer's write side in parallel,
+ * publishes it, and the scene proxy latches the newest complete frame whenever the renderer asks for it, rewriting the vertex buffers it keeps
+ * on the GPU in place. Frames that were already drawn cost nothing to draw again. Simulation and rendering can run at different rates.
+ * Only bounds changes reach the render thread through the usual transform update.
+ */
+UCLASS(ClassGroup=Rendering, meta=(BlueprintSpawnableComponent))
+class BOIDSIMULATION_API UFlockRenderComponent : public UPrimitiveComponent
+{
+	GENERATED_BODY()
+public:
+	explicit UFlockRenderComponent(const FObjectInitializer& ObjectInitializer);
+
+	// Null uses the default surface material.
+	UPROPERTY(EditAnywhere, Category="Rendering")
+	TObjectPtr<UMaterialInterface> Material;
+
+	// Length of a boid's dart.
+	UPROPERTY(EditAnywhere, Category="Rendering", meta=(ClampMin=0))
+	float BoidSize = 20.f;
+
+	// Game thread only. The buffer to fill for the next PublishFrame.
+	UE_NODISCARD FORCEINLINE FFlockRenderFrame& GetWriteFrame()
+	{
+		return Frames->GetWriteBuffer();
+	}
+
+	// Game thread only. Hands the write frame to the render thread. Bounds are relative to the component and only pushed when they change.
+	void PublishFrame(const FBox& InLocalBounds);
+
+	UE_NODISCARD FORCEINLINE const TSharedRef<FFlockRenderFrames, ESPMode::ThreadSafe>& GetFrames() const
+	{
+		return Frames;
+	}
+
+	virtual FPrimitiveSceneProxy* CreateSceneProxy() override;
+	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
+	virtual int32 GetNumMaterials() const override;
+	virtual UMaterialInterface* GetMaterial(int32 ElementIndex) const override;
+	virtual void GetUsedMaterials(TArray<UMaterialInterface*>& OutMaterials, bool bGetDebugMaterials = false) const override;
+
+private:
+	// Shared with the scene proxy, which may outlive the component by a frame.
+	TSharedRef<FFlockRenderFrames, ESPMode::ThreadSafe> Frames = MakeShared<FFlockRenderFrames, ESPMode::ThreadSafe>();
+
+	FBox LocalBounds{ForceInit};
+};
@@ -0,0 +1,539 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockReplication.h"
+#include "BoidSimulation.h"
+#include "Flock.h"
+#include "FlockCompactState.h"
+#include "Engine/NetConnection.h"
+#include "Engine/PackageMapClient.h"
+#include "GameFramework/PlayerController.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Replicated Boids Sent"), STAT_ReplicatedBoidsSent, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Replicated Boids Pending"), STAT_ReplicatedBoidsPending, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Replicated Bytes Sent"), STAT_ReplicatedBytesSent, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Replicated Deltas Skipped"), STAT_ReplicatedDeltasSkipped, STATGROUP_BoidSimulation);
+
+namespace FlockReplication
+{
+// Locations are quantized over twice the bounds, see FFlockNetBoid.
+static constexpr double LocationRange = 2.0;
+
+FFlockNetBoid Quantize(const uint64 Id, const FVector& Location, const FVector& Direction, const uint8 Species, const double BoundsRadius)
+{
+	const FVector Normalized = Location / (BoundsRadius * LocationRange);
+
+	FFlockNetBoid Boid;
+	Boid.Id = Id;
+	Boid.Location[0] = FlockCompactState::QuantizeSNorm16(Normalized.X);
+	Boid.Location[1] = FlockCompactState::QuantizeSNorm16(Normalized.Y);
+	Boid.Location[2] = FlockCompactState::QuantizeSNorm16(Normalized.Z);
+	Boid.Species = Species;
+	Boid.Direction = FlockCompactState::EncodeDirection(Direction);
+	return Boid;
+}
+
+FVector DequantizeLocation(const FFlockNetBoid& Boid, const double BoundsRadius)
+{
+	const double Scale = BoundsRadius * LocationRange / MAX_int16;
+	return FVector{Boid.Location[0] * Scale, Boid.Location[1] * Scale, Boid.Location[2] * Scale};
+}
+
+UE_NODISCARD FORCEINLINE int32 GetPackedSize(const uint32 Value)
+{
+	return 1 + (Value >= (1u << 7)) + (Value >= (1u << 14)) + (Value >= (1u << 21)) + (Value >= (1u << 28));
+}
+
+FORCEINLINE void SerializePacked(FArchive& Ar, uint32 Value)
+{
+	Ar.SerializeIntPacked(Value);
+}
+
+UE_NODISCARD FORCEINLINE uint32 ReadPacked(FArchive& Ar)
+{
+	uint32 Value = 0;
+	Ar.SerializeIntPacked(Value);
+	return Value;
+}
+
+// Ids go out as gaps from the previous one, split in halves since ids are 64 bit.
+FORCEINLINE void SerializeIdGap(FArchive& Ar, const uint64 IdGap)
+{
+	SerializePacked(Ar, static_cast<uint32>(IdGap));
+	SerializePacked(Ar, static_cast<uint32>(IdGap >> 32));
+}
+
+UE_NODISCARD FORCEINLINE uint64 ReadIdGap(FArchive& Ar)
+{
+	const uint32 Low = ReadPacked(Ar);
+	const uint32 High = ReadPacked(Ar);
+	return static_cast<uint64>(High) << 32 | Low;
+}
+
+// Size of a boid sent in full on the wire, besides its id and the zero reference age in front of it.
+static constexpr int32 BoidBytes = 3 * sizeof(int16) + sizeof(uint8) + sizeof(uint32);
+
+// A difference is one packed value per location axis and direction component.
+static constexpr int32 NumDeltas = 5;
+
+// The least a sent boid can take on the wire: a two part id gap, its reference age and either a difference or the boid in full.
+static constexpr int32 MinSentBytes = 3 + NumDeltas;
+
+FORCEINLINE void GetComponents(const FFlockNetBoid& Boid, uint16 (&OutComponents)[NumDeltas])
+{
+	OutComponents[0] = static_cast<uint16>(Boid.Location[0]);
+	OutComponents[1] = static_cast<uint16>(Boid.Location[1]);
+	OutComponents[2] = static_cast<uint16>(Boid.Location[2]);
+	OutComponents[3] = static_cast<uint16>(Boid.Direction);
+	OutComponents[4] = static_cast<uint16>(Boid.Direction >> 16);
+}
+
+/**
+ * The difference between two values of a boid, zigzag encoded so that small steps either way pack into a byte. Differences wrap around at 16 bits,
+ * like the components themselves, so applying them with ApplyDeltas restores To exactly.
+ */
+FORCEINLINE void GetDeltas(const FFlockNetBoid& From, const FFlockNetBoid& To, uint32 (&OutDeltas)[NumDeltas])
+{
+	uint16 FromComponents[NumDeltas], ToComponents[NumDeltas];
+	GetComponents(From, FromComponents);
+	GetComponents(To, ToComponents);
+
+	for (int32 i = 0; i < NumDeltas; ++i)
+	{
+		const int32 Delta = static_cast<int16>(static_cast<uint16>(ToComponents[i] - FromComponents[i]));
+		OutDeltas[i] = static_cast<uint32>((Delta << 1) ^ (Delta >> 31)) & 0xffff;
+	}
+}
+
+UE_NODISCARD FORCEINLINE FFlockNetBoid ApplyDeltas(const FFlockNetBoid& From, const uint32 (&Deltas)[NumDeltas])
+{
+	uint16 Components[NumDeltas];
+	GetComponents(From, Components);
+
+	for (int32 i = 0; i < NumDeltas; ++i)
+	{
+		const uint16 Delta = static_cast<uint16>((Deltas[i] >> 1) ^ (0u - (Deltas[i] & 1)));
+		Components[i] = static_cast<uint16>(Components[i] + Delta);
+	}
+
+	FFlockNetBoid Boid = From;
+	Boid.Location[0] = static_cast<int16>(Components[0]);
+	Boid.Location[1] = static_cast<int16>(Components[1]);
+	Boid.Location[2] = static_cast<int16>(Components[2]);
+	Boid.Direction = Components[3] | static_cast<uint32>(Components[4]) << 16;
+	return Boid;
+}
+
+UE_NODISCARD FORCEINLINE int32 GetDeltasSize(const uint32 (&Deltas)[NumDeltas])
+{
+	int32 Size = 0;
+	for (const uint32 Delta : Deltas)
+	{
+		Size += GetPackedSize(Delta);
+	}
+	return Size;
+}
+
+/**
+ * What one connection is known to have. Replaced by a new state after every update sent to it, and rolled back to the previous one by the engine
+ * when that update's packet is lost, so the next delta is always against something the client actually received.
+ */
+class FBaseState : public INetDeltaBaseState
+{
+public:
+	// Sorted by id, each as it was last sent.
+	TArray<FFlockNetBoid> Boids;
+
+	// Per entry of Boids, UpdateIndex as of the update that last sent the boid.
+	TArray<uint32> LastSentUpdates;
+
+	uint32 UpdateIndex = 0;
+
+	// The last update index handed out on this connection. Shared by all of its states so that rollbacks don't hand the same index out twice.
+	TSharedPtr<uint32> LastUpdateIndex;
+
+	virtual bool IsStateEqual(INetDeltaBaseState* OtherState) override
+	{
+		const FBaseState* Other = static_cast<const FBaseState*>(OtherState);
+		if (Boids.Num() != Other->Boids.Num()) return false;
+
+		for (int32 i = 0; i < Boids.Num(); ++i)
+		{
+			if (Boids[i].Id != Other->Boids[i].Id || !Boids[i].HasSameMotion(Other->Boids[i])) return false;
+		}
+		return true;
+	}
+
+	virtual void CountBytes(FArchive& Ar) const override
+	{
+		Boids.CountBytes(Ar);
+		LastSentUpdates.CountBytes(Ar);
+	}
+};
+
+/**
+ * Applies an update to a connection's base: drops Removed and upserts Sent, keeping ids sorted. Both are ascending by id.
+ * OutSources maps each entry of OutBoids to the index in Base it came from, INDEX_NONE for boids that were just sent.
+ */
+void ApplyToBase(const TConstArrayView<FFlockNetBoid>& Base, const TConstArrayView<uint64>& Removed, const TConstArrayView<FFlockNetBoid>& Sent,
+	TArray<FFlockNetBoid>& OutBoids, TArray<int32>& OutSources)
+{
+	OutBoids.Reset(Base.Num() + Sent.Num());
+	OutSources.Reset(Base.Num() + Sent.Num());
+
+	int32 RemovedIndex = 0, SentIndex = 0;
+	for (int32 BaseIndex = 0; BaseIndex < Base.Num(); ++BaseIndex)
+	{
+		const uint64 Id = Base[BaseIndex].Id;
+		while (SentIndex < Sent.Num() && Sent[SentIndex].Id < Id)
+		{
+			OutBoids.Add(Sent[SentIndex++]);
+			OutSources.Add(INDEX_NONE);
+		}
+
+		if (SentIndex < Sent.Num() && Sent[SentIndex].Id == Id)
+		{
+			OutBoids.Add(Sent[SentIndex++]);
+			OutSources.Add(INDEX_NONE);
+			continue;
+		}
+
+		while (RemovedIndex < Removed.Num() && Removed[RemovedIndex] < Id)
+		{
+			++RemovedIndex;
+		}
+
+		if (RemovedIndex < Removed.Num() && Removed[RemovedIndex] == Id) continue;
+
+		OutBoids.Add(Base[BaseIndex]);
+		OutSources.Add(BaseIndex);
+	}
+
+	for (; SentIndex < Sent.Num(); ++SentIndex)
+	{
+		OutBoids.Add(Sent[SentIndex]);
+		OutSources.Add(INDEX_NONE);
+	}
+}
+}
+
+bool FFlockReplicatedState::NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+{
+	// Nothing in here references objects, so the engine's unmapped object and guid passes have nothing to do.
+	if (AFlock* Flock = Cast<AFlock>(DeltaParms.Object))
+	{
+		if (DeltaParms.Writer) return WriteDelta(*Flock, DeltaParms);
+		if (DeltaParms.Reader) return ReadDelta(*Flock, DeltaParms);
+	}
+	return false;
+}
+
+void FFlockReplicatedState::UpdateSnapshot(const AFlock& Flock)
+{
+	if (SnapshotFrame == GFrameCounter) return;
+	SnapshotFrame = GFrameCounter;
+
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Replication Snapshot"), STAT_ReplicationSnapshot, STATGROUP_BoidSimulation);
+
+	Snapshot.Reset(Flock.GetNumBoids());
+	for (int32 Slot = 0; Slot < Flock.GetNumSlots(); ++Slot)
+	{
+		if (!Flock.IsSlotAlive(Slot)) continue;
+
+		Snapshot.Add(FlockReplication::Quantize(Flock.SlotHandles[Slot].Id, Flock.BoidLocations[Slot], Flock.BoidDirections[Slot], Flock.BoidSpecies[Slot], Flock.BoundsRadius));
+	}
+
+	// Slots are allocated in no particular order, ids only ever grow. Sorted ids keep both ends' bases in the same order and the id deltas small.
+	Snapshot.Sort([](const FFlockNetBoid& A, const FFlockNetBoid& B) -> bool { return A.Id < B.Id; });
+}
+
+bool FFlockReplicatedState::WriteDelta(const AFlock& Flock, FNetDeltaSerializeInfo& DeltaParms)
+{
+	using namespace FlockReplication;
+
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Write Replication Delta"), STAT_WriteReplicationDelta, STATGROUP_BoidSimulation);
+
+	// Lockstep clients simulate the boids themselves, see FFlockLockstepState.
+	if (Flock.ReplicationMode == EFlockReplicationMode::Lockstep) return false;
+
+	UpdateSnapshot(Flock);
+
+	static const FBaseState EmptyState;
+	const FBaseState& Old = DeltaParms.OldState ? *static_cast<const FBaseState*>(DeltaParms.OldState) : EmptyState;
+	const TSharedRef<uint32> LastUpdateIndex = Old.LastUpdateIndex.IsValid() ? Old.LastUpdateIndex.ToSharedRef() : MakeShared<uint32>(0);
+	const uint32 UpdateIndex = *LastUpdateIndex + 1;
+
+	// Relevance falls off with distance from whatever this connection is looking through.
+	const UPackageMapClient* PackageMap = Cast<UPackageMapClient>(DeltaParms.Map);
+	const UNetConnection* Connection = PackageMap ? PackageMap->GetConnection() : nullptr;
+	const AActor* Viewer = Connection ? (Connection->ViewTarget ? Connection->ViewTarget.Get() : Connection->PlayerController.Get()) : nullptr;
+	const FVector ViewerLocation = Viewer ? Flock.GetActorTransform().InverseTransformPosition(Viewer->GetActorLocation()) : FVector::ZeroVector;
+	const double InvRelevanceDistance = Viewer && Flock.ReplicationRelevanceDistance > 0.f ? 1.0 / Flock.ReplicationRelevanceDistance : 0.0;
+
+	struct FCandidate
+	{
+		double Priority;
+		int32 SnapshotIndex;
+
+		// Into Old.Boids for boids sent as a difference from it, INDEX_NONE for boids sent in full.
+		int32 ReferenceIndex;
+
+		int32 EstimatedBytes;
+	};
+
+	// Both sides are sorted by id, so one merge finds everything that was removed, added or moved.
+	TArray<uint64> Removed;
+	TArray<FCandidate> Candidates;
+	uint64 PreviousId = 0;
+	for (int32 OldIndex = 0, SnapshotIndex = 0; OldIndex < Old.Boids.Num() || SnapshotIndex < Snapshot.Num();)
+	{
+		if (SnapshotIndex == Snapshot.Num() || (OldIndex < Old.Boids.Num() && Old.Boids[OldIndex].Id < Snapshot[SnapshotIndex].Id))
+		{
+			Removed.Add(Old.Boids[OldIndex++].Id);
+			continue;
+		}
+
+		const FFlockNetBoid& Boid = Snapshot[SnapshotIndex];
+		const double Relevance = 1.0 / (1.0 + FVector::Dist(ViewerLocation, DequantizeLocation(Boid, Flock.BoundsRadius)) * InvRelevanceDistance);
+
+		// Estimated against the previous boid in the snapshot rather than the previous one sent, which is usually the same few bytes.
+		const int32 IdBytes = GetPackedSize(static_cast<uint32>(Boid.Id - PreviousId)) + 1;
+		PreviousId = Boid.Id;
+
+		if (OldIndex == Old.Boids.Num() || Boid.Id < Old.Boids[OldIndex].Id)
+		{
+			// Never sent, as stale as a boid can get.
+			Candidates.Add(FCandidate{UpdateIndex * Relevance, SnapshotIndex, INDEX_NONE, IdBytes + 1 + BoidBytes});
+			++SnapshotIndex;
+			continue;
+		}
+
+		if (!Old.Boids[OldIndex].HasSameMotion(Boid))
+		{
+			const uint32 Age = UpdateIndex - Old.LastSentUpdates[OldIndex];
+
+			// A difference only if the client still keeps the value it's against, and if it's smaller than the boid in full.
+			int32 ReferenceIndex = INDEX_NONE;
+			int32 SentBytes = 1 + BoidBytes;
+			if (Age <= MaxReferenceAge)
+			{
+				uint32 Deltas[NumDeltas];
+				GetDeltas(Old.Boids[OldIndex], Boid, Deltas);
+
+				const int32 DeltaBytes = 1 + GetDeltasSize(Deltas);
+				if (DeltaBytes < SentBytes)
+				{
+					ReferenceIndex = OldIndex;
+					SentBytes = DeltaBytes;
+				}
+			}
+
+			Candidates.Add(FCandidate{Age * Relevance, SnapshotIndex, ReferenceIndex, IdBytes + SentBytes});
+		}
+		++OldIndex;
+		++SnapshotIndex;
+	}
+
+	if (Removed.IsEmpty() && Candidates.IsEmpty()) return false;
+
+	// Removals are cheap and always go out. The rest goes out by priority for as long as the budget lasts, and at least one boid always does.
+	const double UpdatesPerSecond = FMath::Max(Flock.NetUpdateFrequency, 1.f);
+	const int32 Budget = FMath::Max(FMath::FloorToInt32(Flock.ReplicationBytesPerSecond / UpdatesPerSecond), 1);
+
+	Candidates.Sort([](const FCandidate& A, const FCandidate& B) -> bool { return A.Priority > B.Priority; });
+
+	int32 Spent = 2 * Removed.Num();
+	int32 NumSelected = 0;
+	while (NumSelected < Candidates.Num() && (NumSelected == 0 || Spent + Candidates[NumSelected].EstimatedBytes <= Budget))
+	{
+		Spent += Candidates[NumSelected++].EstimatedBytes;
+	}
+
+	TArrayView<FCandidate> Selected{Candidates.GetData(), NumSelected};
+	Selected.Sort([](const FCandidate& A, const FCandidate& B) -> bool { return A.SnapshotIndex < B.SnapshotIndex; });
+
+	TArray<FFlockNetBoid> Sent;
+	Sent.Reserve(NumSelected);
+	for (const FCandidate& Candidate : Selected)
+	{
+		Sent.Add(Snapshot[Candidate.SnapshotIndex]);
+	}
+
+	FBitWriter& Writer = *DeltaParms.Writer;
+	const int64 StartBits = Writer.GetNumBits();
+
+	// Everything is keyed by id, and differences name the update they're against, so a client can tell which of them it can apply whichever
+	// of the earlier updates made it.
+	SerializePacked(Writer, UpdateIndex);
+
+	SerializePacked(Writer, Removed.Num());
+	PreviousId = 0;
+	for (const uint64 Id : Removed)
+	{
+		SerializeIdGap(Writer, Id - PreviousId);
+		PreviousId = Id;
+	}
+
+	SerializePacked(Writer, Sent.Num());
+	PreviousId = 0;
+	for (int32 i = 0; i < Sent.Num(); ++i)
+	{
+		FFlockNetBoid& Boid = Sent[i];
+		SerializeIdGap(Writer, Boid.Id - PreviousId);
+		PreviousId = Boid.Id;
+
+		// How many updates ago the value this is a difference from was sent, zero for boids sent in full.
+		const int32 ReferenceIndex = Selected[i].ReferenceIndex;
+		if (ReferenceIndex == INDEX_NONE)
+		{
+			SerializePacked(Writer, 0);
+			Writer << Boid.Species;
+			Writer << Boid.Location[0] << Boid.Location[1] << Boid.Location[2];
+			Writer << Boid.Direction;
+			continue;
+		}
+
+		SerializePacked(Writer, UpdateIndex - Old.LastSentUpdates[ReferenceIndex]);
+
+		uint32 Deltas[NumDeltas];
+		GetDeltas(Old.Boids[ReferenceIndex], Boid, Deltas);
+		for (const uint32 Delta : Deltas)
+		{
+			SerializePacked(Writer, Delta);
+		}
+	}
+
+	// The connection's new base, with every boid just sent stamped with this update.
+	*LastUpdateIndex = UpdateIndex;
+
+	TSharedPtr<FBaseState> NewState = MakeShared<FBaseState>();
+	NewState->UpdateIndex = UpdateIndex;
+	NewState->LastUpdateIndex = LastUpdateIndex;
+
+	TArray<int32> Sources;
+	ApplyToBase(Old.Boids, Removed, Sent, NewState->Boids, Sources);
+
+	NewState->LastSentUpdates.SetNumUninitialized(Sources.Num());
+	for (int32 i = 0; i < Sources.Num(); ++i)
+	{
+		NewState->LastSentUpdates[i] = Sources[i] == INDEX_NONE ? UpdateIndex : Old.LastSentUpdates[Sources[i]];
+	}
+
+	*DeltaParms.NewState = NewState;
+
+	INC_DWORD_STAT_BY(STAT_ReplicatedBoidsSent, NumSelected);
+	INC_DWORD_STAT_BY(STAT_ReplicatedBoidsPending, Candidates.Num() - NumSelected);
+	INC_DWORD_STAT_BY(STAT_ReplicatedBytesSent, (Writer.GetNumBits() - StartBits + 7) / 8);
+	return true;
+}
+
+bool FFlockReplicatedState::ReadDelta(AFlock& Flock, FNetDeltaSerializeInfo& DeltaParms)
+{
+	using namespace FlockReplication;
+
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Read Replication Delta"), STAT_ReadReplicationDelta, STATGROUP_BoidSimulation);
+
+	FBitReader& Reader = *DeltaParms.Reader;
+
+	const auto Fail = [&Flock, &Reader](const TCHAR* Reason) -> bool
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("%s: Discarding malformed replication update, %s."), *Flock.GetName(), Reason);
+		Reader.SetError();
+		return false;
+	};
+
+	// Indices only go down when the server starts over with this client, like after the channel was reopened, and the old ones then mean nothing.
+	const uint32 UpdateIndex = ReadPacked(Reader);
+	if (UpdateIndex <= LastReceivedUpdate)
+	{
+		ReceivedValues.Reset();
+	}
+	LastReceivedUpdate = UpdateIndex;
+
+	// Counts are checked against what's left to read in 64 bits, so garbage can neither overflow them nor make us allocate much.
+	const uint32 NumRemoved = ReadPacked(Reader);
+	if (static_cast<int64>(NumRemoved) * 2 * 8 > Reader.GetBitsLeft()) return Fail(TEXT("too many removed boids"));
+
+	TArray<FFlockBoidHandle> Removed;
+	Removed.SetNumUninitialized(NumRemoved);
+	uint64 PreviousId = 0;
+	for (FFlockBoidHandle& Handle : Removed)
+	{
+		Handle.Id = PreviousId + ReadIdGap(Reader);
+		PreviousId = Handle.Id;
+	}
+
+	const uint32 NumSent = ReadPacked(Reader);
+	if (static_cast<int64>(NumSent) * MinSentBytes * 8 > Reader.GetBitsLeft()) return Fail(TEXT("too many sent boids"));
+
+	TArray<FFlockNetBoid> Received;
+	Received.Reserve(NumSent);
+	PreviousId = 0;
+	int32 NumSkipped = 0;
+	for (uint32 i = 0; i < NumSent; ++i)
+	{
+		FFlockNetBoid Boid;
+		Boid.Id = PreviousId + ReadIdGap(Reader);
+		PreviousId = Boid.Id;
+
+		const uint32 Age = ReadPacked(Reader);
+		if (Age == 0)
+		{
+			Reader << Boid.Species;
+			Reader << Boid.Location[0] << Boid.Location[1] << Boid.Location[2];
+			Reader << Boid.Direction;
+			Received.Add(Boid);
+			continue;
+		}
+
+		uint32 Deltas[NumDeltas];
+		for (uint32& Delta : Deltas)
+		{
+			Delta = ReadPacked(Reader);
+		}
+
+		// Against a value from a lost packet, or a difference this client skipped itself. Either way the server resends it once it notices the loss.
+		const TArray<FReceivedValue, TInlineAllocator<2>>* Values = ReceivedValues.Find(Boid.Id);
+		const FReceivedValue* Reference = Values && Age <= UpdateIndex ? Values->FindByPredicate([ReferenceUpdate = UpdateIndex - Age](const FReceivedValue& Value) -> bool
+		{
+			return Value.UpdateIndex == ReferenceUpdate;
+		}) : nullptr;
+
+		if (!Reference)
+		{
+			++NumSkipped;
+			continue;
+		}
+
+		Received.Add(ApplyDeltas(Reference->Boid, Deltas));
+	}
+
+	if (Reader.IsError()) return Fail(TEXT("truncated"));
+
+	for (const FFlockBoidHandle& Handle : Removed)
+	{
+		ReceivedValues.Remove(Handle.Id);
+	}
+
+	TArray<AFlock::FReplicatedBoid> Sent;
+	Sent.Reserve(Received.Num());
+	for (const FFlockNetBoid& Boid : Received)
+	{
+		// Values too old to be referenced any more go as new ones come in. Boids that stop moving keep their last one, which is all they need.
+		TArray<FReceivedValue, TInlineAllocator<2>>& Values = ReceivedValues.FindOrAdd(Boid.Id);
+		int32 NumExpired = 0;
+		while (NumExpired < Values.Num() && Values[NumExpired].UpdateIndex + MaxReferenceAge < UpdateIndex)
+		{
+			++NumExpired;
+		}
+		Values.RemoveAt(0, NumExpired, false);
+		Values.Add(FReceivedValue{UpdateIndex, Boid});
+
+		Sent.Add(AFlock::FReplicatedBoid{FFlockBoidHandle{Boid.Id}, DequantizeLocation(Boid, Flock.BoundsRadius), FlockCompactState::DecodeDirection(Boid.Direction), Boid.Species});
+	}
+
+	INC_DWORD_STAT_BY(STAT_ReplicatedDeltasSkipped, NumSkipped);
+
+	Flock.ApplyReplicatedBoids(Removed, Sent);
+	return true;
+}
@@ -0,0 +1,93 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/NetSerialization.h"
+#include "FlockReplication.generated.h"
+
+class AFlock;
+
+/**
+ * A boid as it goes over the wire, 11 bytes plus its id as a gap from the previous one when sent in full. The location is 16 bit fixed point relative to the
+ * flock's origin over twice its bounds, since boids stray past them before they are steered back, so 2 * BoundsRadius / 32767 per axis: 0.06 units for a
+ * 1000 unit flock. Boids further out are clamped. The direction is octahedral, as in FlockCompactState.
+ */
+struct FFlockNetBoid
+{
+	uint64 Id;
+	int16 Location[3];
+	uint8 Species;
+	uint32 Direction;
+
+	UE_NODISCARD FORCEINLINE bool HasSameMotion(const FFlockNetBoid& Other) const
+	{
+		return Location[0] == Other.Location[0] && Location[1] == Other.Location[1] && Location[2] == Other.Location[2] && Direction == Other.Direction;
+	}
+};
+
+namespace FlockReplication
+{
+UE_NODISCARD FFlockNetBoid Quantize(const uint64 Id, const FVector& Location, const FVector& Direction, const uint8 Species, const double BoundsRadius);
+UE_NODISCARD FVector DequantizeLocation(const FFlockNetBoid& Boid, const double BoundsRadius);
+}
+
+/**
+ * Replicates every boid of a flock, one custom delta per connection rather than a property per boid.
+ *
+ * The server keeps, per connection, the quantized boids it has sent that connection and the update each was last sent in. The engine rolls
+ * that back to the base of a lost packet, dropping everything sent since, so it only ever holds values the client got or will be told about
+ * again. Each update only names boids that differ from it: the ids of removed boids, and new or moved boids. A moved boid goes out as the
+ * difference from the value it was last sent with, tagged with how many updates ago that was, as long as that is at most MaxReferenceAge
+ * updates and the difference is smaller than the boid in full. Anything else goes out in full. Which boids make it into an update is decided by
+ * priority, how many updates a boid has gone without times its relevance to the connection's view target, under AFlock::ReplicationBytesPerSecond.
+ * Unsent boids just wait for a later update, their staleness growing until they win.
+ *
+ * Clients keep every value they received in the last MaxReferenceAge updates, so they can resolve any difference the server sends. One against a
+ * value they never got can only follow a lost packet and is skipped. The engine then rolls the server back to before that packet, after which
+ * the boid is sent against a value the client has, or in full. Update numbers keep counting up through rollbacks, so a number always names the same
+ * values. Clients keep simulating their copy of the flock between updates and snap each boid back to the server's whenever it's received,
+ * adding the ones they don't have yet and ignoring removals of ones they never got.
+ */
+USTRUCT()
+struct BOIDSIMULATION_API FFlockReplicatedState
+{
+	GENERATED_BODY()
+
+	friend struct FFlockTestAccess;
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms);
+
+private:
+	bool WriteDelta(const AFlock& Flock, FNetDeltaSerializeInfo& DeltaParms);
+	bool ReadDelta(AFlock& Flock, FNetDeltaSerializeInfo& DeltaParms);
+
+	void UpdateSnapshot(const AFlock& Flock);
+
+	// How many updates back a difference can reach.
+	static constexpr uint32 MaxReferenceAge = 8;
+
+	// Server only. Every live boid quantized, sorted by id. Shared by every connection, rebuilt at most once per frame.
+	TArray<FFlockNetBoid> Snapshot;
+	uint64 SnapshotFrame = MAX_uint64;
+
+	struct FReceivedValue
+	{
+		uint32 UpdateIndex;
+		FFlockNetBoid Boid;
+	};
+
+	// Client only. Per boid, the values received in the last MaxReferenceAge updates, oldest first.
+	TMap<uint64, TArray<FReceivedValue, TInlineAllocator<2>>> ReceivedValues;
+	uint32 LastReceivedUpdate = 0;
+};
+
+template<>
+struct TStructOpsTypeTraits<FFlockReplicatedState> : public TStructOpsTypeTraitsBase2<FFlockReplicatedState>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+		WithCopy = false,
+	};
+};
@@ -0,0 +1,484 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockShard.h"
+#include "BoidSimulation.h"
+#include "Flock.h"
+#include "FlockCompactState.h"
+#include "IPAddress.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "Misc/CommandLine.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Shard Halo Boids"), STAT_ShardHaloBoids, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Shard Migrants In"), STAT_ShardMigrantsIn, STATGROUP_BoidSimulation);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Shard Migrants Out"), STAT_ShardMigrantsOut, STATGROUP_BoidSimulation);
+
+namespace FlockShard
+{
+static TAutoConsoleVariable<float> StatusInterval{
+	TEXT("BoidSimulation.Shard.StatusInterval"),
+	5.f,
+	TEXT("Seconds between the status lines a flock shard logs, 0 for none. Scripts/RunFlockShards.sh checks the flock stayed whole from them.")};
+
+static constexpr uint32 Magic = 0x534B4C46;
+static constexpr uint8 Version = 1;
+
+// Frames are prefixed with their size. Anything claiming more than this is a broken stream rather than a big flock.
+static constexpr uint32 MaxFrameSize = 256 * 1024 * 1024;
+
+static constexpr double ConnectRetrySeconds = 1.0;
+
+static void SerializeBoids(FArchive& Ar, TArray<FFlockShardBoid>& Boids)
+{
+	int32 Num = Boids.Num();
+	Ar << Num;
+
+	if (Ar.IsLoading())
+	{
+		if (Num < 0 || Num > (Ar.TotalSize() - Ar.Tell()) / FFlockShardBoid::SerializedSize)
+		{
+			Ar.SetError();
+			return;
+		}
+		Boids.SetNumUninitialized(Num);
+	}
+
+	for (FFlockShardBoid& Boid : Boids)
+	{
+		Ar << Boid;
+	}
+}
+}
+
+void FFlockShardMessage::Serialize(FArchive& Ar)
+{
+	uint32 MessageMagic = FlockShard::Magic;
+	uint8 MessageVersion = FlockShard::Version;
+	Ar << MessageMagic << MessageVersion;
+
+	if (Ar.IsLoading() && (MessageMagic != FlockShard::Magic || MessageVersion != FlockShard::Version))
+	{
+		Ar.SetError();
+		return;
+	}
+
+	Ar << Step;
+	FlockShard::SerializeBoids(Ar, Migrants);
+	if (Ar.IsError()) return;
+	FlockShard::SerializeBoids(Ar, Halo);
+}
+
+FFlockShardLink::~FFlockShardLink()
+{
+	Disconnect();
+
+	if (ListenSocket)
+	{
+		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ListenSocket);
+		ListenSocket = nullptr;
+	}
+}
+
+void FFlockShardLink::Listen(const int32 Port)
+{
+	ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+
+	const TSharedRef<FInternetAddr> Address = SocketSubsystem->CreateInternetAddr(FNetworkProtocolTypes::IPv4);
+	Address->SetLoopbackAddress();
+	Address->SetPort(Port);
+
+	ListenSocket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("FlockShardListen"), FNetworkProtocolTypes::IPv4);
+	if (!ListenSocket) return;
+
+	ListenSocket->SetReuseAddr(true);
+	if (!ListenSocket->Bind(*Address) || !ListenSocket->Listen(1) || !ListenSocket->SetNonBlocking(true))
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("Flock shard couldn't listen on port %i."), Port);
+		SocketSubsystem->DestroySocket(ListenSocket);
+		ListenSocket = nullptr;
+	}
+}
+
+void FFlockShardLink::Connect(const int32 Port)
+{
+	ConnectPort = Port;
+	NextConnectTime = 0.0;
+}
+
+void FFlockShardLink::Update()
+{
+	ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+
+	bool bFreshConnection = false;
+	if (!Socket && ListenSocket)
+	{
+		bool bPending = false;
+		if (ListenSocket->HasPendingConnection(bPending) && bPending)
+		{
+			Socket = ListenSocket->Accept(TEXT("FlockShard"));
+			bFreshConnection = Socket != nullptr;
+		}
+	}
+	else if (!Socket && ConnectPort != 0 && FPlatformTime::Seconds() >= NextConnectTime)
+	{
+		NextConnectTime = FPlatformTime::Seconds() + FlockShard::ConnectRetrySeconds;
+
+		const TSharedRef<FInternetAddr> Address = SocketSubsystem->CreateInternetAddr(FNetworkProtocolTypes::IPv4);
+		Address->SetLoopbackAddress();
+		Address->SetPort(ConnectPort);
+
+		// Blocking, but a loopback connect either succeeds or is refused right away.
+		Socket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("FlockShard"), FNetworkProtocolTypes::IPv4);
+		if (Socket && !Socket->Connect(*Address))
+		{
+			SocketSubsystem->DestroySocket(Socket);
+			Socket = nullptr;
+		}
+		bFreshConnection = Socket != nullptr;
+	}
+
+	// Steps are small and frequent, so they go out as they come.
+	if (bFreshConnection)
+	{
+		Socket->SetNonBlocking(true);
+		Socket->SetNoDelay(true);
+		UE_LOG(LogBoidSimulation, Log, TEXT("Flock shard connected to its neighbor."));
+	}
+
+	if (!Socket) return;
+
+	if (Socket->GetConnectionState() == SCS_ConnectionError)
+	{
+		Disconnect();
+		return;
+	}
+
+	while (!Outgoing.IsEmpty())
+	{
+		int32 BytesSent = 0;
+		if (!Socket->Send(Outgoing.GetData(), Outgoing.Num(), BytesSent))
+		{
+			if (SocketSubsystem->GetLastErrorCode() != SE_EWOULDBLOCK)
+			{
+				Disconnect();
+				return;
+			}
+			break;
+		}
+		if (BytesSent <= 0) break;
+		Outgoing.RemoveAt(0, BytesSent, false);
+	}
+
+	for (uint32 PendingSize = 0; Socket->HasPendingData(PendingSize) && PendingSize > 0;)
+	{
+		const int32 Offset = Incoming.Num();
+		Incoming.AddUninitialized(FMath::Min<uint32>(PendingSize, 1024 * 1024));
+
+		int32 BytesRead = 0;
+		if (!Socket->Recv(Incoming.GetData() + Offset, Incoming.Num() - Offset, BytesRead))
+		{
+			Incoming.SetNum(Offset, false);
+			Disconnect();
+			return;
+		}
+		Incoming.SetNum(Offset + BytesRead, false);
+		if (BytesRead == 0) break;
+	}
+}
+
+void FFlockShardLink::Send(const TConstArrayView<uint8>& Frame)
+{
+	if (!Socket) return;
+
+	const uint32 Size = Frame.Num();
+	Outgoing.Append(reinterpret_cast<const uint8*>(&Size), sizeof(Size));
+	Outgoing.Append(Frame.GetData(), Frame.Num());
+}
+
+bool FFlockShardLink::Receive(TArray<uint8>& OutFrame)
+{
+	if (Incoming.Num() < static_cast<int32>(sizeof(uint32))) return false;
+
+	uint32 Size;
+	FMemory::Memcpy(&Size, Incoming.GetData(), sizeof(Size));
+	if (Size > FlockShard::MaxFrameSize)
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("Flock shard received a %u byte frame, dropping the connection."), Size);
+		Disconnect();
+		return false;
+	}
+
+	if (static_cast<uint32>(Incoming.Num()) - sizeof(uint32) < Size) return false;
+
+	OutFrame.SetNumUninitialized(Size);
+	FMemory::Memcpy(OutFrame.GetData(), Incoming.GetData() + sizeof(uint32), Size);
+	Incoming.RemoveAt(0, sizeof(uint32) + Size, false);
+	return true;
+}
+
+void FFlockShardLink::Disconnect()
+{
+	if (!Socket) return;
+
+	// Whatever migrants were in flight are lost with it.
+	UE_LOG(LogBoidSimulation, Error, TEXT("Flock shard lost its connection, %i bytes unsent."), Outgoing.Num());
+
+	Socket->Close();
+	ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+	Socket = nullptr;
+	Outgoing.Reset();
+	Incoming.Reset();
+}
+
+TOptional<FFlockShard::FConfig> FFlockShard::ParseCommandLine()
+{
+	FConfig Config;
+	if (!FParse::Value(FCommandLine::Get(), TEXT("FlockShard="), Config.Index) || !FParse::Value(FCommandLine::Get(), TEXT("FlockShards="), Config.Count)) return {};
+
+	FParse::Value(FCommandLine::Get(), TEXT("FlockShardPort="), Config.BasePort);
+	FParse::Value(FCommandLine::Get(), TEXT("FlockShardSeed="), Config.Seed);
+
+	if (Config.Count < 2 || Config.Index < 0 || Config.Index >= Config.Count)
+	{
+		UE_LOG(LogBoidSimulation, Error, TEXT("Ignoring -FlockShard=%i -FlockShards=%i, need 0 <= FlockShard < FlockShards and at least 2 shards."), Config.Index, Config.Count);
+		return {};
+	}
+
+	return Config;
+}
+
+FFlockShard::FFlockShard(const FConfig& InConfig, const int32 CellDimensions)
+	: Config{InConfig}
+	, FirstCell{static_cast<int32>(static_cast<int64>(CellDimensions) * InConfig.Index / InConfig.Count)}
+	, LastCell{static_cast<int32>(static_cast<int64>(CellDimensions) * (InConfig.Index + 1) / InConfig.Count)}
+{
+	// No need to extend the outermost slabs past the bounds, the grid already clamps whatever strays beyond them into its edge cells.
+	if (HasNeighbor(Lower))
+	{
+		Links[Lower].Listen(Config.BasePort + Config.Index);
+	}
+	if (HasNeighbor(Upper))
+	{
+		Links[Upper].Connect(Config.BasePort + Config.Index + 1);
+	}
+}
+
+void FFlockShard::Update()
+{
+	for (FFlockShardLink& Link : Links)
+	{
+		Link.Update();
+	}
+}
+
+void FFlockShard::Send(const int32 Side, FFlockShardMessage& Message)
+{
+	TArray<uint8> Frame;
+	Frame.Reserve(16 + (Message.Migrants.Num() + Message.Halo.Num()) * FFlockShardBoid::SerializedSize);
+
+	FMemoryWriter Writer{Frame};
+	Message.Serialize(Writer);
+	Links[Side].Send(Frame);
+}
+
+bool FFlockShard::Receive(const int32 Side, FFlockShardMessage& OutMessage)
+{
+	for (TArray<uint8> Frame; Links[Side].Receive(Frame);)
+	{
+		FMemoryReader Reader{Frame};
+		OutMessage.Serialize(Reader);
+		if (!Reader.IsError()) return true;
+
+		UE_LOG(LogBoidSimulation, Error, TEXT("Flock shard %i dropped a malformed %i byte message from its %s neighbor."), Config.Index, Frame.Num(), Side == Lower ? TEXT("lower") : TEXT("upper"));
+	}
+	return false;
+}
+
+void FFlockShard::ReceiveBoids(AFlock& Flock)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Receive Shard Boids"), STAT_ReceiveShardBoids, STATGROUP_BoidSimulation);
+
+	Update();
+
+	const auto ToSpawnRequest = [](const FFlockShardBoid& Boid) -> AFlock::FSpawnRequest
+	{
+		return AFlock::FSpawnRequest{FFlockBoidHandle{Boid.Id}, FTransform{FlockCompactState::DecodeDirection(Boid.Direction).ToOrientationQuat(), FVector{Boid.Location}}, Boid.Species};
+	};
+
+	FRWScopeLock Lock{Flock.SimulationLock, SLT_Write};
+
+	int32 NumReceivedMigrants = 0;
+	for (int32 Side = 0; Side < NumSides; ++Side)
+	{
+		for (FFlockShardMessage Message; Receive(Side, Message);)
+		{
+			// Each halo replaces the last one from that side, however far the old one drifted while being simulated here.
+			for (const FFlockBoidHandle& Handle : HaloHandles[Side])
+			{
+				Halo.Remove(Handle);
+			}
+			Flock.RemoveBoids(HaloHandles[Side]);
+			HaloHandles[Side].Reset();
+
+			TArray<AFlock::FSpawnRequest> Requests;
+			Requests.Reserve(Message.Migrants.Num() + Message.Halo.Num());
+			for (const FFlockShardBoid& Boid : Message.Migrants)
+			{
+				if (Flock.HandleToSlot.Contains(FFlockBoidHandle{Boid.Id})) continue;
+				Requests.Add(ToSpawnRequest(Boid));
+
+				// Held on to by the neighbor for a while, long enough to have drifted right across this slab.
+				if (!OwnsCell(Flock.GetCellCoordinates(FVector{Boid.Location}).X))
+				{
+					ScanAllMigrants();
+				}
+			}
+			NumReceivedMigrants += Requests.Num();
+
+			for (const FFlockShardBoid& Boid : Message.Halo)
+			{
+				const FFlockBoidHandle Handle{Boid.Id};
+				if (Flock.HandleToSlot.Contains(Handle)) continue;
+
+				Requests.Add(ToSpawnRequest(Boid));
+				HaloHandles[Side].Add(Handle);
+				Halo.Add(Handle);
+			}
+
+			Flock.AddBoids(Requests);
+		}
+	}
+
+	NumMigrantsIn += NumReceivedMigrants;
+	SET_DWORD_STAT(STAT_ShardMigrantsIn, NumReceivedMigrants);
+	SET_DWORD_STAT(STAT_ShardHaloBoids, Halo.Num());
+}
+
+int32 FFlockShard::GetHaloCells(const AFlock& Flock)
+{
+	double MaxSearchRadius = 0.0;
+	for (const AFlock::FBoidSpeciesRules& Rules : Flock.Parameters->SpeciesRules)
+	{
+		MaxSearchRadius = FMath::Max(MaxSearchRadius, Rules.SearchRadius);
+	}
+
+	// Columns line up with the border, so the neighbor's boids right at it see exactly this far in.
+	return FMath::Max(FMath::CeilToInt32(MaxSearchRadius / AFlock::CELL_SIZE), 1);
+}
+
+void FFlockShard::GatherBoids(const AFlock& Flock, const TSet<FFlockBoidHandle>& Halo, const int32 Side, const int32 FirstCell, const int32 LastCell, const int32 MigrantCells, const int32 HaloCells, FFlockShardMessage& OutMessage)
+{
+	const int32 CellDimensions = Flock.GetCellDimensions();
+
+	// Only the columns that can hold migrants or halo boids, the rest of the slab is never looked at.
+	const auto VisitColumns = [&](const int32 BeginX, const int32 EndX, const TFunctionRef<void(int32)>& Visit) -> void
+	{
+		for (int32 X = FMath::Max(BeginX, 0); X < FMath::Min(EndX, CellDimensions); ++X)
+		{
+			for (int32 Z = 0; Z < CellDimensions; ++Z)
+			{
+				for (int32 Y = 0; Y < CellDimensions; ++Y)
+				{
+					for (const int32 Slot : Flock.BoidCells[Flock.GetCellIndex(FIntVector{X, Y, Z})])
+					{
+						if (!Halo.Contains(Flock.SlotHandles[Slot]))
+						{
+							Visit(Slot);
+						}
+					}
+				}
+			}
+		}
+	};
+
+	const auto ToShardBoid = [&Flock](const int32 Slot) -> FFlockShardBoid
+	{
+		return FFlockShardBoid{Flock.SlotHandles[Slot].Id, FVector3f{Flock.BoidLocations[Slot]}, FlockCompactState::EncodeDirection(Flock.BoidDirections[Slot]), Flock.BoidSpecies[Slot]};
+	};
+
+	const int32 BeginOutside = Side == Lower ? FirstCell - MigrantCells : LastCell;
+	const int32 EndOutside = Side == Lower ? FirstCell : LastCell + MigrantCells;
+	VisitColumns(BeginOutside, EndOutside, [&](const int32 Slot) -> void
+	{
+		OutMessage.Migrants.Add(ToShardBoid(Slot));
+	});
+
+	const int32 BeginHalo = Side == Lower ? FirstCell : LastCell - HaloCells;
+	const int32 EndHalo = Side == Lower ? FirstCell + HaloCells : LastCell;
+	VisitColumns(FMath::Max(BeginHalo, FirstCell), FMath::Min(EndHalo, LastCell), [&](const int32 Slot) -> void
+	{
+		OutMessage.Halo.Add(ToShardBoid(Slot));
+	});
+}
+
+void FFlockShard::SendBoids(AFlock& Flock, const float DeltaTime)
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Send Shard Boids"), STAT_SendShardBoids, STATGROUP_BoidSimulation);
+
+	Update();
+
+	// Sent every step, so a boid can only have crossed as many columns as it moved through since the last one.
+	double MaxMovement = 0.0;
+	for (const AFlock::FBoidSpeciesRules& Rules : Flock.Parameters->SpeciesRules)
+	{
+		MaxMovement = FMath::Max(MaxMovement, Rules.MovementSpeed * static_cast<double>(DeltaTime));
+	}
+	const int32 MigrantCells = FMath::Max(FMath::CeilToInt32(MaxMovement / AFlock::CELL_SIZE), 1);
+	const int32 HaloCells = GetHaloCells(Flock);
+
+	FFlockShardMessage Messages[NumSides];
+	TArray<FFlockBoidHandle> Migrated;
+
+	FRWScopeLock Lock{Flock.SimulationLock, SLT_Write};
+
+	for (int32 Side = 0; Side < NumSides; ++Side)
+	{
+		// Held on to, and simulated here, until the neighbor is reachable. They can drift any distance past the border meanwhile.
+		if (!IsConnected(Side))
+		{
+			bScanAllMigrants[Side] = true;
+			continue;
+		}
+
+		FFlockShardMessage& Message = Messages[Side];
+		GatherBoids(Flock, Halo, Side, FirstCell, LastCell, bScanAllMigrants[Side] ? Flock.GetCellDimensions() : MigrantCells, HaloCells, Message);
+		bScanAllMigrants[Side] = false;
+
+		for (const FFlockShardBoid& Boid : Message.Migrants)
+		{
+			Migrated.Add(FFlockBoidHandle{Boid.Id});
+		}
+	}
+
+	Flock.RemoveBoids(Migrated);
+
+	for (int32 Side = 0; Side < NumSides; ++Side)
+	{
+		if (IsConnected(Side))
+		{
+			Messages[Side].Step = Step;
+			Send(Side, Messages[Side]);
+		}
+	}
+
+	// Flushed right away rather than at the start of the next tick, so neighbors get it while they're still simulating this step.
+	Update();
+	++Step;
+
+	NumMigrantsOut += Migrated.Num();
+	SET_DWORD_STAT(STAT_ShardMigrantsOut, Migrated.Num());
+
+	const float StatusInterval = FlockShard::StatusInterval.GetValueOnGameThread();
+	const double Now = FPlatformTime::Seconds();
+	if (StatusInterval > 0.f && Now >= NextStatusTime)
+	{
+		NextStatusTime = Now + StatusInterval;
+		UE_LOG(LogBoidSimulation, Log, TEXT("%s: Shard %i/%i step %u: %i owned of %i, %i halo, %llu migrated in, %llu migrated out, %i/%i links"),
+			*Flock.GetName(), Config.Index, Config.Count, Step, Flock.GetNumBoids() - Halo.Num(), Flock.NumInstances, Halo.Num(), NumMigrantsIn, NumMigrantsOut,
+			static_cast<int32>(IsConnected(Lower)) + static_cast<int32>(IsConnected(Upper)),
+			static_cast<int32>(HasNeighbor(Lower)) + static_cast<int32>(HasNeighbor(Upper)));
+	}
+}
@@ -0,0 +1,184 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockBoidHandle.h"
+
+class AFlock;
+class FSocket;
+
+// A boid as shards exchange it, 25 bytes: location as floats relative to the flock, direction octahedral as in FlockCompactState.
+struct FFlockShardBoid
+{
+	uint64 Id;
+	FVector3f Location;
+	uint32 Direction;
+	uint8 Species;
+
+	static constexpr int32 SerializedSize = 25;
+
+	friend FArchive& operator<<(FArchive& Ar, FFlockShardBoid& Boid)
+	{
+		return Ar << Boid.Id << Boid.Location.X << Boid.Location.Y << Boid.Location.Z << Boid.Direction << Boid.Species;
+	}
+};
+
+// Everything a shard sends one neighbor per step. Little endian, as every platform we run shards on.
+struct FFlockShardMessage
+{
+	uint32 Step = 0;
+
+	// Boids that crossed into the neighbor's slab. The neighbor owns them from here on.
+	TArray<FFlockShardBoid> Migrants;
+
+	// Boids close enough to the neighbor's slab for its boids to see. The neighbor adds them to its grid but doesn't own them.
+	TArray<FFlockShardBoid> Halo;
+
+	// Sets the archive's error on a foreign, outdated or truncated message rather than reading past it.
+	void Serialize(FArchive& Ar);
+};
+
+// A framed, non-blocking TCP connection to one neighbor over loopback. Reconnects on its own once the neighbor is back.
+class FFlockShardLink
+{
+public:
+	FFlockShardLink() = default;
+	FFlockShardLink(const FFlockShardLink&) = delete;
+	FFlockShardLink& operator=(const FFlockShardLink&) = delete;
+	~FFlockShardLink();
+
+	// Either waits for the neighbor on Port or keeps trying to reach it there.
+	void Listen(const int32 Port);
+	void Connect(const int32 Port);
+
+	// Accepts or connects, flushes what's queued and reads what's arrived. Never blocks.
+	void Update();
+
+	UE_NODISCARD FORCEINLINE bool IsConnected() const
+	{
+		return Socket != nullptr;
+	}
+
+	// Queued until the socket takes it. Frames queued while disconnected are dropped.
+	void Send(const TConstArrayView<uint8>& Frame);
+
+	UE_NODISCARD bool Receive(TArray<uint8>& OutFrame);
+
+private:
+	void Disconnect();
+
+	FSocket* ListenSocket = nullptr;
+	FSocket* Socket = nullptr;
+
+	int32 ConnectPort = 0;
+	double NextConnectTime = 0.0;
+
+	TArray<uint8> Outgoing;
+	TArray<uint8> Incoming;
+};
+
+/**
+ * One process' slab of a flock split across several, each owning the boids in whole grid columns [GetFirstCell(), GetLastCell()) along X.
+ * Neighbors exchange halos and migrants every step, see ReceiveBoids and SendBoids, which AFlock::Tick calls around simulating.
+ * Shard I listens on BasePort + I for shard I - 1 and connects to shard I + 1 on BasePort + I + 1.
+ */
+class FFlockShard
+{
+public:
+	static constexpr int32 Lower = 0;
+	static constexpr int32 Upper = 1;
+	static constexpr int32 NumSides = 2;
+
+	struct FConfig
+	{
+		int32 Index = 0;
+		int32 Count = 1;
+		int32 BasePort = 7800;
+
+		// Every shard scatters the whole flock from it and keeps its own slab.
+		int32 Seed = 1;
+	};
+
+	// From -FlockShard=I -FlockShards=N, plus optionally -FlockShardPort=P and -FlockShardSeed=S. Unset when not running as a shard.
+	UE_NODISCARD static TOptional<FConfig> ParseCommandLine();
+
+	FFlockShard(const FConfig& InConfig, const int32 CellDimensions);
+
+	UE_NODISCARD FORCEINLINE const FConfig& GetConfig() const
+	{
+		return Config;
+	}
+
+	UE_NODISCARD FORCEINLINE int32 GetFirstCell() const
+	{
+		return FirstCell;
+	}
+
+	UE_NODISCARD FORCEINLINE int32 GetLastCell() const
+	{
+		return LastCell;
+	}
+
+	UE_NODISCARD FORCEINLINE bool OwnsCell(const int32 CellX) const
+	{
+		return CellX >= FirstCell && CellX < LastCell;
+	}
+
+	UE_NODISCARD FORCEINLINE bool HasNeighbor(const int32 Side) const
+	{
+		return Side == Lower ? Config.Index > 0 : Config.Index < Config.Count - 1;
+	}
+
+	UE_NODISCARD FORCEINLINE bool IsConnected(const int32 Side) const
+	{
+		return Links[Side].IsConnected();
+	}
+
+	void Update();
+
+	void Send(const int32 Side, FFlockShardMessage& Message);
+
+	// Skips, and logs, anything that doesn't parse.
+	UE_NODISCARD bool Receive(const int32 Side, FFlockShardMessage& OutMessage);
+
+	// Adopts the neighbors' migrants into Flock and replaces their halos. Before simulating.
+	void ReceiveBoids(AFlock& Flock);
+
+	// Hands Flock's boids that left the slab to the neighbor they crossed into and sends both neighbors the slab's edges. After simulating a step of DeltaTime.
+	void SendBoids(AFlock& Flock, const float DeltaTime);
+
+	// Spawns can land anywhere, so the next send looks for migrants across the whole grid rather than next to the borders only.
+	FORCEINLINE void ScanAllMigrants()
+	{
+		bScanAllMigrants[Lower] = bScanAllMigrants[Upper] = true;
+	}
+
+	// Columns of the halo sent to each neighbor: every owned boid within any species' search radius of the border.
+	UE_NODISCARD static int32 GetHaloCells(const AFlock& Flock);
+
+	/**
+	 * What to send the neighbor past Side of the slab [FirstCell, LastCell): Flock's boids in the MigrantCells columns just past that border
+	 * as migrants and in the HaloCells columns just inside it as halo. Boids in Halo, the neighbors' own halos, are never sent back.
+	 */
+	static void GatherBoids(const AFlock& Flock, const TSet<FFlockBoidHandle>& Halo, const int32 Side, const int32 FirstCell, const int32 LastCell, const int32 MigrantCells, const int32 HaloCells, FFlockShardMessage& OutMessage);
+
+private:
+	FConfig Config;
+	int32 FirstCell;
+	int32 LastCell;
+
+	FFlockShardLink Links[NumSides];
+
+	// The neighbors' halos, per side. Gridded and simulated like any other boid so the boids near the edge see them, but never sent on.
+	TArray<FFlockBoidHandle> HaloHandles[NumSides];
+	TSet<FFlockBoidHandle> Halo;
+	uint32 Step = 0;
+
+	// Per side. Set when boids may have got past that border other than by moving there, which the migrant scan otherwise relies on:
+	// spawns, which can land anywhere, and boids held on to while a neighbor was unreachable, here or there.
+	bool bScanAllMigrants[NumSides] = {};
+	uint64 NumMigrantsIn = 0;
+	uint64 NumMigrantsOut = 0;
+	double NextStatusTime = 0.0;
+};
@@ -0,0 +1,186 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ConvexVolume.h"
+#include "FlockBoidHandle.h"
+
+enum class EFlockQueryShape : uint8
+{
+	Sphere,
+	Box,
+	Cone,
+	Frustum,
+};
+
+/**
+ * A single shape to gather boids in. Everything is relative to the flock, the same space boids are simulated in.
+ * Build with the Make* helpers.
+ */
+struct FFlockSpatialQuery
+{
+	EFlockQueryShape Shape = EFlockQueryShape::Sphere;
+
+	// Sphere center, box center or cone apex.
+	FVector Origin = FVector::ZeroVector;
+
+	// Box half extent.
+	FVector Extent = FVector::ZeroVector;
+
+	// Normalized cone axis.
+	FVector Direction = FVector::ForwardVector;
+
+	// Sphere radius or cone length.
+	double Radius = 0.0;
+
+	double CosHalfAngle = 1.0;
+
+	// Not owned. Must outlive the query. Bounds limit the cells walked for the frustum, the whole grid is walked when invalid.
+	const FConvexVolume* Frustum = nullptr;
+	FBox FrustumBounds{ForceInit};
+
+	UE_NODISCARD static FFlockSpatialQuery MakeSphere(const FVector& Center, const double Radius)
+	{
+		FFlockSpatialQuery Query;
+		Query.Shape = EFlockQueryShape::Sphere;
+		Query.Origin = Center;
+		Query.Radius = Radius;
+		return Query;
+	}
+
+	UE_NODISCARD static FFlockSpatialQuery MakeBox(const FBox& Box)
+	{
+		FFlockSpatialQuery Query;
+		Query.Shape = EFlockQueryShape::Box;
+		Query.Origin = Box.GetCenter();
+		Query.Extent = Box.GetExtent();
+		return Query;
+	}
+
+	UE_NODISCARD static FFlockSpatialQuery MakeCone(const FVector& Apex, const FVector& Direction, const double Length, const double HalfAngleRadians)
+	{
+		FFlockSpatialQuery Query;
+		Query.Shape = EFlockQueryShape::Cone;
+		Query.Origin = Apex;
+		Query.Direction = Direction.GetSafeNormal();
+		Query.Radius = Length;
+		Query.CosHalfAngle = FMath::Cos(HalfAngleRadians);
+		return Query;
+	}
+
+	UE_NODISCARD static FFlockSpatialQuery MakeFrustum(const FConvexVolume& Frustum, const FBox& Bounds = FBox{ForceInit})
+	{
+		FFlockSpatialQuery Query;
+		Query.Shape = EFlockQueryShape::Frustum;
+		Query.Frustum = &Frustum;
+		Query.FrustumBounds = Bounds;
+		return Query;
+	}
+
+	// Conservative bounds of the shape, used to pick the grid cells to walk. Invalid means unbounded.
+	UE_NODISCARD FBox GetBounds() const
+	{
+		switch (Shape)
+		{
+		case EFlockQueryShape::Sphere:
+		case EFlockQueryShape::Cone:
+			return FBox{Origin - FVector{Radius}, Origin + FVector{Radius}};
+		case EFlockQueryShape::Box:
+			return FBox{Origin - Extent, Origin + Extent};
+		default:
+			return FrustumBounds;
+		}
+	}
+
+	// Whether the cell could contain a match. Only needs to be conservative.
+	UE_NODISCARD FORCEINLINE bool MayIntersectCell(const FVector& CellCenter, const double CellHalfExtent) const
+	{
+		switch (Shape)
+		{
+		case EFlockQueryShape::Sphere:
+		case EFlockQueryShape::Cone:
+			return FMath::SphereAABBIntersection(Origin, FMath::Square(Radius), FBox{CellCenter - FVector{CellHalfExtent}, CellCenter + FVector{CellHalfExtent}});
+		case EFlockQueryShape::Box:
+			return true;
+		default:
+			return Frustum->IntersectBox(CellCenter, FVector{CellHalfExtent});
+		}
+	}
+
+	UE_NODISCARD FORCEINLINE bool Contains(const FVector& Location) const
+	{
+		switch (Shape)
+		{
+		case EFlockQueryShape::Sphere:
+			return FVector::DistSquared(Origin, Location) <= FMath::Square(Radius);
+		case EFlockQueryShape::Box:
+			return FMath::Abs(Location.X - Origin.X) <= Extent.X && FMath::Abs(Location.Y - Origin.Y) <= Extent.Y && FMath::Abs(Location.Z - Origin.Z) <= Extent.Z;
+		case EFlockQueryShape::Cone:
+		{
+			const FVector ToLocation = Location - Origin;
+			const double DistSquared = ToLocation.SizeSquared();
+			if (DistSquared > FMath::Square(Radius)) return false;
+
+			// Compare squared to avoid the sqrt. Only valid for half angles below 90 degrees, which is all a cone is good for anyway.
+			const double Projection = ToLocation | Direction;
+			return Projection >= 0.0 && FMath::Square(Projection) >= FMath::Square(CosHalfAngle) * DistSquared;
+		}
+		default:
+			return Frustum->IntersectSphere(Location, 0.f);
+		}
+	}
+};
+
+/**
+ * Flat results of a batch of spatial queries. Query I's matches live in [Offsets[I], Offsets[I + 1]) of Handles and Locations.
+ * Keep one around and reuse it; running a batch only grows its buffers, never allocates per query.
+ */
+struct FFlockSpatialQueryResults
+{
+	TArray<int32> Offsets;
+	TArray<FFlockBoidHandle> Handles;
+	TArray<FVector> Locations;
+
+	UE_NODISCARD FORCEINLINE int32 Num() const
+	{
+		return FMath::Max(Offsets.Num() - 1, 0);
+	}
+
+	UE_NODISCARD FORCEINLINE TConstArrayView<FFlockBoidHandle> GetHandles(const int32 QueryIndex) const
+	{
+		return TConstArrayView<FFlockBoidHandle>{Handles.GetData() + Offsets[QueryIndex], Offsets[QueryIndex + 1] - Offsets[QueryIndex]};
+	}
+
+	UE_NODISCARD FORCEINLINE TConstArrayView<FVector> GetLocations(const int32 QueryIndex) const
+	{
+		return TConstArrayView<FVector>{Locations.GetData() + Offsets[QueryIndex], Offsets[QueryIndex + 1] - Offsets[QueryIndex]};
+	}
+};
+
+/**
+ * A line trace (SweepRadius == 0) or sphere sweep against individual boids, relative to the flock.
+ * A ray is just a long segment.
+ */
+struct FFlockBoidTrace
+{
+	FVector Start = FVector::ZeroVector;
+	FVector End = FVector::ZeroVector;
+	double SweepRadius = 0.0;
+};
+
+struct FFlockBoidTraceHit
+{
+	// Invalid on a miss.
+	FFlockBoidHandle Handle;
+
+	FVector BoidLocation = FVector::ZeroVector;
+
+	// Fraction along Start -> End of the first contact.
+	double Time = 1.0;
+
+	UE_NODISCARD FORCEINLINE bool IsHit() const
+	{
+		return Handle.IsValid();
+	}
+};
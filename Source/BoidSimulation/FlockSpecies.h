@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockSpecies.generated.h"
+
+/**
+ * Behaviour profile shared by every boid of one species within an AFlock.
+ * Every species separates from every other, but only aligns and coheres with its own kind.
+ */
+USTRUCT(BlueprintType)
+struct BOIDSIMULATION_API FFlockSpecies
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category="Species")
+	FName Name;
+
+	// Relative share of the boids spawned on BeginPlay.
+	UPROPERTY(EditAnywhere, Category="Species", meta=(ClampMin=0))
+	float SpawnWeight = 1.f;
+
+	// Zero uses the flock's MovementSpeed.
+	UPROPERTY(EditAnywhere, Category="Species", meta=(ClampMin=0))
+	float MovementSpeed = 0.f;
+
+	// Disabled rules are compiled out of this species' steering kernel rather than skipped at runtime.
+	UPROPERTY(EditAnywhere, Category="Species|Rules")
+	bool bSeparation = true;
+
+	UPROPERTY(EditAnywhere, Category="Species|Rules")
+	bool bAlignment = true;
+
+	UPROPERTY(EditAnywhere, Category="Species|Rules")
+	bool bCohesion = true;
+
+	// Multiplies the matching BoidSimulation.*Strength.
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0))
+	float SeparationStrengthScale = 1.f;
+
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0))
+	float AlignmentStrengthScale = 1.f;
+
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0))
+	float CohesionStrengthScale = 1.f;
+
+	// Per-rule radii. Zero falls back to the flock's BoidsSearchNearbyRadius. Neighbors are gathered once at the largest of them and sorted into rules by distance.
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0))
+	float SeparationRadius = 0.f;
+
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0))
+	float AlignmentRadius = 0.f;
+
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0))
+	float CohesionRadius = 0.f;
+
+	/**
+	 * Full angle in degrees of the cone in front of a boid that each rule considers. Anything below 360 replaces the half-space test, see
+	 * bLegacyHalfSpace, with the cone.
+	 */
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0, ClampMax=360))
+	float SeparationFieldOfView = 360.f;
+
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0, ClampMax=360))
+	float AlignmentFieldOfView = 360.f;
+
+	UPROPERTY(EditAnywhere, Category="Species|Rules", meta=(ClampMin=0, ClampMax=360))
+	float CohesionFieldOfView = 360.f;
+
+	/**
+	 * Rules whose field of view is left at 360 keep the flock's original neighbor test, which skips neighbors with
+	 * (Direction | (Location - OtherLocation)) <= -0.25, so default species behave as they did before cones existed. The offset isn't normalized,
+	 * so the test isn't a cone and narrows with distance. Turn this off for those rules to consider every neighbor in range.
+	 */
+	UPROPERTY(EditAnywhere, Category="Species|Rules")
+	bool bLegacyHalfSpace = true;
+};
@@ -0,0 +1,108 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+enum class EFlockSteeringMath : uint8
+{
+	// Quaternion based, as accurate as the engine gets. Several transcendentals per call.
+	Exact,
+
+	// Bounded-error approximations. Only sqrt and divisions, see each function for its bound.
+	Fast,
+};
+
+/**
+ * Rotation helpers for steering, in exact and fast flavours picked at runtime by EFlockSteeringMath.
+ * The documented bounds are checked against the exact versions by the BoidSimulation.SteeringMath automation tests.
+ */
+namespace FlockSteeringMath
+{
+// Rotates A towards B by Alpha of the angle between them. Alpha outside [0, 1] extrapolates.
+UE_NODISCARD FORCEINLINE FVector SlerpNormalsExact(const FVector& A, const FVector& B, const double Alpha)
+{
+	const FQuat RotationDifference = FQuat::FindBetweenNormals(A, B);
+
+	FVector Axis; double Angle;
+	RotationDifference.ToAxisAndAngle(Axis, Angle);
+
+	return FQuat{Axis, Angle * Alpha}.RotateVector(A);
+}
+
+/**
+ * Normalized lerp with Alpha remapped by a polynomial fit of the slerp angle (after Zeux's onlerp), so there's no acos or sin.
+ * Within 4e-4 radians (0.025 degrees) of SlerpNormalsExact while A and B are at most 90 degrees apart and Alpha is in [0, 1].
+ * Falls back to the exact version outside of that.
+ */
+UE_NODISCARD FORCEINLINE FVector SlerpNormalsFast(const FVector& A, const FVector& B, const double Alpha)
+{
+	const double Dot = A | B;
+	if (UNLIKELY(Dot < 0.0 || Alpha < 0.0 || Alpha > 1.0))
+	{
+		return SlerpNormalsExact(A, B, Alpha);
+	}
+
+	const double K0 = 1.0904 + Dot * (-3.2452 + Dot * (3.55645 - Dot * 1.43519));
+	const double K1 = 0.848013 + Dot * (-1.06021 + Dot * 0.215638);
+	const double K = K0 * FMath::Square(Alpha - 0.5) + K1;
+	const double CorrectedAlpha = Alpha + Alpha * (Alpha - 0.5) * (Alpha - 1.0) * K;
+
+	return (A + (B - A) * CorrectedAlpha).GetUnsafeNormal();
+}
+
+UE_NODISCARD FORCEINLINE FVector SlerpNormals(const FVector& A, const FVector& B, const double Alpha, const EFlockSteeringMath Mode)
+{
+	return Mode == EFlockSteeringMath::Fast ? SlerpNormalsFast(A, B, Alpha) : SlerpNormalsExact(A, B, Alpha);
+}
+
+// Same rotation as FVector::ToOrientationQuat (yaw and pitch, no roll) for a normalized Direction.
+UE_NODISCARD FORCEINLINE FQuat DirectionToQuatExact(const FVector& Direction)
+{
+	return Direction.ToOrientationQuat();
+}
+
+/**
+ * DirectionToQuatExact without the atan2, sin and cos. The half-angle sines and cosines of yaw and pitch come straight from the direction's
+ * components via sqrt((1 +- cos) / 2), taking whichever of the pair is better conditioned and deriving the other from sin = 2 * sin/2 * cos/2.
+ * Matches the exact version to within a few ulps (up to the sign of the whole quaternion at yaw == 180, the same rotation) for a normalized Direction.
+ * Directions within ~1e-8 of vertical may pick a different yaw, which is just as valid since yaw is undefined there.
+ */
+UE_NODISCARD FORCEINLINE FQuat DirectionToQuatFast(const FVector& Direction)
+{
+	const double HorizontalSizeSquared = FMath::Square(Direction.X) + FMath::Square(Direction.Y);
+
+	double CosYaw = 1.0, SinYaw = 0.0, CosPitch = 0.0;
+	if (LIKELY(HorizontalSizeSquared > FMath::Square(UE_DOUBLE_SMALL_NUMBER)))
+	{
+		CosPitch = FMath::Sqrt(HorizontalSizeSquared);
+		CosYaw = Direction.X / CosPitch;
+		SinYaw = Direction.Y / CosPitch;
+	}
+
+	// Pitch is in [-90, 90] so its half-angle cosine is always at least sqrt(0.5).
+	const double CP = FMath::Sqrt((1.0 + CosPitch) * 0.5);
+	const double SP = Direction.Z / (2.0 * CP);
+
+	// Yaw is in (-180, 180]. Its half-angle cosine vanishes towards 180, so derive it from the sine there instead.
+	double CY, SY;
+	if (CosYaw >= 0.0)
+	{
+		CY = FMath::Sqrt((1.0 + CosYaw) * 0.5);
+		SY = SinYaw / (2.0 * CY);
+	}
+	else
+	{
+		SY = FMath::Sqrt((1.0 - CosYaw) * 0.5);
+		SY = SinYaw >= 0.0 ? SY : -SY;
+		CY = SinYaw / (2.0 * SY);
+	}
+
+	return FQuat{SP * SY, -SP * CY, CP * SY, CP * CY};
+}
+
+UE_NODISCARD FORCEINLINE FQuat DirectionToQuat(const FVector& Direction, const EFlockSteeringMath Mode)
+{
+	return Mode == EFlockSteeringMath::Fast ? DirectionToQuatFast(Direction) : DirectionToQuatExact(Direction);
+}
+}
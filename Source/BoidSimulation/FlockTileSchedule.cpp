@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockTileSchedule.h"
+#include "Async/TaskGraphInterfaces.h"
+
+void FFlockTileSchedule::Build(const int32 CellDimensions, const int32 TileSize, TFunctionRef<TConstArrayView<int32>(int32)> GetCell)
+{
+	check(TileSize > 0);
+
+	NumStolenTiles.store(0, std::memory_order_relaxed);
+
+	const int32 TilesPerAxis = FMath::DivideAndRoundUp(CellDimensions, TileSize);
+	const int32 NumTiles = FMath::Cube(TilesPerAxis);
+
+	const auto ForEachCellInTile = [&](const int32 TileIndex, auto&& Functor) -> void
+	{
+		const int32 TileX = TileIndex % TilesPerAxis;
+		const int32 TileY = (TileIndex / TilesPerAxis) % TilesPerAxis;
+		const int32 TileZ = TileIndex / (TilesPerAxis * TilesPerAxis);
+
+		const int32 EndX = FMath::Min((TileX + 1) * TileSize, CellDimensions);
+		const int32 EndY = FMath::Min((TileY + 1) * TileSize, CellDimensions);
+		const int32 EndZ = FMath::Min((TileZ + 1) * TileSize, CellDimensions);
+
+		for (int32 Z = TileZ * TileSize; Z < EndZ; ++Z)
+		{
+			for (int32 Y = TileY * TileSize; Y < EndY; ++Y)
+			{
+				for (int32 X = TileX * TileSize; X < EndX; ++X)
+				{
+					Functor(GetCell(X + Y * CellDimensions + Z * CellDimensions * CellDimensions));
+				}
+			}
+		}
+	};
+
+	// Count, prefix sum, then scatter. Both passes are embarrassingly parallel over tiles.
+	TileStarts.SetNumUninitialized(NumTiles + 1);
+	ParallelFor(NumTiles, [&](const int32 TileIndex) -> void
+	{
+		int32 Count = 0;
+		ForEachCellInTile(TileIndex, [&](const TConstArrayView<int32>& Cell) -> void { Count += Cell.Num(); });
+		TileStarts[TileIndex + 1] = Count;
+	});
+
+	TileStarts[0] = 0;
+	NonEmptyTiles.Reset();
+	for (int32 TileIndex = 0; TileIndex < NumTiles; ++TileIndex)
+	{
+		if (TileStarts[TileIndex + 1] > 0)
+		{
+			NonEmptyTiles.Add(TileIndex);
+		}
+		TileStarts[TileIndex + 1] += TileStarts[TileIndex];
+	}
+
+	const int32 NumBoids = TileStarts[NumTiles];
+	TileBoids.SetNumUninitialized(NumBoids);
+	ParallelFor(NumTiles, [&](const int32 TileIndex) -> void
+	{
+		int32 WriteIndex = TileStarts[TileIndex];
+		ForEachCellInTile(TileIndex, [&](const TConstArrayView<int32>& Cell) -> void
+		{
+			FMemory::Memcpy(TileBoids.GetData() + WriteIndex, Cell.GetData(), Cell.Num() * sizeof(int32));
+			WriteIndex += Cell.Num();
+		});
+	});
+
+	// Hand out contiguous runs of tiles with roughly equal boid counts, one run per worker (plus the calling thread).
+	const int32 NumQueues = FMath::Clamp(FTaskGraphInterface::Get().GetNumWorkerThreads() + 1, 1, FMath::Max(NonEmptyTiles.Num(), 1));
+	if (Queues.Num() != NumQueues)
+	{
+		Queues.Empty(NumQueues);
+		Queues.SetNum(NumQueues);
+	}
+
+	int32 TileCursor = 0;
+	for (int32 QueueIndex = 0; QueueIndex < NumQueues; ++QueueIndex)
+	{
+		const int64 TargetEndBoid = static_cast<int64>(NumBoids) * (QueueIndex + 1) / NumQueues;
+
+		Queues[QueueIndex].Start = TileCursor;
+		while (TileCursor < NonEmptyTiles.Num() && (QueueIndex == NumQueues - 1 || TileStarts[NonEmptyTiles[TileCursor] + 1] <= TargetEndBoid))
+		{
+			++TileCursor;
+		}
+		Queues[QueueIndex].End = TileCursor;
+	}
+}
@@ -0,0 +1,125 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/ParallelFor.h"
+#include <atomic>
+
+/**
+ * Spatial alternative to index order scheduling. Groups the boids resident in each brick of TileSize^3 grid cells into a tile,
+ * then hands each worker a contiguous run of tiles (balanced by boid count) so a worker keeps touching the same region of the grid.
+ * Neighbor searches still read straight from the shared grid, so halo cells owned by adjacent tiles need no special handling.
+ * Workers that run dry steal tiles from the back of the other workers' runs, away from where their owners are working.
+ */
+class BOIDSIMULATION_API FFlockTileSchedule
+{
+public:
+	// Rebuilds the tiles from whichever boids GetCell(CellIndex) returns for each cell, e.g. all or only one species'.
+	// Cells are indexed X + Y * CellDimensions + Z * CellDimensions^2.
+	void Build(const int32 CellDimensions, const int32 TileSize, TFunctionRef<TConstArrayView<int32>(int32)> GetCell);
+
+	template<typename BodyType>
+	void ParallelFor(BodyType&& Body)
+	{
+		const int32 NumQueues = Queues.Num();
+		for (FTileQueue& Queue : Queues)
+		{
+			Queue.Reset();
+		}
+
+		::ParallelFor(TEXT("BoidSimulation.Tiles"), NumQueues, 1, [&](const int32 QueueIndex) -> void
+		{
+			const auto ProcessTile = [&](const int32 TileIndex) -> void
+			{
+				const int32 End = TileStarts[TileIndex + 1];
+				for (int32 i = TileStarts[TileIndex]; i < End; ++i)
+				{
+					Body(TileBoids[i]);
+				}
+			};
+
+			// Own run first, front to back.
+			for (int32 TileIndex; (TileIndex = Queues[QueueIndex].PopFront()) != INDEX_NONE;)
+			{
+				ProcessTile(NonEmptyTiles[TileIndex]);
+			}
+
+			// Then steal from everyone else, starting with the run before ours, whose back borders our front.
+			for (int32 Offset = 1; Offset < NumQueues; ++Offset)
+			{
+				FTileQueue& Victim = Queues[(QueueIndex - Offset + NumQueues) % NumQueues];
+				for (int32 TileIndex; (TileIndex = Victim.PopBack()) != INDEX_NONE;)
+				{
+					ProcessTile(NonEmptyTiles[TileIndex]);
+					NumStolenTiles.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		}, EParallelForFlags::Unbalanced);
+	}
+
+	UE_NODISCARD FORCEINLINE int32 GetNumTiles() const
+	{
+		return NonEmptyTiles.Num();
+	}
+
+	// Number of tiles processed by a worker other than their owner, summed over every ParallelFor since the last Build.
+	UE_NODISCARD FORCEINLINE int32 GetNumStolenTiles() const
+	{
+		return NumStolenTiles.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct alignas(PLATFORM_CACHE_LINE_SIZE) FTileQueue
+	{
+		// The unclaimed tiles [Front, Back) of the run, as Front | Back << 32 so the owner and thieves claim from either end with one compare and swap.
+		std::atomic<uint64> Unclaimed{0};
+		int32 Start = 0;
+		int32 End = 0;
+
+		FORCEINLINE void Reset()
+		{
+			Unclaimed.store(Pack(Start, End), std::memory_order_relaxed);
+		}
+
+		// The owner works front to back.
+		UE_NODISCARD FORCEINLINE int32 PopFront()
+		{
+			for (uint64 Expected = Unclaimed.load(std::memory_order_relaxed);;)
+			{
+				const int32 Front = static_cast<int32>(Expected);
+				const int32 Back = static_cast<int32>(Expected >> 32);
+				if (Front >= Back) return INDEX_NONE;
+				if (Unclaimed.compare_exchange_weak(Expected, Pack(Front + 1, Back), std::memory_order_relaxed)) return Front;
+			}
+		}
+
+		// Thieves work back to front.
+		UE_NODISCARD FORCEINLINE int32 PopBack()
+		{
+			for (uint64 Expected = Unclaimed.load(std::memory_order_relaxed);;)
+			{
+				const int32 Front = static_cast<int32>(Expected);
+				const int32 Back = static_cast<int32>(Expected >> 32);
+				if (Front >= Back) return INDEX_NONE;
+				if (Unclaimed.compare_exchange_weak(Expected, Pack(Front, Back - 1), std::memory_order_relaxed)) return Back - 1;
+			}
+		}
+
+	private:
+		UE_NODISCARD static FORCEINLINE uint64 Pack(const int32 Front, const int32 Back)
+		{
+			return static_cast<uint32>(Front) | static_cast<uint64>(static_cast<uint32>(Back)) << 32;
+		}
+	};
+
+	// Boid indices grouped by tile. Tile T owns TileBoids[TileStarts[T], TileStarts[T + 1]).
+	TArray<int32> TileBoids;
+	TArray<int32> TileStarts;
+
+	// Tiles with at least one boid, in linear (spatially coherent) order. Queues index into this.
+	TArray<int32> NonEmptyTiles;
+	TArray<FTileQueue> Queues;
+
+	std::atomic<int32> NumStolenTiles{0};
+};
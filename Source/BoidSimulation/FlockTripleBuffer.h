@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+/**
+ * Lock-free single producer, single consumer triple buffer. The writer fills its buffer and publishes it, the reader latches whatever
+ * was published most recently. Neither side ever waits on the other, and the reader never sees a partially written buffer.
+ * Frames published faster than they're latched are simply skipped.
+ */
+template<typename T>
+class TFlockTripleBuffer
+{
+public:
+	// Writer only. Contents are whatever was in this buffer two publishes ago, it's up to the writer to overwrite all of it.
+	UE_NODISCARD FORCEINLINE T& GetWriteBuffer()
+	{
+		return Buffers[WriteIndex];
+	}
+
+	// Writer only. Hands the write buffer over to the reader and takes back whichever buffer the reader isn't using.
+	FORCEINLINE void Publish()
+	{
+		WriteIndex = Shared.exchange(WriteIndex | FreshBit, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	// Reader only. Swaps in the newest published buffer if there is one. Returns whether the read buffer changed.
+	FORCEINLINE bool Latch()
+	{
+		if ((Shared.load(std::memory_order_relaxed) & FreshBit) == 0) return false;
+
+		ReadIndex = Shared.exchange(ReadIndex, std::memory_order_acq_rel) & IndexMask;
+		return true;
+	}
+
+	// Reader only.
+	UE_NODISCARD FORCEINLINE const T& GetReadBuffer() const
+	{
+		return Buffers[ReadIndex];
+	}
+
+private:
+	static constexpr uint8 IndexMask = 0x3;
+	static constexpr uint8 FreshBit = 0x4;
+
+	T Buffers[3];
+
+	// The buffer in between, plus whether it was published since the reader last latched.
+	std::atomic<uint8> Shared{2};
+
+	uint8 WriteIndex = 0;
+	uint8 ReadIndex = 1;
+};
@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/ParallelFor.h"
+#include <atomic>
+
+/**
+ * Lock-free disjoint sets over [0, Num), safe to Union from any number of threads at once.
+ * Roots are only ever linked under a smaller root with a compare-and-swap, so concurrent unions can't form cycles, and Find halves paths as it
+ * walks them. Losing a path halving race only leaves a path longer than it could have been, never a wrong one.
+ */
+class FFlockUnionFind
+{
+public:
+	void Reset(const int32 Num)
+	{
+		if (Parents.Num() != Num)
+		{
+			Parents.Empty(Num);
+			Parents.SetNum(Num);
+		}
+
+		ParallelFor(Num, [this](const int32 i) -> void
+		{
+			Parents[i].store(i, std::memory_order_relaxed);
+		});
+	}
+
+	UE_NODISCARD FORCEINLINE int32 Find(int32 i)
+	{
+		for (;;)
+		{
+			int32 Parent = Parents[i].load(std::memory_order_relaxed);
+			if (Parent == i) return i;
+
+			const int32 Grandparent = Parents[Parent].load(std::memory_order_relaxed);
+			if (Parent != Grandparent)
+			{
+				Parents[i].compare_exchange_weak(Parent, Grandparent, std::memory_order_relaxed);
+			}
+			i = Grandparent;
+		}
+	}
+
+	FORCEINLINE void Union(int32 A, int32 B)
+	{
+		for (;;)
+		{
+			A = Find(A);
+			B = Find(B);
+			if (A == B) return;
+
+			if (A < B)
+			{
+				Swap(A, B);
+			}
+
+			// Only succeeds if A is still a root. Otherwise someone linked it meanwhile, so start over from the new roots.
+			int32 Expected = A;
+			if (Parents[A].compare_exchange_strong(Expected, B, std::memory_order_acq_rel)) return;
+		}
+	}
+
+private:
+	TArray<std::atomic<int32>> Parents;
+};
@@ -0,0 +1,60 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockWarmState.h"
+#include "Flock.h"
+
+bool UFlockWarmState::IsCompatible(const AFlock& Flock) const
+{
+	return NumBoids == Flock.GetNumInstances() && BoundsRadius == Flock.GetBoundsRadius() && NumSpecies == Flock.GetNumSpecies()
+		&& BulkData.GetBulkDataSize() == static_cast<int64>(NumBoids) * (sizeof(FVector3f) + sizeof(uint32) + sizeof(uint8));
+}
+
+void UFlockWarmState::Store(const AFlock& Flock, const TConstArrayView<FVector>& Locations, const TConstArrayView<FVector>& Directions, const TConstArrayView<uint8> Species, const float InSimulatedSeconds)
+{
+	check(Locations.Num() == Directions.Num() && Locations.Num() == Species.Num());
+
+	NumBoids = Locations.Num();
+	BoundsRadius = Flock.GetBoundsRadius();
+	NumSpecies = Flock.GetNumSpecies();
+	SimulatedSeconds = InSimulatedSeconds;
+
+	BulkData.Lock(LOCK_READ_WRITE);
+	uint8* Data = static_cast<uint8*>(BulkData.Realloc(static_cast<int64>(NumBoids) * (sizeof(FVector3f) + sizeof(uint32) + sizeof(uint8))));
+
+	FVector3f* OutLocations = reinterpret_cast<FVector3f*>(Data);
+	uint32* OutDirections = reinterpret_cast<uint32*>(OutLocations + NumBoids);
+	uint8* OutSpecies = reinterpret_cast<uint8*>(OutDirections + NumBoids);
+
+	for (int32 i = 0; i < NumBoids; ++i)
+	{
+		OutLocations[i] = FVector3f{Locations[i]};
+		OutDirections[i] = FlockCompactState::EncodeDirection(Directions[i]);
+	}
+	FMemory::Memcpy(OutSpecies, Species.GetData(), NumBoids);
+
+	BulkData.Unlock();
+}
+
+UFlockWarmState::FView UFlockWarmState::Lock() const
+{
+	const uint8* Data = static_cast<const uint8*>(BulkData.LockReadOnly());
+
+	const FVector3f* Locations = reinterpret_cast<const FVector3f*>(Data);
+	const uint32* Directions = reinterpret_cast<const uint32*>(Locations + NumBoids);
+	const uint8* Species = reinterpret_cast<const uint8*>(Directions + NumBoids);
+
+	return FView{{Locations, NumBoids}, {Directions, NumBoids}, {Species, NumBoids}};
+}
+
+void UFlockWarmState::Unlock() const
+{
+	BulkData.Unlock();
+}
+
+void UFlockWarmState::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	BulkData.Serialize(Ar, this);
+}
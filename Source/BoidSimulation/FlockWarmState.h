@@ -0,0 +1,59 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "Serialization/BulkData.h"
+#include "FlockWarmState.generated.h"
+
+class AFlock;
+
+/**
+ * Settled boids baked offline by AFlock::BakeWarmState, so a flock starts out organized instead of scattered.
+ * Stored as one bulk block: float locations relative to the flock, then octahedral directions (see FFlockCompactBoid), then species, 17 bytes per boid.
+ */
+UCLASS(BlueprintType)
+class BOIDSIMULATION_API UFlockWarmState : public UDataAsset
+{
+	GENERATED_BODY()
+public:
+	struct FView
+	{
+		TConstArrayView<FVector3f> Locations;
+		TConstArrayView<uint32> Directions;
+		TConstArrayView<uint8> Species;
+	};
+
+	UE_NODISCARD FORCEINLINE int32 GetNumBoids() const
+	{
+		return NumBoids;
+	}
+
+	// Whether the state was baked from a flock configured like this one. Anything else would start out of bounds or with the wrong species.
+	UE_NODISCARD bool IsCompatible(const AFlock& Flock) const;
+
+	// Overwrites the baked state. Every slot must hold a live boid.
+	void Store(const AFlock& Flock, const TConstArrayView<FVector>& Locations, const TConstArrayView<FVector>& Directions, const TConstArrayView<uint8> Species, const float InSimulatedSeconds);
+
+	// The view is valid until Unlock.
+	UE_NODISCARD FView Lock() const;
+	void Unlock() const;
+
+	virtual void Serialize(FArchive& Ar) override;
+
+protected:
+	UPROPERTY(VisibleAnywhere, Category="Warm State")
+	int32 NumBoids = 0;
+
+	UPROPERTY(VisibleAnywhere, Category="Warm State")
+	float BoundsRadius = 0.f;
+
+	UPROPERTY(VisibleAnywhere, Category="Warm State")
+	int32 NumSpecies = 0;
+
+	UPROPERTY(VisibleAnywhere, Category="Warm State")
+	float SimulatedSeconds = 0.f;
+
+	FByteBulkData BulkData;
+};
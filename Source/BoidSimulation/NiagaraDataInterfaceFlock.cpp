@@ -0,0 +1,242 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "NiagaraDataInterfaceFlock.h"
+#include "Flock.h"
+#include "NiagaraSystemInstance.h"
+#include "NiagaraTypes.h"
+
+#define LOCTEXT_NAMESPACE "NiagaraDataInterfaceFlock"
+
+namespace NiagaraDataInterfaceFlock
+{
+static const FName GetNumSlotsName{TEXT("GetNumSlots")};
+static const FName GetNumBoidsName{TEXT("GetNumBoids")};
+static const FName GetBoidName{TEXT("GetBoid")};
+
+struct FInstanceData
+{
+	FNiagaraParameterDirectBinding<UObject*> FlockBinding;
+
+	// Resolved on the game thread before every simulation. Only dereferenced by the VM functions of that same simulation.
+	TWeakObjectPtr<const AFlock> Flock;
+	FTransform FlockToSimulation;
+};
+}
+
+UNiagaraDataInterfaceFlock::UNiagaraDataInterfaceFlock()
+{
+	FlockParameter.Parameter.SetType(FNiagaraTypeDefinition::GetUObjectDef());
+}
+
+void UNiagaraDataInterfaceFlock::PostInitProperties()
+{
+	Super::PostInitProperties();
+
+	if (HasAnyFlags(RF_ClassDefaultObject))
+	{
+		FNiagaraTypeRegistry::Register(FNiagaraTypeDefinition{GetClass()}, ENiagaraTypeRegistryFlags::AllowAnyVariable | ENiagaraTypeRegistryFlags::AllowParameter);
+	}
+}
+
+#if WITH_EDITORONLY_DATA
+void UNiagaraDataInterfaceFlock::GetFunctionsInternal(TArray<FNiagaraFunctionSignature>& OutFunctions) const
+{
+	FNiagaraFunctionSignature BaseSignature;
+	BaseSignature.bMemberFunction = true;
+	BaseSignature.bRequiresContext = false;
+	BaseSignature.Inputs.Emplace(FNiagaraTypeDefinition{GetClass()}, TEXT("Flock"));
+
+	{
+		FNiagaraFunctionSignature& Signature = OutFunctions.Add_GetRef(BaseSignature);
+		Signature.Name = NiagaraDataInterfaceFlock::GetNumSlotsName;
+		Signature.Outputs.Emplace(FNiagaraTypeDefinition::GetIntDef(), TEXT("NumSlots"));
+		Signature.SetDescription(LOCTEXT("GetNumSlots", "Number of slots, free ones included. Valid indices for GetBoid are [0, NumSlots)."));
+	}
+
+	{
+		FNiagaraFunctionSignature& Signature = OutFunctions.Add_GetRef(BaseSignature);
+		Signature.Name = NiagaraDataInterfaceFlock::GetNumBoidsName;
+		Signature.Outputs.Emplace(FNiagaraTypeDefinition::GetIntDef(), TEXT("NumBoids"));
+		Signature.SetDescription(LOCTEXT("GetNumBoids", "Number of live boids."));
+	}
+
+	{
+		FNiagaraFunctionSignature& Signature = OutFunctions.Add_GetRef(BaseSignature);
+		Signature.Name = NiagaraDataInterfaceFlock::GetBoidName;
+		Signature.Inputs.Emplace(FNiagaraTypeDefinition::GetIntDef(), TEXT("Slot"));
+		Signature.Outputs.Emplace(FNiagaraTypeDefinition::GetBoolDef(), TEXT("bAlive"));
+		Signature.Outputs.Emplace(FNiagaraTypeDefinition::GetPositionDef(), TEXT("Position"));
+		Signature.Outputs.Emplace(FNiagaraTypeDefinition::GetVec3Def(), TEXT("Direction"));
+		Signature.Outputs.Emplace(FNiagaraTypeDefinition::GetIntDef(), TEXT("Species"));
+		Signature.Outputs.Emplace(FNiagaraTypeDefinition::GetIntDef(), TEXT("Cluster"));
+		Signature.SetDescription(LOCTEXT("GetBoid", "Reads the boid in a slot. Free or out of range slots aren't alive and read as zero. Cluster is -1 outside of a reported cluster."));
+	}
+}
+#endif
+
+void UNiagaraDataInterfaceFlock::GetVMExternalFunction(const FVMExternalFunctionBindingInfo& BindingInfo, void* InstanceData, FVMExternalFunction& OutFunc)
+{
+	if (BindingInfo.Name == NiagaraDataInterfaceFlock::GetNumSlotsName)
+	{
+		OutFunc = FVMExternalFunction::CreateStatic(&UNiagaraDataInterfaceFlock::VMGetNumSlots);
+	}
+	else if (BindingInfo.Name == NiagaraDataInterfaceFlock::GetNumBoidsName)
+	{
+		OutFunc = FVMExternalFunction::CreateStatic(&UNiagaraDataInterfaceFlock::VMGetNumBoids);
+	}
+	else if (BindingInfo.Name == NiagaraDataInterfaceFlock::GetBoidName)
+	{
+		OutFunc = FVMExternalFunction::CreateStatic(&UNiagaraDataInterfaceFlock::VMGetBoid);
+	}
+}
+
+int32 UNiagaraDataInterfaceFlock::PerInstanceDataSize() const
+{
+	return sizeof(NiagaraDataInterfaceFlock::FInstanceData);
+}
+
+bool UNiagaraDataInterfaceFlock::InitPerInstanceData(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance)
+{
+	NiagaraDataInterfaceFlock::FInstanceData* InstanceData = new(PerInstanceData) NiagaraDataInterfaceFlock::FInstanceData;
+	InstanceData->FlockBinding.Init(SystemInstance->GetInstanceParameters(), FlockParameter.Parameter);
+	return true;
+}
+
+void UNiagaraDataInterfaceFlock::DestroyPerInstanceData(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance)
+{
+	static_cast<NiagaraDataInterfaceFlock::FInstanceData*>(PerInstanceData)->~FInstanceData();
+}
+
+bool UNiagaraDataInterfaceFlock::PerInstanceTick(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance, float DeltaSeconds)
+{
+	NiagaraDataInterfaceFlock::FInstanceData* InstanceData = static_cast<NiagaraDataInterfaceFlock::FInstanceData*>(PerInstanceData);
+
+	const AFlock* Flock = Cast<AFlock>(InstanceData->FlockBinding.GetValue());
+	if (!Flock)
+	{
+		const USceneComponent* AttachComponent = SystemInstance->GetAttachComponent();
+		Flock = AttachComponent ? Cast<AFlock>(AttachComponent->GetOwner()) : nullptr;
+	}
+
+	InstanceData->Flock = Flock;
+	if (Flock)
+	{
+		// Boids are relative to the flock, Niagara positions to the system's large world tile.
+		InstanceData->FlockToSimulation = Flock->GetActorTransform();
+		InstanceData->FlockToSimulation.SetTranslation(FVector{SystemInstance->GetLWCConverter().ConvertWorldToSimulationPosition(Flock->GetActorLocation())});
+	}
+
+	// Nothing to reset, a missing flock just reads as empty.
+	return false;
+}
+
+bool UNiagaraDataInterfaceFlock::Equals(const UNiagaraDataInterface* Other) const
+{
+	return Super::Equals(Other) && CastChecked<const UNiagaraDataInterfaceFlock>(Other)->FlockParameter == FlockParameter;
+}
+
+bool UNiagaraDataInterfaceFlock::CopyToInternal(UNiagaraDataInterface* Destination) const
+{
+	if (!Super::CopyToInternal(Destination)) return false;
+
+	CastChecked<UNiagaraDataInterfaceFlock>(Destination)->FlockParameter = FlockParameter;
+	return true;
+}
+
+void UNiagaraDataInterfaceFlock::VMGetNumSlots(FVectorVMExternalFunctionContext& Context)
+{
+	VectorVM::FUserPtrHandler<NiagaraDataInterfaceFlock::FInstanceData> InstanceData{Context};
+	FNDIOutputParam<int32> OutNumSlots{Context};
+
+	int32 NumSlots = 0;
+	if (const AFlock* Flock = InstanceData->Flock.Get())
+	{
+		Flock->ReadBuffers([&NumSlots](const AFlock::FBufferViews& Buffers) -> void
+		{
+			NumSlots = Buffers.Locations.Num();
+		});
+	}
+
+	for (int32 i = 0; i < Context.GetNumInstances(); ++i)
+	{
+		OutNumSlots.SetAndAdvance(NumSlots);
+	}
+}
+
+void UNiagaraDataInterfaceFlock::VMGetNumBoids(FVectorVMExternalFunctionContext& Context)
+{
+	VectorVM::FUserPtrHandler<NiagaraDataInterfaceFlock::FInstanceData> InstanceData{Context};
+	FNDIOutputParam<int32> OutNumBoids{Context};
+
+	// Only changes between ticks, on the game thread, when spawns are applied under the flock's write lock.
+	int32 NumBoids = 0;
+	if (const AFlock* Flock = InstanceData->Flock.Get())
+	{
+		Flock->ReadBuffers([Flock, &NumBoids](const AFlock::FBufferViews&) -> void
+		{
+			NumBoids = Flock->GetNumBoids();
+		});
+	}
+
+	for (int32 i = 0; i < Context.GetNumInstances(); ++i)
+	{
+		OutNumBoids.SetAndAdvance(NumBoids);
+	}
+}
+
+void UNiagaraDataInterfaceFlock::VMGetBoid(FVectorVMExternalFunctionContext& Context)
+{
+	VectorVM::FUserPtrHandler<NiagaraDataInterfaceFlock::FInstanceData> InstanceData{Context};
+	FNDIInputParam<int32> InSlot{Context};
+	FNDIOutputParam<bool> OutAlive{Context};
+	FNDIOutputParam<FVector3f> OutPosition{Context};
+	FNDIOutputParam<FVector3f> OutDirection{Context};
+	FNDIOutputParam<int32> OutSpecies{Context};
+	FNDIOutputParam<int32> OutCluster{Context};
+
+	const int32 NumInstances = Context.GetNumInstances();
+
+	const auto WriteEmpty = [&]() -> void
+	{
+		OutAlive.SetAndAdvance(false);
+		OutPosition.SetAndAdvance(FVector3f::ZeroVector);
+		OutDirection.SetAndAdvance(FVector3f::ZeroVector);
+		OutSpecies.SetAndAdvance(0);
+		OutCluster.SetAndAdvance(INDEX_NONE);
+	};
+
+	const AFlock* Flock = InstanceData->Flock.Get();
+	if (!Flock)
+	{
+		for (int32 i = 0; i < NumInstances; ++i)
+		{
+			WriteEmpty();
+		}
+		return;
+	}
+
+	const FTransform& FlockToSimulation = InstanceData->FlockToSimulation;
+
+	// One lock for the whole batch. Every read goes straight to the flock's own buffers.
+	Flock->ReadBuffers([&](const AFlock::FBufferViews& Buffers) -> void
+	{
+		for (int32 i = 0; i < NumInstances; ++i)
+		{
+			const int32 Slot = InSlot.GetAndAdvance();
+			if (!Buffers.Locations.IsValidIndex(Slot) || !Buffers.Handles[Slot].IsValid())
+			{
+				WriteEmpty();
+				continue;
+			}
+
+			OutAlive.SetAndAdvance(true);
+			OutPosition.SetAndAdvance(FVector3f{FlockToSimulation.TransformPosition(Buffers.Locations[Slot])});
+			OutDirection.SetAndAdvance(FVector3f{FlockToSimulation.TransformVectorNoScale(Buffers.Directions[Slot])});
+			OutSpecies.SetAndAdvance(Buffers.Species[Slot]);
+			OutCluster.SetAndAdvance(Buffers.Clusters[Slot]);
+		}
+	});
+}
+
+#undef LOCTEXT_NAMESPACE
@@ -0,0 +1,58 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "NiagaraDataInterface.h"
+#include "NiagaraCommon.h"
+#include "NiagaraDataInterfaceFlock.generated.h"
+
+/**
+ * Lets CPU emitters read an AFlock's boids by slot, straight out of the simulation buffers, e.g. to spawn one particle per slot and follow it.
+ * Every function call holds the flock's read lock for its whole batch of particles, see AFlock::ReadBuffers. Positions and directions come out in simulation space.
+ * Slots are reassigned when the flock compacts them, so a particle following a slot can jump to another boid now and then.
+ */
+UCLASS(EditInlineNew, Category="Boids", meta=(DisplayName="Flock"))
+class BOIDSIMULATION_API UNiagaraDataInterfaceFlock : public UNiagaraDataInterface
+{
+	GENERATED_BODY()
+public:
+	UNiagaraDataInterfaceFlock();
+
+	// Object user parameter holding the flock. When unset, or not a flock, falls back to the actor the Niagara component is attached to.
+	UPROPERTY(EditAnywhere, Category="Flock")
+	FNiagaraUserParameterBinding FlockParameter;
+
+	virtual void PostInitProperties() override;
+
+	virtual bool CanExecuteOnTarget(ENiagaraSimTarget Target) const override
+	{
+		return Target == ENiagaraSimTarget::CPUSim;
+	}
+
+	virtual void GetVMExternalFunction(const FVMExternalFunctionBindingInfo& BindingInfo, void* InstanceData, FVMExternalFunction& OutFunc) override;
+
+	virtual int32 PerInstanceDataSize() const override;
+	virtual bool InitPerInstanceData(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance) override;
+	virtual void DestroyPerInstanceData(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance) override;
+	virtual bool PerInstanceTick(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance, float DeltaSeconds) override;
+
+	virtual bool HasPreSimulateTick() const override
+	{
+		return true;
+	}
+
+	virtual bool Equals(const UNiagaraDataInterface* Other) const override;
+
+protected:
+#if WITH_EDITORONLY_DATA
+	virtual void GetFunctionsInternal(TArray<FNiagaraFunctionSignature>& OutFunctions) const override;
+#endif
+
+	virtual bool CopyToInternal(UNiagaraDataInterface* Destination) const override;
+
+private:
+	static void VMGetNumSlots(FVectorVMExternalFunctionContext& Context);
+	static void VMGetNumBoids(FVectorVMExternalFunctionContext& Context);
+	static void VMGetBoid(FVectorVMExternalFunctionContext& Context);
+};
@@ -0,0 +1,113 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Tests/FlockTestAccess.h"
+#include "FlockCompactState.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockCompactStateRoundTripTest, "BoidSimulation.CompactState.RoundTrip", EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FFlockCompactStateRoundTripTest::RunTest(const FString& Parameters)
+{
+	constexpr double CellSize = 125.0;
+
+	// Both as documented on FFlockCompactBoid: half a quantization step per axis, and the 16 bit octahedral bound.
+	const double MaxLocationError = FMath::Sqrt(3.0) * CellSize / 65534.0 * (1.0 + 1e-9);
+	constexpr double MaxDirectionAngle = 6.5e-5;
+
+	constexpr int32 NumSamples = 200000;
+	const FRandomStream Random{0x5eed};
+	const FVector CellCenter{-250.0, 375.0, 1000.0};
+
+	double WorstLocationError = 0.0;
+	double WorstDirectionAngle = 0.0;
+	for (int32 i = 0; i < NumSamples; ++i)
+	{
+		const FVector Location = CellCenter + FVector{Random.FRandRange(-1.0, 1.0), Random.FRandRange(-1.0, 1.0), Random.FRandRange(-1.0, 1.0)} * CellSize;
+
+		FVector Direction = Random.GetUnitVector();
+		if (i % 4 == 0)
+		{
+			Direction.Z = 0.0;// On the fold
+			Direction = Direction.GetSafeNormal(UE_DOUBLE_SMALL_NUMBER, FVector::ForwardVector);
+		}
+
+		const FFlockCompactBoid Boid = FlockCompactState::Encode(Location, CellCenter, Direction, CellSize);
+		WorstLocationError = FMath::Max(WorstLocationError, FVector::Dist(FlockCompactState::DecodeLocation(Boid, CellCenter, CellSize), Location));
+
+		// The decoded direction is only float precision, which acos of the dot couldn't tell apart from the bound itself.
+		const FVector Decoded = FlockCompactState::DecodeDirection(Boid);
+		WorstDirectionAngle = FMath::Max(WorstDirectionAngle, FMath::Atan2((Decoded ^ Direction).Size(), Decoded | Direction));
+	}
+
+	TestTrue(FString::Printf(TEXT("Locations within %g of the original in %g unit cells, was %g"), MaxLocationError, CellSize, WorstLocationError), WorstLocationError <= MaxLocationError);
+	TestTrue(FString::Printf(TEXT("Directions within %g rad of the original, was %g"), MaxDirectionAngle, WorstDirectionAngle), WorstDirectionAngle <= MaxDirectionAngle);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockCompactStateDivergenceTest, "BoidSimulation.CompactState.Divergence", EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FFlockCompactStateDivergenceTest::RunTest(const FString& Parameters)
+{
+	// A second of simulation, over which a boid travels 10 units. Quantization alone moves trajectories by thousandths of a unit,
+	// the rest comes from the odd neighbor that lands on the other side of a radius or the half-space test and steers one boid differently for a step.
+	constexpr int32 NumSteps = 30;
+	constexpr float DeltaTime = 1.f / 30.f;
+	constexpr double MaxMeanDistance = 0.05;
+	constexpr double MaxDistance = 2.0;
+
+	// Wide enough radii that most boids have neighbors at this density.
+	FFlockSpecies Species;
+	Species.SeparationRadius = 50.f;
+	Species.AlignmentRadius = 150.f;
+	Species.CohesionRadius = 150.f;
+
+	FFlockTestWorld World;
+	AFlock& Flock = World.SpawnFlock(MakeArrayView(&Species, 1));
+	FFlockTestAccess::Scatter(Flock, 4000, 1);
+	const FFlockTestAccess::FSnapshot Start = FFlockTestAccess::Save(Flock);
+
+	const auto Run = [&](const bool bCompactState) -> TArray<FVector>
+	{
+		FFlockTestAccess::Restore(Flock, Start);
+		FFlockTestAccess::UseParameters(Flock, bCompactState, false);
+		for (int32 Step = 0; Step < NumSteps; ++Step)
+		{
+			FFlockTestAccess::StepSorted(Flock, DeltaTime);
+		}
+		return FFlockTestAccess::GetLocations(Flock);
+	};
+
+	const TArray<FVector> Reference = Run(false);
+	const TArray<FVector> Rerun = Run(false);
+	const TArray<FVector> Compact = Run(true);
+
+	int32 NumRerunMismatches = 0;
+	double WorstDistance = 0.0;
+	double SumDistance = 0.0;
+	int32 NumAlive = 0;
+	for (int32 Slot = 0; Slot < Reference.Num(); ++Slot)
+	{
+		if (!FFlockTestAccess::IsSlotAlive(Flock, Slot)) continue;
+
+		NumRerunMismatches += Rerun[Slot] != Reference[Slot];
+
+		const double Distance = FVector::Dist(Reference[Slot], Compact[Slot]);
+		WorstDistance = FMath::Max(WorstDistance, Distance);
+		SumDistance += Distance;
+		++NumAlive;
+	}
+	const double MeanDistance = SumDistance / FMath::Max(NumAlive, 1);
+
+	// Otherwise the comparison below would measure scheduling noise rather than the compact state.
+	TestEqual(TEXT("Full precision reruns from sorted cells match exactly"), NumRerunMismatches, 0);
+	TestTrue(FString::Printf(TEXT("Compact state trajectories within %g units of full precision on average, were %g"), MaxMeanDistance, MeanDistance), MeanDistance <= MaxMeanDistance);
+	TestTrue(FString::Printf(TEXT("Compact state trajectories within %g units of full precision, were %g"), MaxDistance, WorstDistance), WorstDistance <= MaxDistance);
+
+	return true;
+}
+
+#endif
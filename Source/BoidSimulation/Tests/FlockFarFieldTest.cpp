@@ -0,0 +1,66 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Tests/FlockTestAccess.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockFarFieldTest, "BoidSimulation.FarField.MatchesExactSteering", EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FFlockFarFieldTest::RunTest(const FString& Parameters)
+{
+	// With a single species and no field of view or half-space test every boid of a far cell is one the exact walk would count too, so the two only differ by summation order.
+	constexpr double MaxAngle = 1e-6;
+
+	// Radii have to span a few cells for any cell to be far. The second pair puts the separation ring past the nearest far cells.
+	// The scatter fills the whole bounds, which reach past the outermost cells' boxes, so boids near the edge have clamped boids in range too.
+	struct FCase
+	{
+		float SeparationRadius;
+		float FarRadius;
+	};
+	constexpr FCase Cases[] = {{25.f, 300.f}, {200.f, 400.f}};
+
+	for (const FCase& Case : Cases)
+	{
+		FFlockSpecies Species;
+		Species.SeparationRadius = Case.SeparationRadius;
+		Species.AlignmentRadius = Case.FarRadius;
+		Species.CohesionRadius = Case.FarRadius;
+		Species.bLegacyHalfSpace = false;
+
+		FFlockTestWorld World;
+		AFlock& Flock = World.SpawnFlock(MakeArrayView(&Species, 1));
+		FFlockTestAccess::Scatter(Flock, 4000, 1);
+		const FFlockTestAccess::FSnapshot Start = FFlockTestAccess::Save(Flock);
+		const int32 NumClampedBoids = FFlockTestAccess::CountClampedBoids(Flock);
+
+		FFlockTestAccess::UseParameters(Flock, false, false);
+		FFlockTestAccess::Step(Flock, 1.f / 30.f);
+		const TArray<FVector> Exact = FFlockTestAccess::GetDirections(Flock);
+
+		FFlockTestAccess::Restore(Flock, Start);
+		FFlockTestAccess::UseParameters(Flock, false, true);
+		const int32 NumFarFieldCells = FFlockTestAccess::CountFarFieldCells(Flock);
+		FFlockTestAccess::Step(Flock, 1.f / 30.f);
+		const TArray<FVector>& FarField = FFlockTestAccess::GetDirections(Flock);
+
+		double WorstAngle = 0.0;
+		for (int32 Slot = 0; Slot < Exact.Num(); ++Slot)
+		{
+			if (!FFlockTestAccess::IsSlotAlive(Flock, Slot)) continue;
+
+			WorstAngle = FMath::Max(WorstAngle, FMath::Acos(FMath::Clamp(Exact[Slot] | FarField[Slot], -1.0, 1.0)));
+		}
+
+		const FString Label = FString::Printf(TEXT("separation %g, alignment and cohesion %g"), Case.SeparationRadius, Case.FarRadius);
+		TestTrue(FString::Printf(TEXT("Far-field cells are used with %s"), *Label), NumFarFieldCells > 0);
+		TestTrue(FString::Printf(TEXT("Some boids lie past the edge of the grid with %s"), *Label), NumClampedBoids > 0);
+		TestTrue(FString::Printf(TEXT("Far-field steering within %g rad of exact with %s, was %g"), MaxAngle, *Label, WorstAngle), WorstAngle <= MaxAngle);
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockInstanceEncoding.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockInstanceEncodingTest, "BoidSimulation.InstanceEncoding.RoundTrip", EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FFlockInstanceEncodingTest::RunTest(const FString& Parameters)
+{
+	// The octahedral mapping itself only loses float rounding. Packing adds 12 bit quantization on top, documented at 1.1e-3 rad.
+	constexpr double MaxEncodedAngle = 1e-6;
+	constexpr double MaxPackedAngle = 1.1e-3;
+
+	constexpr int32 NumSamples = 200000;
+	const FRandomStream Random{0x5eed};
+
+	double WorstEncodedAngle = 0.0;
+	double WorstPackedAngle = 0.0;
+	int32 NumInexactPacks = 0;
+
+	// Through the cross product rather than acos of the dot, which can't resolve angles much under 1e-4 between float precision directions.
+	const auto Angle = [](const FVector& A, const FVector& B) -> double
+	{
+		return FMath::Atan2((A ^ B).Size(), A | B);
+	};
+
+	const auto Measure = [&](const FVector& Direction) -> void
+	{
+		WorstEncodedAngle = FMath::Max(WorstEncodedAngle, Angle(Direction, FlockInstanceEncoding::DecodeDirection(FlockInstanceEncoding::EncodeDirection(Direction))));
+
+		const float Packed = FlockInstanceEncoding::PackDirection(Direction);
+		NumInexactPacks += Packed != FMath::FloorToFloat(Packed) || Packed < 0.f || Packed >= 1 << 24;
+		WorstPackedAngle = FMath::Max(WorstPackedAngle, Angle(Direction, FlockInstanceEncoding::UnpackDirection(Packed)));
+	};
+
+	// The axes and the fold at the equator are where the mapping changes branch.
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		for (const double Sign : {-1.0, 1.0})
+		{
+			FVector Direction = FVector::ZeroVector;
+			Direction[Axis] = Sign;
+			Measure(Direction);
+		}
+	}
+
+	for (int32 i = 0; i < NumSamples; ++i)
+	{
+		FVector Direction = Random.GetUnitVector();
+		if (i % 4 == 0)
+		{
+			Direction.Z = 0.0;
+			Direction = Direction.GetSafeNormal(UE_DOUBLE_SMALL_NUMBER, FVector::ForwardVector);
+		}
+		Measure(Direction);
+	}
+
+	TestEqual(TEXT("Packed directions are integers a float holds exactly"), NumInexactPacks, 0);
+	TestTrue(FString::Printf(TEXT("Octahedral round trip within %g rad, was %g"), MaxEncodedAngle, WorstEncodedAngle), WorstEncodedAngle <= MaxEncodedAngle);
+	TestTrue(FString::Printf(TEXT("Packed round trip within %g rad, was %g"), MaxPackedAngle, WorstPackedAngle), WorstPackedAngle <= MaxPackedAngle);
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,144 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Tests/FlockTestAccess.h"
+#include "FlockCompactState.h"
+#include "Misc/AutomationTest.h"
+#include "Serialization/BitReader.h"
+#include "Serialization/BitWriter.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockReplicationPacketLossTest, "BoidSimulation.Replication.RecoversFromPacketLoss", EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FFlockReplicationPacketLossTest::RunTest(const FString& Parameters)
+{
+	// Spawned boids go through a rotation on the client, the rest arrive exactly as the server quantized them.
+	constexpr double MaxAngle = 1e-6;
+
+	FFlockTestWorld World;
+	AFlock& Server = World.SpawnFlock();
+	AFlock& Client = World.SpawnFlock();
+	FFlockTestAccess::Scatter(Server, 500, 1);
+	FFlockTestAccess::UseParameters(Server, false, false);
+
+	// Every boid that changed fits in every update, so the client should end up with all of the server's.
+	FFlockTestAccess::SetReplicationBytesPerSecond(Server, 1e9f);
+
+	const auto Send = [&Server](INetDeltaBaseState* OldState, TArray<uint8>& OutBytes, int64& OutNumBits) -> TSharedPtr<INetDeltaBaseState>
+	{
+		FBitWriter Writer{0, true};
+		TSharedPtr<INetDeltaBaseState> NewState = FFlockTestAccess::WriteReplicationUpdate(Server, OldState, Writer);
+		OutBytes = *Writer.GetBuffer();
+		OutNumBits = Writer.GetNumBits();
+		return NewState;
+	};
+
+	const auto Receive = [this, &Client](TArray<uint8>& Bytes, const int64 NumBits) -> void
+	{
+		FBitReader Reader{Bytes.GetData(), NumBits};
+		TestTrue(TEXT("Update is read back"), FFlockTestAccess::ReadReplicationUpdate(Client, Reader) && !Reader.IsError());
+	};
+
+	TArray<uint8> Bytes;
+	int64 NumBits;
+
+	const TSharedPtr<INetDeltaBaseState> Acked = Send(nullptr, Bytes, NumBits);
+	Receive(Bytes, NumBits);
+
+	// The lost update is the only one to remove some boids and add others.
+	TArray<FFlockBoidHandle> Despawned;
+	Server.ReadBuffers([&Despawned](const AFlock::FBufferViews& Buffers) -> void
+	{
+		for (int32 Slot = 0; Slot < Buffers.Handles.Num() && Despawned.Num() < 20; Slot += 7)
+		{
+			if (Buffers.Handles[Slot].IsValid())
+			{
+				Despawned.Add(Buffers.Handles[Slot]);
+			}
+		}
+	});
+	Server.DespawnBoids(Despawned);
+
+	TArray<FTransform> Spawns;
+	for (int32 i = 0; i < 20; ++i)
+	{
+		Spawns.Add(FTransform{FRotator{0.f, i * 18.f, 0.f}, FVector{i * 10.0, 0.0, 0.0}});
+	}
+	TArray<FFlockBoidHandle> Spawned;
+	Server.SpawnBoids(Spawns, Spawned);
+
+	FFlockTestAccess::ApplyPendingSpawns(Server);
+	FFlockTestAccess::Step(Server, 1.f / 30.f);
+	const TSharedPtr<INetDeltaBaseState> Lost = Send(Acked.Get(), Bytes, NumBits);
+
+	// Sent before the loss is noticed, so against the lost update's base. The client gets it.
+	FFlockTestAccess::Step(Server, 1.f / 30.f);
+	Send(Lost.Get(), Bytes, NumBits);
+	Receive(Bytes, NumBits);
+
+	// Once the loss is noticed the engine rolls the connection's base back to the one the lost update was written against.
+	FFlockTestAccess::Step(Server, 1.f / 30.f);
+	const TSharedPtr<INetDeltaBaseState> Resent = Send(Acked.Get(), Bytes, NumBits);
+	Receive(Bytes, NumBits);
+
+	// Boids that barely moved since the last update go out as small differences rather than in full.
+	FFlockTestAccess::Step(Server, 1.f / 240.f);
+	Send(Resent.Get(), Bytes, NumBits);
+	Receive(Bytes, NumBits);
+
+	// 11 bytes a boid in full and one for its reference age, not even counting ids.
+	const int64 FullBytes = Server.GetNumBoids() * 12;
+	TestTrue(FString::Printf(TEXT("Update after a short step is smaller than the boids in full, was %lld bytes against %lld"), (NumBits + 7) / 8, FullBytes), (NumBits + 7) / 8 < FullBytes);
+
+	TMap<FFlockBoidHandle, TPair<FVector, FVector>> ClientBoids;
+	Client.ReadBuffers([&ClientBoids](const AFlock::FBufferViews& Buffers) -> void
+	{
+		for (int32 Slot = 0; Slot < Buffers.Handles.Num(); ++Slot)
+		{
+			if (Buffers.Handles[Slot].IsValid())
+			{
+				ClientBoids.Add(Buffers.Handles[Slot], TPair<FVector, FVector>{Buffers.Locations[Slot], Buffers.Directions[Slot]});
+			}
+		}
+	});
+
+	TestEqual(TEXT("Client has as many boids as the server"), Client.GetNumBoids(), Server.GetNumBoids());
+
+	int32 NumMissing = 0;
+	double WorstDistance = 0.0;
+	double WorstAngle = 0.0;
+	Server.ReadBuffers([&](const AFlock::FBufferViews& Buffers) -> void
+	{
+		for (int32 Slot = 0; Slot < Buffers.Handles.Num(); ++Slot)
+		{
+			if (!Buffers.Handles[Slot].IsValid()) continue;
+
+			const TPair<FVector, FVector>* ClientBoid = ClientBoids.Find(Buffers.Handles[Slot]);
+			if (!ClientBoid)
+			{
+				++NumMissing;
+				continue;
+			}
+
+			const FFlockNetBoid Quantized = FlockReplication::Quantize(Buffers.Handles[Slot].Id, Buffers.Locations[Slot], Buffers.Directions[Slot], Buffers.Species[Slot], Server.GetBoundsRadius());
+			const FVector Location = FlockReplication::DequantizeLocation(Quantized, Server.GetBoundsRadius());
+			const FVector Direction = FlockCompactState::DecodeDirection(Quantized.Direction);
+
+			WorstDistance = FMath::Max(WorstDistance, FVector::Dist(Location, ClientBoid->Key));
+			WorstAngle = FMath::Max(WorstAngle, FMath::Atan2((Direction ^ ClientBoid->Value).Size(), Direction | ClientBoid->Value));
+		}
+	});
+
+	TestEqual(TEXT("Server boids missing on the client"), NumMissing, 0);
+	TestTrue(FString::Printf(TEXT("Client locations match the server's quantized ones, were off by %g"), WorstDistance), WorstDistance <= UE_DOUBLE_SMALL_NUMBER);
+	TestTrue(FString::Printf(TEXT("Client directions within %g rad of the server's quantized ones, was %g"), MaxAngle, WorstAngle), WorstAngle <= MaxAngle);
+	for (const FFlockBoidHandle& Handle : Despawned)
+	{
+		TestFalse(TEXT("Boid removed by the lost update is gone on the client"), ClientBoids.Contains(Handle));
+	}
+
+	return true;
+}
+
+#endif
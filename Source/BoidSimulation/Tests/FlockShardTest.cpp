@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Tests/FlockTestAccess.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockShardHaloTest, "BoidSimulation.Shard.HaloCoversSearchRadius", EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FFlockShardHaloTest::RunTest(const FString& Parameters)
+{
+	// One radius inside a single column, one spanning a few.
+	constexpr float SearchRadii[] = {50.f, 300.f};
+
+	for (const float SearchRadius : SearchRadii)
+	{
+		FFlockSpecies Species;
+		Species.SeparationRadius = SearchRadius * 0.5f;
+		Species.AlignmentRadius = SearchRadius;
+		Species.CohesionRadius = SearchRadius;
+
+		FFlockTestWorld World;
+		AFlock& Flock = World.SpawnFlock(MakeArrayView(&Species, 1));
+		FFlockTestAccess::Scatter(Flock, 4000, 1);
+		FFlockTestAccess::UseParameters(Flock, false, false);
+
+		const double MaxSearchRadius = FFlockTestAccess::GetMaxSearchRadius(Flock);
+		const int32 HaloCells = FFlockTestAccess::GetShardHaloCells(Flock);
+		const double CellSize = FFlockTestAccess::GetColumnStart(Flock, 1) - FFlockTestAccess::GetColumnStart(Flock, 0);
+		TestEqual(FString::Printf(TEXT("Halo columns for search radius %g"), MaxSearchRadius), HaloCells, FMath::Max(FMath::CeilToInt32(MaxSearchRadius / CellSize), 1));
+
+		// A slab in the middle of the grid, with neighbors on both sides.
+		const int32 CellDimensions = FFlockTestAccess::GetCellDimensions(Flock);
+		const int32 FirstCell = CellDimensions / 3;
+		const int32 LastCell = CellDimensions * 2 / 3;
+		const double SlabStart = FFlockTestAccess::GetColumnStart(Flock, FirstCell);
+		const double SlabEnd = FFlockTestAccess::GetColumnStart(Flock, LastCell);
+
+		for (int32 Side = 0; Side < FFlockShard::NumSides; ++Side)
+		{
+			FFlockShardMessage Message;
+			FFlockTestAccess::GatherShardBoids(Flock, Side, FirstCell, LastCell, 1, HaloCells, Message);
+
+			const double Border = Side == FFlockShard::Lower ? SlabStart : SlabEnd;
+			const TCHAR* SideName = Side == FFlockShard::Lower ? TEXT("lower") : TEXT("upper");
+
+			TSet<uint64> HaloIds;
+			double WorstHaloDistance = 0.0;
+			int32 NumHaloOutside = 0;
+			for (const FFlockShardBoid& Boid : Message.Halo)
+			{
+				HaloIds.Add(Boid.Id);
+				WorstHaloDistance = FMath::Max(WorstHaloDistance, FMath::Abs(Boid.Location.X - Border));
+				if (Boid.Location.X < SlabStart || Boid.Location.X >= SlabEnd)
+				{
+					++NumHaloOutside;
+				}
+			}
+
+			int32 NumMigrantsTooFar = 0;
+			for (const FFlockShardBoid& Boid : Message.Migrants)
+			{
+				const double PastBorder = Side == FFlockShard::Lower ? Border - Boid.Location.X : Boid.Location.X - Border;
+				if (PastBorder < 0.0 || PastBorder > CellSize)
+				{
+					++NumMigrantsTooFar;
+				}
+			}
+
+			// Every boid of the slab that a neighbor's boid right at the border could see.
+			int32 NumUnsent = 0;
+			Flock.ReadBuffers([&](const AFlock::FBufferViews& Buffers) -> void
+			{
+				for (int32 Slot = 0; Slot < Buffers.Handles.Num(); ++Slot)
+				{
+					if (!Buffers.Handles[Slot].IsValid()) continue;
+
+					const double X = Buffers.Locations[Slot].X;
+					if (X >= SlabStart && X < SlabEnd && FMath::Abs(X - Border) <= MaxSearchRadius && !HaloIds.Contains(Buffers.Handles[Slot].Id))
+					{
+						++NumUnsent;
+					}
+				}
+			});
+
+			const FString Label = FString::Printf(TEXT("search radius %g, %s side"), MaxSearchRadius, SideName);
+			TestTrue(FString::Printf(TEXT("Halo is not empty with %s"), *Label), !Message.Halo.IsEmpty());
+			TestEqual(FString::Printf(TEXT("Halo boids outside the slab with %s"), *Label), NumHaloOutside, 0);
+			TestTrue(FString::Printf(TEXT("Halo boids within %i columns of the border with %s, furthest was %g"), HaloCells, *Label, WorstHaloDistance), WorstHaloDistance <= HaloCells * CellSize);
+			TestEqual(FString::Printf(TEXT("Boids within the search radius of the border left out of the halo with %s"), *Label), NumUnsent, 0);
+			TestEqual(FString::Printf(TEXT("Migrants more than a column past the border with %s"), *Label), NumMigrantsTooFar, 0);
+		}
+	}
+
+	return true;
+}
+
+#endif
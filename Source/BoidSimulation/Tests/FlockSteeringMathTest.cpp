@@ -0,0 +1,57 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockSteeringMath.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockSteeringMathTest, "BoidSimulation.SteeringMath.FastMatchesExact", EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FFlockSteeringMathTest::RunTest(const FString& Parameters)
+{
+	// The bound SlerpNormalsFast documents.
+	constexpr double MaxSlerpAngle = 4e-4;
+
+	// DirectionToQuatFast is meant to be exact but for rounding. The engine's own SinCos is a polynomial, so the reference is only good to about 1e-7.
+	constexpr double MaxQuatAngle = 1e-6;
+
+	constexpr int32 NumSamples = 200000;
+	const FRandomStream Random{0x5eed};
+
+	double WorstSlerpAngle = 0.0;
+	double WorstQuatAngle = 0.0;
+
+	for (int32 i = 0; i < NumSamples; ++i)
+	{
+		const FVector A = Random.GetUnitVector();
+		FVector B = Random.GetUnitVector();
+		if ((A | B) < 0.0)
+		{
+			B = -B;// Only the documented domain. Outside of it the fast version is the exact one.
+		}
+		const double Alpha = Random.GetFraction();
+
+		const FVector ExactDirection = FlockSteeringMath::SlerpNormalsExact(A, B, Alpha);
+		const FVector FastDirection = FlockSteeringMath::SlerpNormalsFast(A, B, Alpha);
+		WorstSlerpAngle = FMath::Max(WorstSlerpAngle, FMath::Acos(FMath::Clamp(ExactDirection | FastDirection, -1.0, 1.0)));
+
+		// Angle of the rotation taking one to the other. |Dot| folds q and -q, which are the same rotation.
+		const FQuat ExactQuat = FlockSteeringMath::DirectionToQuatExact(A);
+		const FQuat FastQuat = FlockSteeringMath::DirectionToQuatFast(A);
+		WorstQuatAngle = FMath::Max(WorstQuatAngle, 2.0 * FMath::Acos(FMath::Min(FMath::Abs(ExactQuat | FastQuat), 1.0)));
+	}
+
+	TestTrue(FString::Printf(TEXT("SlerpNormalsFast within %g rad of exact, was %g"), MaxSlerpAngle, WorstSlerpAngle), WorstSlerpAngle <= MaxSlerpAngle);
+	TestTrue(FString::Printf(TEXT("DirectionToQuatFast within %g rad of exact, was %g"), MaxQuatAngle, WorstQuatAngle), WorstQuatAngle <= MaxQuatAngle);
+
+	// Outside the fitted domain the fast version must hand over to the exact one rather than extrapolate its fit.
+	const FVector A = FVector{1.0, 0.0, 0.0};
+	const FVector Opposite = FVector{-0.6, 0.8, 0.0};
+	TestTrue(TEXT("SlerpNormalsFast falls back past 90 degrees"), FlockSteeringMath::SlerpNormalsFast(A, Opposite, 0.3).Equals(FlockSteeringMath::SlerpNormalsExact(A, Opposite, 0.3), 0.0));
+	TestTrue(TEXT("SlerpNormalsFast falls back for Alpha past 1"), FlockSteeringMath::SlerpNormalsFast(A, FVector::UpVector, 1.5).Equals(FlockSteeringMath::SlerpNormalsExact(A, FVector::UpVector, 1.5), 0.0));
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,158 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Tests/FlockTestAccess.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+
+FFlockTestWorld::FFlockTestWorld()
+	: World{UWorld::CreateWorld(EWorldType::Game, false)}
+{
+	GEngine->CreateNewWorldContext(EWorldType::Game).SetCurrentWorld(World);
+}
+
+FFlockTestWorld::~FFlockTestWorld()
+{
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+}
+
+AFlock& FFlockTestWorld::SpawnFlock(const TConstArrayView<FFlockSpecies>& Species)
+{
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+	AFlock* Flock = World->SpawnActor<AFlock>(SpawnParameters);
+	check(Flock);
+
+	Flock->Species = TArray<FFlockSpecies>(Species);
+	Flock->InitializeSimulation();
+	return *Flock;
+}
+
+void FFlockTestAccess::Scatter(AFlock& Flock, const int32 NumBoids, const int32 Seed)
+{
+	Flock.NumInstances = NumBoids;
+	Flock.ScatterBoids(FRandomStream{Seed});
+}
+
+void FFlockTestAccess::UseParameters(AFlock& Flock, const bool bCompactState, const bool bFarField)
+{
+	const TSharedRef<AFlock::FParameterBlock, ESPMode::ThreadSafe> Block = MakeShared<AFlock::FParameterBlock, ESPMode::ThreadSafe>(*Flock.BuildParameters());
+	Block->bCompactState = bCompactState;
+	Block->bFarField = bFarField;
+	for (int32 SpeciesIndex = 0; SpeciesIndex < Block->SpeciesKernels.Num(); ++SpeciesIndex)
+	{
+		Block->SpeciesKernels[SpeciesIndex] = AFlock::GetSteerKernel(Block->SpeciesRules[SpeciesIndex].RuleMask, bCompactState);
+	}
+
+	Flock.Parameters = Block;
+	Flock.bParametersDirty = false;
+}
+
+void FFlockTestAccess::Step(AFlock& Flock, const float DeltaTime)
+{
+	Flock.SimulateAsynchronously(DeltaTime);
+}
+
+void FFlockTestAccess::StepSorted(AFlock& Flock, const float DeltaTime)
+{
+	Flock.SortBoidCells();
+	Flock.SimulateAsynchronously(DeltaTime);
+}
+
+FFlockTestAccess::FSnapshot FFlockTestAccess::Save(const AFlock& Flock)
+{
+	return FSnapshot{Flock.BoidLocations, Flock.BoidDirections, Flock.BoidCells};
+}
+
+void FFlockTestAccess::Restore(AFlock& Flock, const FSnapshot& Snapshot)
+{
+	Flock.BoidLocations = Snapshot.Locations;
+	Flock.BoidDirections = Snapshot.Directions;
+	Flock.BoidCells = Snapshot.Cells;
+}
+
+void FFlockTestAccess::ApplyPendingSpawns(AFlock& Flock)
+{
+	Flock.ApplyPendingSpawnRequests();
+}
+
+void FFlockTestAccess::SetReplicationBytesPerSecond(AFlock& Flock, const float BytesPerSecond)
+{
+	Flock.ReplicationBytesPerSecond = BytesPerSecond;
+}
+
+TSharedPtr<INetDeltaBaseState> FFlockTestAccess::WriteReplicationUpdate(AFlock& Flock, INetDeltaBaseState* OldState, FBitWriter& Writer)
+{
+	Flock.ReplicatedState.SnapshotFrame = MAX_uint64;
+
+	TSharedPtr<INetDeltaBaseState> NewState;
+	FNetDeltaSerializeInfo DeltaParms;
+	DeltaParms.Writer = &Writer;
+	DeltaParms.OldState = OldState;
+	DeltaParms.NewState = &NewState;
+	DeltaParms.Object = &Flock;
+	return Flock.ReplicatedState.NetDeltaSerialize(DeltaParms) ? NewState : nullptr;
+}
+
+bool FFlockTestAccess::ReadReplicationUpdate(AFlock& Flock, FBitReader& Reader)
+{
+	FNetDeltaSerializeInfo DeltaParms;
+	DeltaParms.Reader = &Reader;
+	DeltaParms.Object = &Flock;
+	return Flock.ReplicatedState.NetDeltaSerialize(DeltaParms);
+}
+
+double FFlockTestAccess::GetColumnStart(const AFlock& Flock, const int32 CellX)
+{
+	return Flock.GetCellLocation(FIntVector{CellX, 0, 0}).X - AFlock::CELL_SIZE * 0.5;
+}
+
+double FFlockTestAccess::GetMaxSearchRadius(const AFlock& Flock)
+{
+	double MaxSearchRadius = 0.0;
+	for (const AFlock::FBoidSpeciesRules& Rules : Flock.Parameters->SpeciesRules)
+	{
+		MaxSearchRadius = FMath::Max(MaxSearchRadius, Rules.SearchRadius);
+	}
+	return MaxSearchRadius;
+}
+
+int32 FFlockTestAccess::CountClampedBoids(const AFlock& Flock)
+{
+	int32 NumClamped = 0;
+	for (int32 Slot = 0; Slot < Flock.GetNumSlots(); ++Slot)
+	{
+		if (!Flock.IsSlotAlive(Slot)) continue;
+
+		const FVector Offset = (Flock.BoidLocations[Slot] - Flock.GetCellLocation(Flock.GetCellCoordinates(Flock.BoidLocations[Slot]))).GetAbs();
+		if (Offset.GetMax() > AFlock::CELL_SIZE * 0.5)
+		{
+			++NumClamped;
+		}
+	}
+	return NumClamped;
+}
+
+int32 FFlockTestAccess::CountFarFieldCells(const AFlock& Flock)
+{
+	const AFlock::FParameterBlock& Params = *Flock.Parameters;
+
+	int32 NumCells = 0;
+	for (int32 Slot = 0; Slot < Flock.GetNumSlots(); ++Slot)
+	{
+		if (!Flock.IsSlotAlive(Slot)) continue;
+
+		const AFlock::FBoidSpeciesRules& Rules = Params.SpeciesRules[Flock.BoidSpecies[Slot]];
+		const double NearRadius = (Rules.RuleMask & AFlock::RuleSeparation) != 0 ? Rules.SeparationRadius : 0.0;
+		Flock.ForEachNearbyCell(Flock.BoidLocations[Slot], Rules.SearchRadius, Rules.FarFieldRadius, NearRadius,
+			[](const int32, const FVector&) -> void {}, [&NumCells](const int32) -> void { ++NumCells; });
+	}
+	return NumCells;
+}
+
+#endif
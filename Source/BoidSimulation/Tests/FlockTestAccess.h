@@ -0,0 +1,108 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Flock.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+// A game world of its own for a test to spawn flocks into. Never begins play, so nothing in it ticks, and is torn down with everything in it.
+class FFlockTestWorld
+{
+public:
+	FFlockTestWorld();
+	FFlockTestWorld(const FFlockTestWorld&) = delete;
+	FFlockTestWorld& operator=(const FFlockTestWorld&) = delete;
+	~FFlockTestWorld();
+
+	// The flock's grid is sized, but it has no boids and keeps its ISM empty.
+	UE_NODISCARD AFlock& SpawnFlock(const TConstArrayView<FFlockSpecies>& Species = {});
+
+private:
+	UWorld* World;
+};
+
+// Reaches into AFlock for tests, which drive the simulation a step at a time rather than through Tick.
+struct FFlockTestAccess
+{
+	// Adds NumBoids boids at once, spread over the bounds like on BeginPlay.
+	static void Scatter(AFlock& Flock, const int32 NumBoids, const int32 Seed);
+
+	// Resolves the parameter block as a tick would, with the given switches rather than the console variables'.
+	static void UseParameters(AFlock& Flock, const bool bCompactState, const bool bFarField);
+
+	static void Step(AFlock& Flock, const float DeltaTime);
+
+	// Sorts the cells first, like a lockstep step, so reruns from the same state match bit for bit.
+	static void StepSorted(AFlock& Flock, const float DeltaTime);
+
+	UE_NODISCARD static const TArray<FVector>& GetLocations(const AFlock& Flock)
+	{
+		return Flock.BoidLocations;
+	}
+
+	UE_NODISCARD static const TArray<FVector>& GetDirections(const AFlock& Flock)
+	{
+		return Flock.BoidDirections;
+	}
+
+	UE_NODISCARD static bool IsSlotAlive(const AFlock& Flock, const int32 Slot)
+	{
+		return Flock.IsSlotAlive(Slot);
+	}
+
+	// Everything a step changes, to rewind the flock to.
+	struct FSnapshot
+	{
+		TArray<FVector> Locations;
+		TArray<FVector> Directions;
+		TArray<TArray<int32, TInlineAllocator<4>>> Cells;
+	};
+
+	UE_NODISCARD static FSnapshot Save(const AFlock& Flock);
+	static void Restore(AFlock& Flock, const FSnapshot& Snapshot);
+
+	// Lets spawns and despawns through, like the start of a tick.
+	static void ApplyPendingSpawns(AFlock& Flock);
+
+	static void SetReplicationBytesPerSecond(AFlock& Flock, const float BytesPerSecond);
+
+	/**
+	 * Writes the flock's next replication update for a connection whose base is OldState, null for a new connection, as the server would.
+	 * Returns the connection's new base, null when there was nothing to send. Snapshots the flock again every time rather than once per frame.
+	 */
+	UE_NODISCARD static TSharedPtr<INetDeltaBaseState> WriteReplicationUpdate(AFlock& Flock, INetDeltaBaseState* OldState, FBitWriter& Writer);
+
+	// Applies an update written by WriteReplicationUpdate to a client's flock.
+	static bool ReadReplicationUpdate(AFlock& Flock, FBitReader& Reader);
+
+	UE_NODISCARD static int32 GetCellDimensions(const AFlock& Flock)
+	{
+		return Flock.GetCellDimensions();
+	}
+
+	// Where grid column CellX starts along X, relative to the flock.
+	UE_NODISCARD static double GetColumnStart(const AFlock& Flock, const int32 CellX);
+
+	// Of the current parameter block, the largest over every species.
+	UE_NODISCARD static double GetMaxSearchRadius(const AFlock& Flock);
+
+	UE_NODISCARD static int32 GetShardHaloCells(const AFlock& Flock)
+	{
+		return FFlockShard::GetHaloCells(Flock);
+	}
+
+	static void GatherShardBoids(const AFlock& Flock, const int32 Side, const int32 FirstCell, const int32 LastCell, const int32 MigrantCells, const int32 HaloCells, FFlockShardMessage& OutMessage)
+	{
+		FFlockShard::GatherBoids(Flock, TSet<FFlockBoidHandle>{}, Side, FirstCell, LastCell, MigrantCells, HaloCells, OutMessage);
+	}
+
+	// Boids outside the box of the grid cell they're filed under, which only happens past the edge of the grid.
+	UE_NODISCARD static int32 CountClampedBoids(const AFlock& Flock);
+
+	// How many times steering would take a whole cell's aggregate rather than walking its boids, summed over every boid.
+	UE_NODISCARD static int32 CountFarFieldCells(const AFlock& Flock);
+};
+
+#endif
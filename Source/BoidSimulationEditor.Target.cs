@@ -10,6 +10,6 @@ public class BoidSimulationEditorTarget : TargetRules
 		Type = TargetType.Editor;
 		DefaultBuildSettings = BuildSettingsVersion.V4;
 
-		ExtraModuleNames.AddRange( new string[] { "BoidSimulation" } );
+		ExtraModuleNames.AddRange( new string[] { "BoidSimulation", "BoidSimulationShaders" } );
 	}
 }
@@ -0,0 +1,21 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Misc/Paths.h"
+#include "Modules/ModuleManager.h"
+#include "ShaderCore.h"
+
+/**
+ * Maps the project's shader directory, which has to happen before the engine compiles any shaders, so in PostConfigInit rather than the
+ * Default phase the game module loads in.
+ */
+class FBoidSimulationShadersModule : public IModuleInterface
+{
+public:
+	virtual void StartupModule() override
+	{
+		// Lets materials include /BoidSimulation/FlockInstanceEncoding.ush.
+		AddShaderSourceDirectoryMapping(TEXT("/BoidSimulation"), FPaths::Combine(FPaths::ProjectDir(), TEXT("Shaders")));
+	}
+};
+
+IMPLEMENT_MODULE(FBoidSimulationShadersModule, BoidSimulationShaders);